@@ -0,0 +1,105 @@
+#include "arena.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+// Something with the strictest alignment of the basic types
+typedef union {
+	long double d;
+	long long l;
+	void* p;
+} Aligned;
+
+#define ALIGN sizeof(Aligned)
+
+struct ArenaBlock {
+	ArenaBlock* next;
+	size_t size;
+	size_t at;
+	Aligned data[];
+};
+
+Arena* Arena_Create(size_t blockSize)
+{
+	Arena* me = calloc(1, sizeof(Arena));
+	if(!me) return NULL;
+
+	me->blockSize = blockSize;
+	return me;
+}
+
+void Arena_Destroy(Arena** me)
+{
+	ArenaBlock* b = (*me)->blocks;
+	while(b){
+		ArenaBlock* next = b->next;
+		free(b);
+		b = next;
+	}
+
+	free(*me);
+	*me = NULL;
+}
+
+void Arena_Clear(Arena* me)
+{
+	if(!me->blocks) return;
+
+	// Keep the oldest block, it's the one that's always needed
+	ArenaBlock* b = me->blocks;
+	while(b->next){
+		ArenaBlock* next = b->next;
+		me->size -= b->size;
+		free(b);
+		b = next;
+	}
+
+	b->at = 0;
+	me->blocks = b;
+	me->used = 0;
+}
+
+void* Arena_Alloc(Arena* me, size_t size)
+{
+	size = (size + ALIGN - 1) / ALIGN * ALIGN;
+
+	ArenaBlock* b = me->blocks;
+
+	if(!b || b->at + size > b->size){
+		// Big allocations get a block of their own
+		size_t blockSize = size > me->blockSize ? size : me->blockSize;
+
+		b = malloc(sizeof(ArenaBlock) + blockSize);
+		if(!b) return NULL;
+
+		b->size = blockSize;
+		b->at = 0;
+
+		// A big block goes behind the current one, so the rest of that can still be used
+		if(me->blocks && size > me->blockSize){
+			b->next = me->blocks->next;
+			me->blocks->next = b;
+		}else{
+			b->next = me->blocks;
+			me->blocks = b;
+		}
+
+		me->size += blockSize;
+		if(me->size > me->peak) me->peak = me->size;
+	}
+
+	void* p = (uint8_t*)b->data + b->at;
+	b->at += size;
+	me->used += size;
+
+	return p;
+}
+
+char* Arena_StrDup(Arena* me, const char* str)
+{
+	size_t len = strlen(str) + 1;
+	char* s = Arena_Alloc(me, len);
+	if(s) memcpy(s, str, len);
+	return s;
+}
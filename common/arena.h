@@ -0,0 +1,31 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+// A bump allocator: memory is taken from large blocks and only given back
+// all at once, with Arena_Clear or Arena_Destroy
+
+typedef struct ArenaBlock ArenaBlock;
+
+typedef struct Arena {
+	ArenaBlock* blocks;   // newest first
+	size_t blockSize;
+
+	size_t used;          // bytes handed out since the last clear
+	size_t peak;          // most bytes of blocks held at once
+	size_t size;          // bytes of blocks held now
+} Arena;
+
+// Returns NULL if out of memory
+Arena* Arena_Create(size_t blockSize);
+void Arena_Destroy(Arena** me);
+
+// Frees everything allocated, the first block is kept for reuse
+void Arena_Clear(Arena* me);
+
+// Returns NULL if out of memory, the memory is aligned for any type
+void* Arena_Alloc(Arena* me, size_t size);
+char* Arena_StrDup(Arena* me, const char* str);
+
+#endif
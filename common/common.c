@@ -1,50 +1,5 @@
 #include "common.h"
 
-void WriteRam(uint16_t* ram, const char* filename, uint16_t end, DByteOrder bo)
-{
-	FILE* out = fopen(filename, "wb");
-	LAssert(out, "could not open new file for writing: %s", filename);
-
-	for(int i = 0; i < end + 1; i++){
-		if(bo == DBO_LittleEndian){
-			LogD("%02x %02x", ram[i] & 0xff, (ram[i] >> 8) & 0xff);
-			fputc(ram[i] & 0xff, out);
-			fputc((ram[i] >> 8) & 0xff, out);
-		} else {
-			fputc((ram[i] >> 8) & 0xff, out);
-			fputc(ram[i] & 0xff, out);
-		}
-	}
-
-	fclose(out);
-}
-
-int LoadRamMax(uint16_t* ram, const char* filename, uint16_t lastAddr, DByteOrder bo)
-{
-	FILE* f = fopen(filename, "r");
-	LAssert(f, "could not open file: %s", filename);
-	
-	int addr = 0;
-
-	for(;;){
-		int c1 = 0, c2 = 0;
-		if((c1 = fgetc(f)) == EOF || (c2 = fgetc(f)) == EOF) break;
-		if(bo == DBO_LittleEndian) 	ram[addr] = (c2 & 0xff) << 8 | (c1 & 0xff);
-		else 				ram[addr] = (c1 & 0xff) << 8 | (c2 & 0xff);
-		if(addr >= lastAddr) break;
-		addr++;
-	}
-
-	fclose(f);
-
-	return (int)addr + 1;
-}
-
-void LoadRam(uint16_t* ram, const char* filename)
-{
-	LoadRamMax(ram, filename, 0xffff, DBO_LittleEndian);
-}
-
 uint16_t GetUsedRam(uint16_t* ram)
 {
 	int end = 0xffff;
@@ -62,11 +17,6 @@ void DumpRam(uint16_t* ram, uint16_t end)
 	printf("\n\n");
 }
 
-bool opHasNextWord(uint16_t v){ 
-	return (v >= DV_RefRegNextWordBase && v <= DV_RefRegNextWordTop) 
-		|| v == DV_RefNextWord || v == DV_NextWord; 
-}
-
 char* StrReplace(char* target, const char* str, const char* what, const char* with)
 {
 	const char* ss = strstr(str, what);
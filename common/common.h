@@ -11,17 +11,18 @@
 #include "dcpu16ins.h"
 #include "log.h"
 #include "cvector.h"
+#include "ramio.h"
 
 extern int logLevel;
-typedef enum {DBO_LittleEndian, DBO_BigEndian } DByteOrder;
 
 uint16_t GetUsedRam(uint16_t* ram);
 void DumpRam(uint16_t* ram, uint16_t end);
-void WriteRam(uint16_t* ram, const char* filename, uint16_t len, DByteOrder bo);
-void LoadRam(uint16_t* ram, const char* filename);
-bool opHasNextWord(uint16_t v);
+
+#define opHasNextWord(__v) \
+	(((__v) >= DV_RefRegNextWordBase && (__v) <= DV_RefRegNextWordTop) \
+	|| (__v) == DV_RefNextWord || (__v) == DV_NextWord)
+
 char* StrReplace(char* target, const char* str, const char* what, const char* with);
 long FileSize(const char* filename);
-int LoadRamMax(uint16_t* ram, const char* filename, uint16_t lastAddr, DByteOrder bo);
 
 #endif
@@ -3,6 +3,27 @@
 
 #include <string.h>
 #include <stdlib.h>
+#include <stdbool.h>
+
+// A growable array of any type, declared with Vector(type) and used through
+// the macros below. Nothing is allocated until the first element is added,
+// after that the capacity doubles as needed.
+//
+// By default the memory comes from realloc/free. An allocator (eg. an arena
+// or a pool) can be given with Vector_InitExt, it gets the data pointer with
+// every call. mfree may be NULL for allocators that free everything at once.
+// Growing then allocates a new buffer and copies, as there's no realloc.
+//
+// The elements are never stored in the vector itself: vectors are copied by
+// value (eg. a struct holding one added to another vector), which would
+// leave elems pointing into the old copy.
+//
+// Nothing here aborts or exits when out of memory: the macros that allocate
+// evaluate to false instead and leave the vector as it was, it's up to the
+// caller to check.
+
+typedef void* (*VectorAlloc)(void* data, size_t size);
+typedef void (*VectorFree)(void* data, void* ptr);
 
 #define Vector(type) \
 	struct type ## _vec_s\
@@ -11,49 +32,129 @@
 		type* elems;\
 		int pAllocCount;\
 		int pElemSize;\
-		void* (*mmalloc)(size_t size);\
-		void (*mfree)(void* ptr);\
+		VectorAlloc mmalloc;\
+		VectorFree mfree;\
+		void* mdata;\
+	}
+
+// Changes the allocation to hold exactly allocCount elements, returns false
+// and keeps the old buffer if out of memory
+static inline bool Vector_pResize(void** elems, int* pAllocCount, int count, int elemSize, int allocCount,
+	VectorAlloc mmalloc, VectorFree mfree, void* mdata)
+{
+	void* buffer = NULL;
+
+	if(allocCount > 0){
+		if(!mmalloc) buffer = realloc(*elems, (size_t)allocCount * elemSize);
+		else{
+			buffer = mmalloc(mdata, (size_t)allocCount * elemSize);
+			if(buffer && *elems) memcpy(buffer, *elems, (size_t)(count < allocCount ? count : allocCount) * elemSize);
+		}
+		if(!buffer) return false;
+	}
+
+	if(!mmalloc){
+		if(allocCount == 0) free(*elems);
 	}
+	else if(mfree && *elems) mfree(mdata, *elems);
+
+	*elems = buffer;
+	*pAllocCount = allocCount;
+	return true;
+}
+
+static inline bool Vector_pReserve(void** elems, int* pAllocCount, int count, int elemSize, int need,
+	VectorAlloc mmalloc, VectorFree mfree, void* mdata)
+{
+	if(need <= *pAllocCount) return true;
+	return Vector_pResize(elems, pAllocCount, count, elemSize, need, mmalloc, mfree, mdata);
+}
+
+static inline bool Vector_pShrink(void** elems, int* pAllocCount, int count, int elemSize,
+	VectorAlloc mmalloc, VectorFree mfree, void* mdata)
+{
+	if(count == *pAllocCount) return true;
+	return Vector_pResize(elems, pAllocCount, count, elemSize, count, mmalloc, mfree, mdata);
+}
+
+// Makes room for at least need elements, doubling the capacity so that
+// adding one at a time stays linear
+static inline bool Vector_pGrow(void** elems, int* pAllocCount, int count, int elemSize, int need,
+	VectorAlloc mmalloc, VectorFree mfree, void* mdata)
+{
+	if(need <= *pAllocCount) return true;
+
+	int allocCount = *pAllocCount ? *pAllocCount * 2 : 8;
+	if(allocCount < need) allocCount = need;
+
+	return Vector_pResize(elems, pAllocCount, count, elemSize, allocCount, mmalloc, mfree, mdata);
+}
 
-#define Vector_InitExt(vec, type, _count, _mmalloc, _mfree) \
+static inline bool Vector_pAppend(void** elems, int* pAllocCount, int* count, int elemSize, const void* src, int n,
+	VectorAlloc mmalloc, VectorFree mfree, void* mdata)
+{
+	if(n <= 0) return true;
+	if(!Vector_pGrow(elems, pAllocCount, *count, elemSize, *count + n, mmalloc, mfree, mdata)) return false;
+
+	memcpy((char*)*elems + (size_t)*count * elemSize, src, (size_t)n * elemSize);
+	*count += n;
+	return true;
+}
+
+#define Vector_pArgs(vec) \
+	(void**)&(vec).elems, &(vec).pAllocCount, (vec).count, (vec).pElemSize
+
+#define Vector_pHooks(vec) (vec).mmalloc, (vec).mfree, (vec).mdata
+
+// _count is how many elements to allocate room for up front, may be 0. Check
+// with Vector_Reserve afterwards if that has to succeed.
+#define Vector_InitExt(vec, type, _count, _mmalloc, _mfree, _mdata) \
 	do{\
 		(vec).count = 0;\
+		(vec).elems = NULL;\
+		(vec).pAllocCount = 0;\
 		(vec).pElemSize = sizeof(type);\
 		(vec).mmalloc = (_mmalloc);\
 		(vec).mfree = (_mfree);\
-		(vec).elems = (vec).mmalloc((vec).pElemSize * (_count));\
-		(vec).pAllocCount = (_count);\
-	}while(0);
+		(vec).mdata = (_mdata);\
+		Vector_Reserve(vec, _count);\
+	}while(0)
+
+#define Vector_Init(vec, type) Vector_InitExt(vec, type, 0, NULL, NULL, NULL)
+
+// Makes sure n elements fit without allocating, false if out of memory
+#define Vector_Reserve(vec, n) Vector_pReserve(Vector_pArgs(vec), (n), Vector_pHooks(vec))
+
+// Makes sure n more elements fit, growing like adding them would, false if
+// out of memory. Once it succeeds adding those can't fail.
+#define Vector_Grow(vec, n) Vector_pGrow(Vector_pArgs(vec), (vec).count + (n), Vector_pHooks(vec))
 
-#define Vector_Init(vec, type) Vector_InitExt(vec, type, 256, malloc, free)
+// Gives back the memory that isn't used
+#define Vector_Shrink(vec) Vector_pShrink(Vector_pArgs(vec), Vector_pHooks(vec))
 
+// Adds an element, false if out of memory
 #define Vector_Add(vec, elem) \
-	do{\
-		if((vec).pAllocCount <= (vec).count + 1){ \
-			void* __tmpbuffer = (vec).mmalloc((vec).pElemSize * (vec).pAllocCount * 2); \
-			memcpy(__tmpbuffer, (vec).elems, (vec).pAllocCount * (vec).pElemSize);\
-			(vec).pAllocCount *= 2;\
-			(vec).mfree((vec).elems);\
-			(vec).elems = __tmpbuffer;\
-		}\
-		(vec).elems[(vec).count++] = (elem);\
-	}while(0)\
+	(((vec).count < (vec).pAllocCount || Vector_Grow(vec, 1)) && ((vec).elems[(vec).count++] = (elem), true))
+
+// Adds n elements from an array of the same type, false if out of memory
+#define Vector_Append(vec, _src, n) \
+	Vector_pAppend((void**)&(vec).elems, &(vec).pAllocCount, &(vec).count, (vec).pElemSize, (_src), (n), Vector_pHooks(vec))
 
 #define Vector_Remove(vec, _at) \
 	do{\
-		for(int i = 0; i < vec.count - _at - 1; i++){ \
-			memcpy(vec.elems + _at + i, vec.elems + _at + i + 1, vec.pElemSize); \
-		} \
-		vec.count--;\
-	}while(0);
-
-#define Vector_Concat(vec, src)\
-	for(int i = 0; i < (src).count; i++){\
-		Vector_Add((vec), (src).elems[i])\
-	}
+		int __at = (_at);\
+		memmove((vec).elems + __at, (vec).elems + __at + 1, (size_t)((vec).count - __at - 1) * (vec).pElemSize);\
+		(vec).count--;\
+	}while(0)
+
+#define Vector_Concat(vec, src) Vector_Append(vec, (src).elems, (src).count)
 
 #define Vector_ForEach(vec, _iterator) for(_iterator = (vec).elems; (_iterator) < (vec).elems + (vec).count; (_iterator)++)
 
-#define Vector_Free(vec) (vec).mfree((vec).elems)
+#define Vector_Free(vec) \
+	do{\
+		Vector_pResize(Vector_pArgs(vec), 0, Vector_pHooks(vec));\
+		(vec).count = 0;\
+	}while(0)
 
 #endif
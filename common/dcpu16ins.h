@@ -11,15 +11,19 @@ typedef enum {
 	DI_ExtReserved, DI_ExtJsr,
 
 	// Dtools Extended instructions
-	DI_ExtSys
+	DI_ExtSys,
+
+	// Interrupts, from version 1.7 of the spec
+	DI_ExtInt, DI_ExtIag, DI_ExtIas, DI_ExtRfi, DI_ExtIaq
 } DIns;
 
-#define DINS_NUM (DI_ExtSys + 1)
+#define DINS_NUM (DI_ExtIaq + 1)
 #define DINS_NUM_BASIC (DI_Ifb + 1)
 #define DINS_EXT_BASE (DI_ExtReserved)
 
 #define DINSNAMES {"NONBASIC", "SET", "ADD", "SUB", "MUL", "DIV", "MOD", "SHL", "SHR", \
-	"AND", "BOR", "XOR", "IFE", "IFN", "IFG", "IFB", "RESERVED_EXTENDED", "JSR", "SYS"}
+	"AND", "BOR", "XOR", "IFE", "IFN", "IFG", "IFB", "RESERVED_EXTENDED", "JSR", "SYS", \
+	"INT", "IAG", "IAS", "RFI", "IAQ"}
 
 // Value encoding
 typedef enum {
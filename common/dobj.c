@@ -0,0 +1,385 @@
+#include "dobj.h"
+
+DObj* DObj_Create()
+{
+	DObj* me = calloc(1, sizeof(DObj));
+	if(!me) return NULL;
+
+	Vector_Init(me->code, uint16_t);
+	Vector_Init(me->exports, DObjSymbol);
+	Vector_Init(me->imports, DObjStr);
+	Vector_Init(me->relocs, DObjReloc);
+	Vector_Init(me->debug, DObjDebug);
+	Vector_Init(me->defines, DObjDefine);
+	Vector_Init(me->deps, DObjDep);
+	Vector_Init(me->written, DObjRun);
+
+	return me;
+}
+
+void DObj_Shrink(DObj* me)
+{
+	Vector_Shrink(me->code);
+	Vector_Shrink(me->exports);
+	Vector_Shrink(me->imports);
+	Vector_Shrink(me->relocs);
+	Vector_Shrink(me->debug);
+	Vector_Shrink(me->defines);
+	Vector_Shrink(me->deps);
+	Vector_Shrink(me->written);
+}
+
+void DObj_Destroy(DObj** me)
+{
+	DObj* o = *me;
+
+	DObjSymbol* sit;
+	Vector_ForEach(o->exports, sit){ free(sit->name); free(sit->file); }
+
+	DObjStr* iit;
+	Vector_ForEach(o->imports, iit) free(*iit);
+
+	DObjReloc* rit;
+	Vector_ForEach(o->relocs, rit) free(rit->symbol);
+
+	DObjDebug* dit;
+	Vector_ForEach(o->debug, dit){ free(dit->file); free(dit->labels); }
+
+	DObjDefine* fit;
+	Vector_ForEach(o->defines, fit){ free(fit->searchReplace[0]); free(fit->searchReplace[1]); }
+
+	DObjDep* pit;
+	Vector_ForEach(o->deps, pit) free(pit->file);
+
+	Vector_Free(o->code);
+	Vector_Free(o->exports);
+	Vector_Free(o->imports);
+	Vector_Free(o->relocs);
+	Vector_Free(o->debug);
+	Vector_Free(o->defines);
+	Vector_Free(o->deps);
+	Vector_Free(o->written);
+
+	free(o);
+	*me = NULL;
+}
+
+bool DObj_AddExport(DObj* me, const char* name, uint16_t offset, const char* file, int line)
+{
+	DObjSymbol s = {strdup(name), offset, line, strdup(file)};
+	if(s.name && s.file && Vector_Add(me->exports, s)) return true;
+
+	free(s.name);
+	free(s.file);
+	return false;
+}
+
+bool DObj_AddImport(DObj* me, const char* name)
+{
+	char* s = strdup(name);
+	if(s && Vector_Add(me->imports, s)) return true;
+
+	free(s);
+	return false;
+}
+
+bool DObj_AddReloc(DObj* me, uint16_t offset, const char* symbol, bool relative)
+{
+	DObjReloc r = {offset, strdup(symbol), relative};
+	if(r.symbol && Vector_Add(me->relocs, r)) return true;
+
+	free(r.symbol);
+	return false;
+}
+
+bool DObj_AddDebug(DObj* me, uint16_t offset, uint16_t length, int line, const char* file, const char* labels)
+{
+	DObjDebug d = {offset, length, line, strdup(file), strdup(labels ? labels : "")};
+	if(d.file && d.labels && Vector_Add(me->debug, d)) return true;
+
+	free(d.file);
+	free(d.labels);
+	return false;
+}
+
+bool DObj_AddDefine(DObj* me, const char* search, const char* replace)
+{
+	DObjDefine d = {{strdup(search), strdup(replace)}};
+	if(d.searchReplace[0] && d.searchReplace[1] && Vector_Add(me->defines, d)) return true;
+
+	free(d.searchReplace[0]);
+	free(d.searchReplace[1]);
+	return false;
+}
+
+bool DObj_AddDep(DObj* me, const char* file, uint64_t hash)
+{
+	DObjDep d = {hash, strdup(file)};
+	if(d.file && Vector_Add(me->deps, d)) return true;
+
+	free(d.file);
+	return false;
+}
+
+bool DObj_AddWritten(DObj* me, uint16_t offset, int length)
+{
+	DObjRun r = {offset, length};
+	return Vector_Add(me->written, r);
+}
+
+// Strings are written as single fields so they can hold anything: spaces,
+// tabs, line breaks and backslashes are escaped and the empty string is \e
+static void WriteField(FILE* f, const char* s)
+{
+	fputc(' ', f);
+	if(!*s) fputs("\\e", f);
+
+	for(; *s; s++){
+		switch(*s){
+			case '\\': fputs("\\\\", f); break;
+			case ' ':  fputs("\\s", f); break;
+			case '\t': fputs("\\t", f); break;
+			case '\n': fputs("\\n", f); break;
+			case '\r': fputs("\\r", f); break;
+			default:   fputc(*s, f);
+		}
+	}
+}
+
+bool DObj_Write(DObj* me, const char* filename)
+{
+	FILE* f = fopen(filename, "w");
+	if(!f) return false;
+
+	fprintf(f, "%s %d\n", DOBJ_MAGIC, DOBJ_VERSION);
+
+	fprintf(f, "code %d\n", me->code.count);
+	for(int i = 0; i < me->code.count; i++){
+		fprintf(f, "%04x%c", me->code.elems[i], (i % 8 == 7 || i == me->code.count - 1) ? '\n' : ' ');
+	}
+
+	DObjSymbol* sit;
+	Vector_ForEach(me->exports, sit){
+		fprintf(f, "export %04x", sit->offset);
+		WriteField(f, sit->name);
+		fprintf(f, " %d", sit->line);
+		WriteField(f, sit->file);
+		fputc('\n', f);
+	}
+
+	DObjStr* iit;
+	Vector_ForEach(me->imports, iit){
+		fputs("import", f);
+		WriteField(f, *iit);
+		fputc('\n', f);
+	}
+
+	DObjReloc* rit;
+	Vector_ForEach(me->relocs, rit){
+		fprintf(f, "reloc %04x %s", rit->offset, rit->relative ? "rel" : "abs");
+		WriteField(f, rit->symbol);
+		fputc('\n', f);
+	}
+
+	DObjDebug* dit;
+	Vector_ForEach(me->debug, dit){
+		fprintf(f, "debug %04x %04x %d", dit->offset, dit->length, dit->line);
+		WriteField(f, dit->file);
+		WriteField(f, dit->labels);
+		fputc('\n', f);
+	}
+
+	DObjDefine* fit;
+	Vector_ForEach(me->defines, fit){
+		fputs("define", f);
+		WriteField(f, fit->searchReplace[0]);
+		WriteField(f, fit->searchReplace[1]);
+		fputc('\n', f);
+	}
+
+	DObjDep* pit;
+	Vector_ForEach(me->deps, pit){
+		fprintf(f, "dep %016llx", (unsigned long long)pit->hash);
+		WriteField(f, pit->file);
+		fputc('\n', f);
+	}
+
+	DObjRun* wit;
+	Vector_ForEach(me->written, wit) fprintf(f, "written %04x %x\n", wit->offset, wit->length);
+
+	bool ok = !ferror(f);
+	fclose(f);
+
+	return ok;
+}
+
+// Reads a whole line however long it is into *buffer, growing it as needed
+static bool ReadLine(FILE* f, char** buffer, int* size)
+{
+	int length = 0;
+
+	for(;;){
+		if(length + 1 >= *size){
+			char* grown = realloc(*buffer, *size * 2);
+			if(!grown) return false;
+			*buffer = grown;
+			*size *= 2;
+		}
+		if(!fgets(*buffer + length, *size - length, f)) return length > 0;
+
+		length += strlen(*buffer + length);
+		if((*buffer)[length - 1] == '\n') return true;
+	}
+}
+
+// Takes the next field off *cursor and unescapes it in place, NULL if there are
+// none left or it's malformed
+static char* ReadField(char** cursor)
+{
+	char* s = *cursor + strspn(*cursor, " \r\n");
+	if(!*s) return NULL;
+
+	char* field = s;
+	char* out = s;
+
+	for(; *s && !strchr(" \r\n", *s); s++){
+		if(*s != '\\'){
+			*out++ = *s;
+			continue;
+		}
+
+		switch(*++s){
+			case '\\': *out++ = '\\'; break;
+			case 's':  *out++ = ' '; break;
+			case 't':  *out++ = '\t'; break;
+			case 'n':  *out++ = '\n'; break;
+			case 'r':  *out++ = '\r'; break;
+			case 'e':  break;
+			default:   return NULL;
+		}
+	}
+
+	*cursor = *s ? s + 1 : s;
+	*out = '\0';
+	return field;
+}
+
+static bool ReadNumber(char** cursor, int base, unsigned long long* value)
+{
+	char* field = ReadField(cursor);
+	char* end;
+
+	if(!field) return false;
+	*value = strtoull(field, &end, base);
+	return *end == '\0';
+}
+
+static bool AtEnd(char* cursor)
+{
+	return !ReadField(&cursor);
+}
+
+DObj* DObj_Load(const char* filename, char* error, int errorSize)
+{
+	#define FAIL(...) do{ if(error) snprintf(error, errorSize, "%s:%d: " __VA_ARGS__); goto fail; }while(0)
+
+	FILE* f = fopen(filename, "r");
+	if(!f){
+		if(error) snprintf(error, errorSize, "could not open object file: %s", filename);
+		return NULL;
+	}
+
+	DObj* me = DObj_Create();
+	int size = 256;
+	char* buffer = malloc(size);
+	if(!me || !buffer){
+		fclose(f);
+		free(buffer);
+		if(me) DObj_Destroy(&me);
+		return NULL;
+	}
+
+	char *cursor, *kind, *type, *name, *file;
+	unsigned long long a, b, line;
+	int version = 0, lineNumber = 0;
+	unsigned word;
+	int n;
+
+	if(!ReadLine(f, &buffer, &size) || sscanf(buffer, DOBJ_MAGIC " %d", &version) != 1)
+		FAIL("not a dasm object file", filename, 1);
+	if(version != DOBJ_VERSION)
+		FAIL("unsupported object file version %d", filename, 1, version);
+
+	lineNumber = 1;
+
+	while(ReadLine(f, &buffer, &size)){
+		lineNumber++;
+		bool added = true;
+
+		cursor = buffer;
+		kind = ReadField(&cursor);
+		if(!kind) FAIL("could not parse object file line", filename, lineNumber);
+
+		if(!strcmp(kind, "code") && sscanf(cursor, "%d", &n) == 1){
+			if(n > 0x10000) FAIL("code section too large", filename, lineNumber);
+			if(!Vector_Reserve(me->code, me->code.count + n)) FAIL("out of memory", filename, lineNumber);
+
+			// There's room, it was reserved above
+			for(int i = 0; i < n; i++){
+				if(fscanf(f, "%x", &word) != 1) FAIL("truncated code section", filename, lineNumber);
+				Vector_Add(me->code, (uint16_t)word);
+			}
+			// eat the rest of the last code line
+			if(n > 0 && !ReadLine(f, &buffer, &size)) break;
+			lineNumber += (n + 7) / 8;
+		}
+
+		else if(!strcmp(kind, "export") && ReadNumber(&cursor, 16, &a) && (name = ReadField(&cursor))
+			&& ReadNumber(&cursor, 10, &line) && (file = ReadField(&cursor)) && AtEnd(cursor)){
+			added = DObj_AddExport(me, name, a, file, line);
+		}
+
+		else if(!strcmp(kind, "import") && (name = ReadField(&cursor)) && AtEnd(cursor)) added = DObj_AddImport(me, name);
+
+		else if(!strcmp(kind, "reloc") && ReadNumber(&cursor, 16, &a) && (type = ReadField(&cursor))
+			&& (name = ReadField(&cursor)) && AtEnd(cursor)){
+			added = DObj_AddReloc(me, a, name, !strcmp(type, "rel"));
+		}
+
+		else if(!strcmp(kind, "debug") && ReadNumber(&cursor, 16, &a) && ReadNumber(&cursor, 16, &b)
+			&& ReadNumber(&cursor, 10, &line) && (file = ReadField(&cursor)) && (name = ReadField(&cursor))
+			&& AtEnd(cursor)){
+			added = DObj_AddDebug(me, a, b, line, file, name);
+		}
+
+		else if(!strcmp(kind, "define") && (name = ReadField(&cursor)) && (file = ReadField(&cursor))
+			&& AtEnd(cursor)){
+			added = DObj_AddDefine(me, name, file);
+		}
+
+		else if(!strcmp(kind, "dep") && ReadNumber(&cursor, 16, &a) && (file = ReadField(&cursor)) && AtEnd(cursor)){
+			added = DObj_AddDep(me, file, a);
+		}
+
+		else if(!strcmp(kind, "written") && ReadNumber(&cursor, 16, &a) && ReadNumber(&cursor, 16, &b) && AtEnd(cursor)
+			&& a + b <= 0x10000){
+			added = DObj_AddWritten(me, a, b);
+		}
+
+		else FAIL("could not parse object file line", filename, lineNumber);
+
+		if(!added) FAIL("out of memory", filename, lineNumber);
+	}
+
+	#undef FAIL
+
+	fclose(f);
+	free(buffer);
+	return me;
+
+	fail:
+	fclose(f);
+	free(buffer);
+	DObj_Destroy(&me);
+	return NULL;
+}
@@ -0,0 +1,90 @@
+#ifndef DOBJ_H
+#define DOBJ_H
+
+#include "common.h"
+
+// Relocatable object files, written by dasm -c and combined by dlink.
+// An object is a single section assembled at offset 0, plus the labels it
+// defines (exports), the labels it uses but doesn't define (imports) and a
+// relocation for every word that depends on where the section is placed.
+// Objects cached by dasm for included files also record the .DEFINEs they
+// make, the files they were assembled from and which words were written, as
+// the code also covers what .RESERVE skipped.
+
+#define DOBJ_MAGIC "DOBJ"
+#define DOBJ_VERSION 3
+
+typedef char* DObjStr;
+
+typedef struct {
+	char* name;
+	uint16_t offset;
+	int line;
+	char* file;
+} DObjSymbol;
+
+typedef struct {
+	uint16_t offset;
+	char* symbol;
+	bool relative;  // rel: reference, stores symbol - (offset + 1)
+} DObjReloc;
+
+typedef struct {
+	uint16_t offset, length;
+	int line;
+	char* file;
+	char* labels;   // space separated, may be empty
+} DObjDebug;
+
+typedef struct { char* searchReplace[2]; } DObjDefine;
+
+typedef struct {
+	uint64_t hash;
+	char* file;
+} DObjDep;
+
+typedef struct {
+	uint16_t offset;
+	int length;
+} DObjRun;
+
+typedef Vector(uint16_t) DObjWords;
+typedef Vector(DObjStr) DObjStrVec;
+typedef Vector(DObjSymbol) DObjSymbolVec;
+typedef Vector(DObjReloc) DObjRelocVec;
+typedef Vector(DObjDebug) DObjDebugVec;
+typedef Vector(DObjDefine) DObjDefineVec;
+typedef Vector(DObjDep) DObjDepVec;
+typedef Vector(DObjRun) DObjRunVec;
+
+typedef struct DObj {
+	DObjWords code;
+	DObjSymbolVec exports;
+	DObjStrVec imports;
+	DObjRelocVec relocs;
+	DObjDebugVec debug;
+	DObjDefineVec defines;
+	DObjDepVec deps;
+	DObjRunVec written;
+} DObj;
+
+DObj* DObj_Create();
+void DObj_Destroy(DObj** me);
+
+// The Add functions copy the strings, they return false if out of memory
+bool DObj_AddExport(DObj* me, const char* name, uint16_t offset, const char* file, int line);
+bool DObj_AddImport(DObj* me, const char* name);
+bool DObj_AddReloc(DObj* me, uint16_t offset, const char* symbol, bool relative);
+bool DObj_AddDebug(DObj* me, uint16_t offset, uint16_t length, int line, const char* file, const char* labels);
+bool DObj_AddDefine(DObj* me, const char* search, const char* replace);
+bool DObj_AddDep(DObj* me, const char* file, uint64_t hash);
+bool DObj_AddWritten(DObj* me, uint16_t offset, int length);
+
+// Frees the unused room in the object's arrays, for objects that are kept around
+void DObj_Shrink(DObj* me);
+
+// Neither logs anything, DObj_Load describes what went wrong in error (if not NULL)
+bool DObj_Write(DObj* me, const char* filename);
+DObj* DObj_Load(const char* filename, char* error, int errorSize);
+
+#endif
@@ -1,7 +1,13 @@
 #ifndef LOG_H
 #define LOG_H
 
-#define Log(__level, __levelstr, ...) do{ if(__level >= logLevel){ printf("[%s] ", (__levelstr)); printf(__VA_ARGS__); puts(""); } } while(0)
+// Code that keeps its log level somewhere else (like libdasm, which has one
+// per assembler) defines LOG_LEVEL before including this
+#ifndef LOG_LEVEL
+#define LOG_LEVEL logLevel
+#endif
+
+#define Log(__level, __levelstr, ...) do{ if(__level >= LOG_LEVEL){ printf("[%s] ", (__levelstr)); printf(__VA_ARGS__); puts(""); } } while(0)
 
 #define LogD(...) Log(0, "DD", __VA_ARGS__)
 #define LogV(...) Log(1, "VV", __VA_ARGS__)
@@ -0,0 +1,271 @@
+#include "ramio.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define HOST_BYTE_ORDER DBO_BigEndian
+#else
+#define HOST_BYTE_ORDER DBO_LittleEndian
+#endif
+
+// Swaps the bytes of count words, 8 at a time where there's SIMD. Neither
+// buffer has to be aligned, and they may be the same.
+static void SwapWords(void* dst, const void* src, int count)
+{
+	uint8_t* d = dst;
+	const uint8_t* s = src;
+	int i = 0;
+
+#if defined(__SSE2__)
+	for(; i + 8 <= count; i += 8){
+		__m128i v = _mm_loadu_si128((const __m128i*)(s + i * 2));
+		v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+		_mm_storeu_si128((__m128i*)(d + i * 2), v);
+	}
+#elif defined(__ARM_NEON)
+	for(; i + 8 <= count; i += 8) vst1q_u8(d + i * 2, vrev16q_u8(vld1q_u8(s + i * 2)));
+#endif
+
+	for(; i < count; i++){
+		uint8_t lo = s[i * 2], hi = s[i * 2 + 1];
+		d[i * 2] = hi;
+		d[i * 2 + 1] = lo;
+	}
+}
+
+void BytesToWords(uint16_t* words, const void* bytes, int count, DByteOrder bo)
+{
+	if(bo == HOST_BYTE_ORDER) memmove(words, bytes, (size_t)count * 2);
+	else SwapWords(words, bytes, count);
+}
+
+void WordsToBytes(void* bytes, const uint16_t* words, int count, DByteOrder bo)
+{
+	if(bo == HOST_BYTE_ORDER) memmove(bytes, words, (size_t)count * 2);
+	else SwapWords(bytes, words, count);
+}
+
+void WordsToChars(char* chars, const uint16_t* words, int count)
+{
+	int i = 0;
+
+#if defined(__SSE2__)
+	const __m128i low = _mm_set1_epi16(0xff);
+	for(; i + 16 <= count; i += 16){
+		__m128i a = _mm_and_si128(_mm_loadu_si128((const __m128i*)(words + i)), low);
+		__m128i b = _mm_and_si128(_mm_loadu_si128((const __m128i*)(words + i + 8)), low);
+		_mm_storeu_si128((__m128i*)(chars + i), _mm_packus_epi16(a, b));
+	}
+#elif defined(__ARM_NEON)
+	for(; i + 8 <= count; i += 8) vst1_u8((uint8_t*)chars + i, vmovn_u16(vld1q_u16(words + i)));
+#endif
+
+	for(; i < count; i++) chars[i] = (char)words[i];
+}
+
+void CharsToWords(uint16_t* words, const char* chars, int count)
+{
+	int i = 0;
+
+#if defined(__SSE2__)
+	const __m128i zero = _mm_setzero_si128();
+	for(; i + 16 <= count; i += 16){
+		__m128i v = _mm_loadu_si128((const __m128i*)(chars + i));
+		_mm_storeu_si128((__m128i*)(words + i), _mm_unpacklo_epi8(v, zero));
+		_mm_storeu_si128((__m128i*)(words + i + 8), _mm_unpackhi_epi8(v, zero));
+	}
+#elif defined(__ARM_NEON)
+	for(; i + 8 <= count; i += 8) vst1q_u16(words + i, vmovl_u8(vld1_u8((const uint8_t*)chars + i)));
+#endif
+
+	for(; i < count; i++) words[i] = (uint8_t)chars[i];
+}
+
+int FindZeroWord(const uint16_t* words, int count)
+{
+	int i = 0;
+
+#if defined(__SSE2__)
+	const __m128i zero = _mm_setzero_si128();
+	for(; i + 8 <= count; i += 8){
+		int mask = _mm_movemask_epi8(_mm_cmpeq_epi16(_mm_loadu_si128((const __m128i*)(words + i)), zero));
+		if(mask) return i + __builtin_ctz(mask) / 2;
+	}
+#endif
+
+	for(; i < count; i++){
+		if(!words[i]) return i;
+	}
+
+	return count;
+}
+
+bool WriteRam(uint16_t* ram, const char* filename, uint16_t end, DByteOrder bo)
+{
+	int count = end + 1;
+
+	// Only a foreign byte order needs a copy
+	void* bytes = ram;
+	if(bo != HOST_BYTE_ORDER){
+		bytes = malloc((size_t)count * 2);
+		if(!bytes) return false;
+		WordsToBytes(bytes, ram, count, bo);
+	}
+
+	FILE* out = fopen(filename, "wb");
+	bool ok = out && fwrite(bytes, 2, count, out) == count;
+	if(out && fclose(out) != 0) ok = false;
+
+	if(bytes != ram) free(bytes);
+	return ok;
+}
+
+// Reads a raw binary from the start of f, and closes it
+static int LoadRawFile(FILE* f, uint16_t* ram, uint16_t lastAddr, DByteOrder bo)
+{
+	// Read whole words only, so that a trailing odd byte doesn't touch the RAM
+	long size = -1;
+	if(fseek(f, 0, SEEK_END) == 0) size = ftell(f);
+	if(size < 0 || fseek(f, 0, SEEK_SET) != 0){
+		fclose(f);
+		return -1;
+	}
+
+	long words = size / 2;
+	if(words > (long)lastAddr + 1) words = (long)lastAddr + 1;
+
+	size_t got = fread(ram, 2, words, f);
+	bool ok = !ferror(f);
+	fclose(f);
+
+	if(!ok) return -1;
+
+	BytesToWords(ram, ram, got, bo);
+	return got;
+}
+
+int LoadRamMax(uint16_t* ram, const char* filename, uint16_t lastAddr, DByteOrder bo)
+{
+	FILE* f = fopen(filename, "rb");
+	if(!f) return -1;
+
+	return LoadRawFile(f, ram, lastAddr, bo);
+}
+
+int LoadRam(uint16_t* ram, const char* filename)
+{
+	return LoadRamMax(ram, filename, 0xffff, DBO_LittleEndian);
+}
+
+void MarkUsed(uint32_t* used, int addr, int count)
+{
+	for(int i = addr; i < addr + count; i++) used[i / 32] |= 1u << (i % 32);
+}
+
+bool IsUsed(const uint32_t* used, int addr)
+{
+	return used[addr / 32] >> (addr % 32) & 1;
+}
+
+bool NextUsedRange(const uint32_t* used, int from, int* start, int* end)
+{
+	int at = from;
+
+	// Whole unused words of the bitmap are skipped at once
+	while(at < 0x10000 && !IsUsed(used, at)) at = used[at / 32] >> (at % 32) ? at + 1 : (at / 32 + 1) * 32;
+	if(at >= 0x10000) return false;
+
+	*start = at;
+	while(at < 0x10000 && IsUsed(used, at)) at = ~used[at / 32] >> (at % 32) ? at + 1 : (at / 32 + 1) * 32;
+	*end = at;
+
+	return true;
+}
+
+static void PutLe16(uint8_t* p, uint16_t v){ p[0] = v & 0xff; p[1] = v >> 8; }
+static uint16_t GetLe16(const uint8_t* p){ return p[0] | p[1] << 8; }
+
+bool WriteImage(uint16_t* ram, const uint32_t* used, uint16_t entry, const char* filename, DByteOrder bo)
+{
+	int numSegments = 0;
+	int start, end;
+	for(int at = 0; NextUsedRange(used, at, &start, &end); at = end) numSegments++;
+
+	// Header, segment headers and the words, in one buffer and one write
+	size_t size = 12 + numSegments * 6;
+	for(int at = 0; NextUsedRange(used, at, &start, &end); at = end) size += (end - start) * 2;
+
+	uint8_t* buffer = malloc(size);
+	if(!buffer) return false;
+
+	memcpy(buffer, DIMG_MAGIC, 4);
+	PutLe16(buffer + 4, DIMG_VERSION);
+	PutLe16(buffer + 6, bo == DBO_BigEndian ? DIMG_BIG_ENDIAN : 0);
+	PutLe16(buffer + 8, entry);
+	PutLe16(buffer + 10, numSegments);
+
+	uint8_t* p = buffer + 12;
+	for(int at = 0; NextUsedRange(used, at, &start, &end); at = end){
+		uint32_t length = end - start;
+		PutLe16(p, start);
+		PutLe16(p + 2, length & 0xffff);
+		PutLe16(p + 4, length >> 16);
+		WordsToBytes(p + 6, ram + start, length, bo);
+		p += 6 + length * 2;
+	}
+
+	FILE* out = fopen(filename, "wb");
+	bool ok = out && fwrite(buffer, 1, size, out) == size;
+	if(out && fclose(out) != 0) ok = false;
+
+	free(buffer);
+	return ok;
+}
+
+int LoadImage(uint16_t* ram, const char* filename, uint16_t* entry, uint32_t* used)
+{
+	FILE* f = fopen(filename, "rb");
+	if(!f) return -1;
+
+	uint8_t header[12];
+	if(fread(header, 1, 12, f) != 12 || memcmp(header, DIMG_MAGIC, 4)){
+		if(entry) *entry = 0;
+
+		int words = LoadRawFile(f, ram, 0xffff, DBO_LittleEndian);
+		if(used && words > 0) MarkUsed(used, 0, words);
+		return words;
+	}
+
+	int words = 0;
+	bool ok = GetLe16(header + 4) == DIMG_VERSION;
+	DByteOrder bo = GetLe16(header + 6) & DIMG_BIG_ENDIAN ? DBO_BigEndian : DBO_LittleEndian;
+	int numSegments = GetLe16(header + 10);
+
+	for(int i = 0; ok && i < numSegments; i++){
+		uint8_t seg[6];
+		ok = fread(seg, 1, 6, f) == 6;
+		if(!ok) break;
+
+		uint32_t addr = GetLe16(seg), length = GetLe16(seg + 2) | (uint32_t)GetLe16(seg + 4) << 16;
+		ok = addr + length <= 0x10000 && fread(ram + addr, 2, length, f) == length;
+		if(!ok) break;
+
+		BytesToWords(ram + addr, ram + addr, length, bo);
+		if(used) MarkUsed(used, addr, length);
+		words += length;
+	}
+
+	fclose(f);
+
+	if(!ok) return -1;
+	if(entry) *entry = GetLe16(header + 8);
+	return words;
+}
@@ -0,0 +1,67 @@
+#ifndef RAMIO_H
+#define RAMIO_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Reading and writing binary images. A whole image is read or written with a
+// single call, and the words are converted from or to the file's byte order
+// in bulk. None of these log or exit, they return an error instead.
+
+typedef enum {DBO_LittleEndian, DBO_BigEndian } DByteOrder;
+
+// count words from bytes in byte order bo, the two may be the same buffer
+void BytesToWords(uint16_t* words, const void* bytes, int count, DByteOrder bo);
+void WordsToBytes(void* bytes, const uint16_t* words, int count, DByteOrder bo);
+
+// Text is one character per word, in the low byte. The high bytes are
+// dropped when converting to chars.
+void WordsToChars(char* chars, const uint16_t* words, int count);
+void CharsToWords(uint16_t* words, const char* chars, int count);
+
+// The index of the first zero in words[0 .. count - 1], or count if there's none
+int FindZeroWord(const uint16_t* words, int count);
+
+// Writes ram[0 .. end], returns false if the file couldn't be written
+bool WriteRam(uint16_t* ram, const char* filename, uint16_t end, DByteOrder bo);
+
+// Reads up to and including ram[lastAddr], a trailing odd byte is ignored.
+// Returns the number of words read, or -1 if the file couldn't be read.
+int LoadRamMax(uint16_t* ram, const char* filename, uint16_t lastAddr, DByteOrder bo);
+int LoadRam(uint16_t* ram, const char* filename);
+
+// Segmented images only hold the words a program uses, so an image with code
+// at 0x8000 or a large .RESERVE doesn't carry the zeros in between. They are:
+//
+//   "DIMG", version, flags, entry point, number of segments
+//   for each segment: load address, length in words (32 bits), the words
+//
+// The header fields are little endian 16 bit words unless noted. If bit 0 of
+// flags is set the segments' words are big endian, otherwise little endian.
+//
+// Which words are used is kept in a bitmap of USED_WORDS: bit (addr % 32)
+// of used[addr / 32].
+
+#define DIMG_MAGIC "DIMG"
+#define DIMG_VERSION 1
+#define DIMG_BIG_ENDIAN 0x1
+
+#define USED_WORDS (0x10000 / 32)
+
+void MarkUsed(uint32_t* used, int addr, int count);
+bool IsUsed(const uint32_t* used, int addr);
+
+// Finds the first run of used words at or after from, returns false if there's none
+bool NextUsedRange(const uint32_t* used, int from, int* start, int* end);
+
+// Writes the used words of ram as a segmented image, returns false if the file
+// couldn't be written
+bool WriteImage(uint16_t* ram, const uint32_t* used, uint16_t entry, const char* filename, DByteOrder bo);
+
+// Loads a segmented image, or a little endian raw binary at address 0.
+// entry (if not NULL) gets the image's entry point, 0 for raw binaries, and
+// used (if not NULL) is marked with the loaded words. Returns the number of
+// words loaded, or -1 if the file couldn't be read or isn't a valid image.
+int LoadImage(uint16_t* ram, const char* filename, uint16_t* entry, uint32_t* used);
+
+#endif
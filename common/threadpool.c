@@ -0,0 +1,126 @@
+#include "common.h"
+#include "threadpool.h"
+
+#include <pthread.h>
+#include <unistd.h>
+
+typedef struct {
+	void (*fun)(void* data);
+	void* data;
+} Job;
+
+typedef Vector(Job) JobVec;
+
+struct ThreadPool {
+	pthread_t* threads;
+	int numThreads;
+
+	pthread_mutex_t lock;
+	pthread_cond_t hasJobs;
+	pthread_cond_t idle;
+
+	JobVec jobs;
+	int first;    // the queue is jobs.elems[first .. count)
+	int running;
+	bool quit;
+};
+
+void* Worker(void* vme)
+{
+	ThreadPool* me = vme;
+
+	pthread_mutex_lock(&me->lock);
+
+	for(;;){
+		while(me->first == me->jobs.count && !me->quit) pthread_cond_wait(&me->hasJobs, &me->lock);
+		if(me->first == me->jobs.count) break;
+
+		Job job = me->jobs.elems[me->first++];
+
+		// Reuse the queue storage once it's been drained
+		if(me->first == me->jobs.count) me->first = me->jobs.count = 0;
+
+		me->running++;
+		pthread_mutex_unlock(&me->lock);
+
+		job.fun(job.data);
+
+		pthread_mutex_lock(&me->lock);
+		me->running--;
+
+		if(me->running == 0 && me->first == me->jobs.count) pthread_cond_broadcast(&me->idle);
+	}
+
+	pthread_mutex_unlock(&me->lock);
+	return NULL;
+}
+
+ThreadPool* ThreadPool_Create(int numThreads)
+{
+	ThreadPool* me = calloc(1, sizeof(ThreadPool));
+	if(!me) return NULL;
+
+	pthread_mutex_init(&me->lock, NULL);
+	pthread_cond_init(&me->hasJobs, NULL);
+	pthread_cond_init(&me->idle, NULL);
+
+	Vector_Init(me->jobs, Job);
+
+	if(numThreads < 1) numThreads = 1;
+	me->threads = calloc(numThreads, sizeof(pthread_t));
+
+	// Make do with the threads that could be started
+	while(me->threads && me->numThreads < numThreads){
+		if(pthread_create(me->threads + me->numThreads, NULL, Worker, me) != 0) break;
+		me->numThreads++;
+	}
+
+	if(me->numThreads == 0) ThreadPool_Destroy(&me);
+	return me;
+}
+
+void ThreadPool_Destroy(ThreadPool** me)
+{
+	ThreadPool* p = *me;
+
+	pthread_mutex_lock(&p->lock);
+	p->quit = true;
+	pthread_cond_broadcast(&p->hasJobs);
+	pthread_mutex_unlock(&p->lock);
+
+	for(int i = 0; i < p->numThreads; i++) pthread_join(p->threads[i], NULL);
+
+	pthread_mutex_destroy(&p->lock);
+	pthread_cond_destroy(&p->hasJobs);
+	pthread_cond_destroy(&p->idle);
+
+	Vector_Free(p->jobs);
+	free(p->threads);
+	free(p);
+	*me = NULL;
+}
+
+bool ThreadPool_Submit(ThreadPool* me, void (*fun)(void* data), void* data)
+{
+	Job job = {fun, data};
+
+	pthread_mutex_lock(&me->lock);
+	bool ok = Vector_Add(me->jobs, job);
+	if(ok) pthread_cond_signal(&me->hasJobs);
+	pthread_mutex_unlock(&me->lock);
+
+	return ok;
+}
+
+void ThreadPool_Wait(ThreadPool* me)
+{
+	pthread_mutex_lock(&me->lock);
+	while(me->running > 0 || me->first < me->jobs.count) pthread_cond_wait(&me->idle, &me->lock);
+	pthread_mutex_unlock(&me->lock);
+}
+
+int ThreadPool_NumCores()
+{
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return n < 1 ? 1 : (int)n;
+}
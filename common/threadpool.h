@@ -0,0 +1,22 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+// A fixed number of worker threads running jobs from a shared FIFO queue
+
+typedef struct ThreadPool ThreadPool;
+
+// Returns NULL if no thread could be started
+ThreadPool* ThreadPool_Create(int numThreads);
+
+// Waits for all queued jobs to finish before stopping the threads
+void ThreadPool_Destroy(ThreadPool** me);
+
+// Queues a job, false if out of memory
+bool ThreadPool_Submit(ThreadPool* me, void (*fun)(void* data), void* data);
+
+// Blocks until the queue is empty and no job is running
+void ThreadPool_Wait(ThreadPool* me);
+
+int ThreadPool_NumCores();
+
+#endif
@@ -0,0 +1,543 @@
+#include "dasmi.h"
+#include <unistd.h>
+#include <pthread.h>
+
+// Include cache
+//
+// Included files are assembled on their own into relocatable objects (see
+// dobj.h), which are then placed at the address of the .INCLUDE. The object
+// for a file only depends on its contents, the .DEFINEs active when it's
+// included and the files it includes in turn, so it can be reused whenever
+// those are the same, both within one run and, when the cache has a
+// directory, across runs.
+//
+// The cache is shared by the threads assembling included files ahead of time
+// (see prefetch.c). A file being assembled is marked as pending, and anyone
+// else looking for it waits for it to be done instead of assembling it again.
+// Waiting is skipped when it would close a circle of threads waiting on each
+// other, which only happens for files that include themselves: those are
+// assembled again until they are nested too deep, like without the cache.
+//
+// Objects are reference counted: an entry holds one reference and everyone
+// placing the object another, so an entry can be replaced or dropped while
+// its object is still being placed. The files an object was made from are
+// read and hashed without holding the lock.
+
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+
+struct CachedObj {
+	DObj* obj;
+	int refs;
+};
+
+typedef struct {
+	uint64_t key;
+	CachedObj* held; // NULL if the file can't be relocated (uses .ORG)
+	bool pending;
+	pthread_t owner;
+} CacheEntry;
+
+typedef Vector(CacheEntry) CacheEntryVec;
+
+typedef struct {
+	pthread_t thread;
+	uint64_t key;
+} CacheWaiter;
+
+typedef Vector(CacheWaiter) CacheWaiterVec;
+
+struct IncludeCache {
+	CacheEntryVec entries;
+	CacheWaiterVec waiters;
+	char* dir;
+
+	pthread_mutex_t lock;
+	pthread_cond_t done;
+};
+
+uint64_t HashBytes(const void* data, size_t len, uint64_t hash)
+{
+	const uint8_t* d = data;
+	for(size_t i = 0; i < len; i++){
+		hash ^= d[i];
+		hash *= FNV_PRIME;
+	}
+	return hash;
+}
+
+uint64_t HashStr(const char* str, uint64_t hash)
+{
+	// include the terminator so that "ab" "c" and "a" "bc" differ
+	return HashBytes(str, strlen(str) + 1, hash);
+}
+
+uint64_t HashData(const void* data, size_t len)
+{
+	return HashBytes(data, len, FNV_OFFSET);
+}
+
+// Hash the contents of a file, returns false if it can't be read
+bool HashFile(Dasm* me, const char* filename, uint64_t* hash)
+{
+	size_t len;
+	char* data = me->readFile(me->readFileData, filename, &len);
+	if(!data) return false;
+
+	*hash = HashData(data, len);
+
+	free(data);
+	return true;
+}
+
+IncludeCache* IncludeCache_Create(const char* dir)
+{
+	IncludeCache* me = calloc(1, sizeof(IncludeCache));
+	if(!me) return NULL;
+
+	Vector_Init(me->entries, CacheEntry);
+	Vector_Init(me->waiters, CacheWaiter);
+	if(dir) me->dir = strdup(dir);
+
+	pthread_mutex_init(&me->lock, NULL);
+	pthread_cond_init(&me->done, NULL);
+
+	return me;
+}
+
+// A new reference counted object with a reference for the cache and one for
+// the caller, NULL for NULL
+static CachedObj* HoldObj(DObj* obj)
+{
+	if(!obj) return NULL;
+
+	CachedObj* held = malloc(sizeof(CachedObj));
+	if(!held){
+		DObj_Destroy(&obj);
+		return NULL;
+	}
+
+	held->obj = obj;
+	held->refs = 2;
+	return held;
+}
+
+// Must be called holding the lock
+static void Unref(CachedObj* held)
+{
+	if(held && --held->refs == 0){
+		DObj_Destroy(&held->obj);
+		free(held);
+	}
+}
+
+void IncludeCache_Release(IncludeCache* me, CachedObj* held)
+{
+	if(!held) return;
+
+	pthread_mutex_lock(&me->lock);
+	Unref(held);
+	pthread_mutex_unlock(&me->lock);
+}
+
+void IncludeCache_Destroy(IncludeCache** me)
+{
+	CacheEntry* it;
+	Vector_ForEach((*me)->entries, it) Unref(it->held);
+
+	Vector_Free((*me)->entries);
+	Vector_Free((*me)->waiters);
+	free((*me)->dir);
+
+	pthread_mutex_destroy(&(*me)->lock);
+	pthread_cond_destroy(&(*me)->done);
+	free(*me);
+	*me = NULL;
+}
+
+// Records that the object being assembled depends on a file
+void AddFileDep(Dasm* me, const char* filename, uint64_t hash)
+{
+	if(me->object) LAssertError(DObj_AddDep(me->object, filename, hash), "Could not allocate RAM for object");
+}
+
+bool DepsUpToDate(Dasm* d, DObj* obj)
+{
+	DObjDep* it;
+	Vector_ForEach(obj->deps, it){
+		uint64_t hash;
+		if(!HashFile(d, it->file, &hash) || hash != it->hash) return false;
+	}
+	return true;
+}
+
+CacheEntry* IncludeCache_Lookup(IncludeCache* me, uint64_t key)
+{
+	CacheEntry* it;
+	Vector_ForEach(me->entries, it){
+		if(it->key == key) return it;
+	}
+	return NULL;
+}
+
+// Follows the chain of threads waiting on each other, starting with the owner
+// of a pending entry, to see if it leads back to the calling thread
+bool WouldDeadlock(IncludeCache* me, CacheEntry* e)
+{
+	pthread_t t = e->owner;
+
+	for(int i = 0; i <= me->waiters.count; i++){
+		if(pthread_equal(t, pthread_self())) return true;
+
+		CacheWaiter* w, *found = NULL;
+		Vector_ForEach(me->waiters, w){
+			if(pthread_equal(w->thread, t)) found = w;
+		}
+		if(!found) return false;
+
+		CacheEntry* we = IncludeCache_Lookup(me, found->key);
+		if(!we || !we->pending) return false;
+		t = we->owner;
+	}
+
+	return false;
+}
+
+void GetCachePath(IncludeCache* me, uint64_t key, char* buffer)
+{
+	sprintf(buffer, "%s/%016llx.dobj", me->dir, (unsigned long long)key);
+}
+
+// Puts the object assembled for a pending key in the cache (and on disk if
+// write is set), returns it with a reference for the caller
+CachedObj* IncludeCache_Put(IncludeCache* me, uint64_t key, DObj* obj, bool write)
+{
+	CachedObj* held = HoldObj(obj);
+
+	pthread_mutex_lock(&me->lock);
+
+	CacheEntry* e = IncludeCache_Lookup(me, key);
+	if(e){
+		Unref(e->held);
+		e->held = held;
+		e->pending = false;
+	}else{
+		// Out of memory it's just not cached
+		CacheEntry ne = {key, held, false, pthread_self()};
+		if(!Vector_Add(me->entries, ne) && held) held->refs--;
+	}
+
+	pthread_cond_broadcast(&me->done);
+	pthread_mutex_unlock(&me->lock);
+
+	if(me->dir && held && write){
+		// write to a temporary file first so that concurrent runs never see half an object
+		char path[MAX_STR_SIZE], tmp[MAX_STR_SIZE + 32];
+		GetCachePath(me, key, path);
+		snprintf(tmp, sizeof(tmp), "%s.%d.%lx.tmp", path, (int)getpid(), (unsigned long)pthread_self());
+
+		if(DObj_Write(held->obj, tmp)) rename(tmp, path);
+		else remove(tmp);
+	}
+
+	return held;
+}
+
+// Looks up the object for a key, loading it from disk if needed. Returns
+// false on a miss, held is set to NULL for files that can't be relocated.
+// A hit comes with a reference, which the caller gives back with
+// IncludeCache_Release. A miss marks the key as pending, the caller must
+// follow up with either IncludeCache_Put or IncludeCache_Abandon. The files
+// the object was made from are checked for changes with the assembler's
+// readFile.
+bool IncludeCache_Get(IncludeCache* me, Dasm* d, uint64_t key, CachedObj** held)
+{
+	pthread_mutex_lock(&me->lock);
+
+	CacheEntry* e;
+	while((e = IncludeCache_Lookup(me, key))){
+		if(e->pending){
+			// a file including itself, let it recurse until it's too deep
+			if(WouldDeadlock(me, e)){
+				pthread_mutex_unlock(&me->lock);
+				return false;
+			}
+
+			// Out of memory it can't tell whether waiting is safe, so it doesn't
+			CacheWaiter w = {pthread_self(), key};
+			if(!Vector_Add(me->waiters, w)){
+				pthread_mutex_unlock(&me->lock);
+				return false;
+			}
+
+			pthread_cond_wait(&me->done, &me->lock);
+
+			CacheWaiter* it;
+			Vector_ForEach(me->waiters, it){
+				if(pthread_equal(it->thread, w.thread)) break;
+			}
+			int at = it - me->waiters.elems;
+			Vector_Remove(me->waiters, at);
+			continue;
+		}
+
+		CachedObj* h = e->held;
+		if(!h){
+			pthread_mutex_unlock(&me->lock);
+			*held = NULL;
+			return true;
+		}
+
+		h->refs++;
+		pthread_mutex_unlock(&me->lock);
+
+		if(DepsUpToDate(d, h->obj)){
+			*held = h;
+			return true;
+		}
+
+		// one of the included files changed since it was cached, unless
+		// someone else replaced the entry meanwhile
+		pthread_mutex_lock(&me->lock);
+		e = IncludeCache_Lookup(me, key);
+		if(e && e->held == h){
+			int at = e - me->entries.elems;
+			Vector_Remove(me->entries, at);
+			Unref(h);
+		}
+		Unref(h);
+	}
+
+	// Out of memory the key isn't marked pending, others may assemble it too
+	CacheEntry ne = {key, NULL, true, pthread_self()};
+	(void)Vector_Add(me->entries, ne);
+
+	pthread_mutex_unlock(&me->lock);
+
+	DObj* o = NULL;
+
+	if(me->dir){
+		char path[MAX_STR_SIZE];
+		GetCachePath(me, key, path);
+
+		FILE* f = fopen(path, "r");
+		if(f){
+			fclose(f);
+			// A broken object is just a miss, it gets overwritten
+			o = DObj_Load(path, NULL, 0);
+			if(o && !DepsUpToDate(d, o)) DObj_Destroy(&o);
+		}
+	}
+
+	if(!o){
+		*held = NULL;
+		return false;
+	}
+
+	*held = IncludeCache_Put(me, key, o, false);
+	return *held != NULL;
+}
+
+// Gives up on a pending key after the file failed to assemble
+void IncludeCache_Abandon(IncludeCache* me, uint64_t key)
+{
+	pthread_mutex_lock(&me->lock);
+
+	CacheEntry* e = IncludeCache_Lookup(me, key);
+	if(e && e->pending && pthread_equal(e->owner, pthread_self())){
+		int at = e - me->entries.elems;
+		Vector_Remove(me->entries, at);
+	}
+
+	pthread_cond_broadcast(&me->done);
+	pthread_mutex_unlock(&me->lock);
+}
+
+// Assembles an included file on its own, at address 0
+DObj* AssembleInclude(Dasm* me, const char* filename, int depth, uint64_t key)
+{
+	Dasm* volatile sub = NULL;
+
+	// Clean up and pass errors on to the including file. Set up before anything
+	// can fail, threads waiting for the key would never wake otherwise.
+	jmp_buf bail;
+	jmp_buf* parentBail = me->bail;
+	me->bail = &bail;
+	if(setjmp(bail)){
+		me->bail = parentBail;
+		IncludeCache_Abandon(me->cache, key);
+
+		Dasm* s = sub;
+		if(s){
+			MoveDiagnostics(me, s);
+			if(s->object) DObj_Destroy(&s->object);
+			free(s->ram);
+			Dasm_Destroy(&s);
+		}
+		Bail(me);
+	}
+
+	sub = CreateSub(me);
+	LAssertError(sub, "Could not allocate RAM for assembler");
+	sub->bail = &bail;
+
+	int numDefines = sub->defines->count;
+
+	sub->ram = calloc(1, sizeof(uint16_t) * 0x10000);
+	sub->endAddr = 0xffff;
+	sub->cachingInclude = true;
+	sub->speculative = me->speculative;
+	sub->object = DObj_Create();
+	sub->written = calloc(USED_WORDS, sizeof(uint32_t));
+
+	LAssertError(sub->ram && sub->object && sub->written, "Could not allocate RAM for assembler");
+
+	uint16_t end = Assemble(sub, filename, 0, depth);
+
+	DObj* obj = sub->object;
+
+	if(sub->usedOrg){
+		DObj_Destroy(&obj);
+	}else{
+		Labels_Relocate(sub->labels, sub, sub->ram, obj);
+		LAssertError(Vector_Append(obj->code, sub->ram, end), "Could not allocate RAM for object");
+		AddWrittenRuns(me, sub->written, obj);
+
+		// .DEFINEs made by the file apply to the rest of the including file
+		for(int i = numDefines; i < sub->defines->count; i++){
+			char** sr = sub->defines->elems[i].searchReplace;
+			LAssertError(DObj_AddDefine(obj, sr[0], sr[1]), "Could not allocate RAM for object");
+		}
+
+		// It stays in the cache
+		DObj_Shrink(obj);
+	}
+
+	me->bail = parentBail;
+
+	Dasm* s = sub;
+	free(s->ram);
+	Dasm_Destroy(&s);
+
+	return obj;
+}
+
+// Finds the line that output the word at an offset, for error messages
+DObjDebug* FindDebugLine(DObj* obj, uint16_t offset)
+{
+	DObjDebug* it;
+	Vector_ForEach(obj->debug, it){
+		if(offset >= it->offset && offset < it->offset + it->length) return it;
+	}
+	return NULL;
+}
+
+uint16_t PlaceObject(Dasm* me, DObj* obj, int addr)
+{
+	LAssertError(addr + obj->code.count - 1 <= me->endAddr,
+		"Out of space in binary, at last address %x", me->endAddr);
+
+	memcpy(me->ram + addr, obj->code.elems, obj->code.count * sizeof(uint16_t));
+
+	DObjRun* wit;
+	Vector_ForEach(obj->written, wit) MarkWritten(me, addr + wit->offset, wit->length);
+
+	DObjDefine* dit;
+	Vector_ForEach(obj->defines, dit){
+		Define d = {{DasmStrDup(me, dit->searchReplace[0]), DasmStrDup(me, dit->searchReplace[1])}};
+		LAssertError(Vector_Add(*me->defines, d), "Could not allocate RAM for define");
+	}
+
+	DObjSymbol* sit;
+	Vector_ForEach(obj->exports, sit){
+		Labels_Define(me->labels, me, sit->name, addr + sit->offset, sit->file, sit->line);
+	}
+
+	// The relocations become ordinary label references in the including file
+	DObjReloc* rit;
+	Vector_ForEach(obj->relocs, rit){
+		char name[MAX_STR_SIZE];
+		sprintf(name, "%s%s", rit->relative ? "rel:" : "", rit->symbol);
+
+		DObjDebug* line = FindDebugLine(obj, rit->offset);
+		Labels_Get(me->labels, me, name, addr + rit->offset, addr + (line ? line->offset : rit->offset),
+			line ? line->file : me->currentFile, line ? line->line : me->lineNumber);
+	}
+
+	DObjDebug* it;
+	Vector_ForEach(obj->debug, it){
+		WriteDebugLine(me, addr + it->offset, it->length, it->line, it->file, it->labels);
+	}
+
+	DObjDep* pit;
+	Vector_ForEach(obj->deps, pit) AddFileDep(me, pit->file, pit->hash);
+
+	return addr + obj->code.count;
+}
+
+// The same file can assemble differently depending on where it's included from
+bool IncludeKey(Dasm* me, const char* filename, uint64_t* key, uint64_t* contentHash)
+{
+	if(!HashFile(me, filename, contentHash)) return false;
+
+	*key = HashStr(filename, *contentHash);
+	*key = HashStr(me->baseDir, *key);
+
+	Define* it;
+	Vector_ForEach(*me->defines, it){
+		*key = HashStr(it->searchReplace[0], *key);
+		*key = HashStr(it->searchReplace[1], *key);
+	}
+
+	return true;
+}
+
+// Assembles an included file into the cache unless it's already there,
+// returns it with a reference to give back with IncludeCache_Release
+CachedObj* CacheInclude(Dasm* me, const char* filename, int depth, uint64_t key)
+{
+	CachedObj* held = NULL;
+
+	if(IncludeCache_Get(me->cache, me, key, &held)){
+		if(!me->speculative) LogV("Using cached: %s", filename);
+	}
+	else{
+		DObj* obj = AssembleInclude(me, filename, depth, key);
+		held = IncludeCache_Put(me->cache, key, obj, true);
+	}
+
+	return held;
+}
+
+uint16_t IncludeFile(Dasm* me, const char* filename, int addr, int depth)
+{
+	LAssertError(depth < MAX_INCLUDE_DEPTH, "too many nested .INCLUDEs, does %s include itself?", filename);
+
+	uint64_t key, contentHash;
+	LAssertError(IncludeKey(me, filename, &key, &contentHash), "could not open file: %s", filename);
+	AddFileDep(me, filename, contentHash);
+
+	CachedObj* held = CacheInclude(me, filename, depth, key);
+
+	if(!held){
+		LogV("%s uses .ORG, assembling it in place", filename);
+		return Assemble(me, filename, addr, depth);
+	}
+
+	// The reference is given back whether or not placing it fails
+	jmp_buf bail;
+	jmp_buf* parentBail = me->bail;
+	me->bail = &bail;
+	if(setjmp(bail)){
+		me->bail = parentBail;
+		IncludeCache_Release(me->cache, held);
+		Bail(me);
+	}
+
+	uint16_t end = PlaceObject(me, held->obj, addr);
+
+	me->bail = parentBail;
+	IncludeCache_Release(me->cache, held);
+
+	return end;
+}
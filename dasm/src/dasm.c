@@ -1,4 +1,5 @@
 #include "dasmi.h"
+#include <stdarg.h>
 
 int GetDir(const char* filename, char* buffer)
 {
@@ -15,34 +16,401 @@ int GetDir(const char* filename, char* buffer)
 Dasm* Dasm_Create()
 {
 	Dasm* me = calloc(1, sizeof(Dasm));
-	LAssert(me, "Could not allocate RAM for assembler");
+	if(!me) return NULL;
+
+	me->logLevel = 2;
+	me->readFile = Dasm_ReadFile;
 	
 	me->labels = Labels_Create();
 
 	me->defines = calloc(1, sizeof(Defines));
 	Vector_Init(*me->defines, Define);
 
+	me->diagnostics = calloc(1, sizeof(DasmDiagnostics));
+	Vector_Init(*me->diagnostics, DasmDiagnostic);
+
+	me->sources = calloc(1, sizeof(Sources));
+	Vector_Init(*me->sources, CharPtr);
+
+	me->numThreads = 1;
+
+	me->arena = Arena_Create(64 * 1024);
+	if(!me->arena){
+		Dasm_Destroy(&me);
+		return NULL;
+	}
+
 	return me;
 }
 
+// The strings are in the arena
+void ClearDefines(Dasm* me)
+{
+	me->defines->count = 0;
+}
+
+void ClearDiagnostics(Dasm* me)
+{
+	DasmDiagnostic* it;
+	Vector_ForEach(*me->diagnostics, it){
+		free(it->file);
+		free(it->message);
+	}
+	me->diagnostics->count = 0;
+}
+
+void ClearSources(Dasm* me)
+{
+	CharPtr* it;
+	Vector_ForEach(*me->sources, it) free(*it);
+	me->sources->count = 0;
+}
+
+void Dasm_Reset(Dasm* me)
+{
+	Labels_Clear(me->labels);
+	ClearDefines(me);
+	ClearDiagnostics(me);
+	ClearSources(me);
+
+	if(me->interned) memset(me->interned, 0, me->internSize * sizeof(const char*));
+	me->internCount = 0;
+	Arena_Clear(me->arena);
+
+	me->currentFile = NULL;
+	me->lineNumber = 0;
+	me->usedOrg = false;
+}
+
 void Dasm_Destroy(Dasm** me)
 {
-	free(*me);
+	Dasm* d = *me;
+
+	Labels_Destroy(&d->labels);
+
+	ClearDefines(d);
+	Vector_Free(*d->defines);
+	free(d->defines);
+
+	ClearDiagnostics(d);
+	Vector_Free(*d->diagnostics);
+	free(d->diagnostics);
+
+	ClearSources(d);
+	Vector_Free(*d->sources);
+	free(d->sources);
+
+	if(d->ownsCache) IncludeCache_Destroy(&d->cache);
+
+	free(d->interned);
+	free(d->written);
+	if(d->arena) Arena_Destroy(&d->arena);
+
+	free(d->baseDir);
+	free(d);
 	*me = NULL;
 }
 
-uint16_t Dasm_Assemble(Dasm* me, const char* ifilename, uint16_t* ram, int startAddr, uint16_t endAddr)
+// An assembler for another file of the same program, it starts out with the
+// same .DEFINEs and shares the include cache. NULL if out of memory, it doesn't
+// bail as the new assembler has nowhere to bail to yet.
+Dasm* CreateSub(Dasm* me)
+{
+	Dasm* sub = Dasm_Create();
+	if(!sub) return NULL;
+
+	sub->logLevel = me->logLevel;
+	sub->readFile = me->readFile;
+	sub->readFileData = me->readFileData;
+	sub->cache = me->cache;
+	sub->baseDir = strdup(me->baseDir);
+	if(!sub->baseDir) goto fail;
+
+	Define* it;
+	Vector_ForEach(*me->defines, it){
+		Define d = {{Arena_StrDup(sub->arena, it->searchReplace[0]), Arena_StrDup(sub->arena, it->searchReplace[1])}};
+		if(!d.searchReplace[0] || !d.searchReplace[1] || !Vector_Add(*sub->defines, d)) goto fail;
+	}
+
+	return sub;
+
+	fail:
+	Dasm_Destroy(&sub);
+	return NULL;
+}
+
+char* DasmStrDup(Dasm* me, const char* str)
+{
+	char* copy = Arena_StrDup(me->arena, str);
+	LAssertError(copy, "Could not allocate RAM for string");
+	return copy;
+}
+
+static uint32_t HashStr(const char* str)
+{
+	uint32_t hash = 2166136261u;
+	for(; *str; str++) hash = (hash ^ (unsigned char)*str) * 16777619u;
+	return hash;
+}
+
+// Returns a copy of str that lives as long as the arena, the same pointer for
+// equal strings. Label references keep their file name this way instead of
+// copying it for every reference.
+const char* InternStr(Dasm* me, const char* str)
+{
+	if(!str) return NULL;
+
+	// Keep the table at most half full
+	if((me->internCount + 1) * 2 > me->internSize){
+		int size = me->internSize ? me->internSize * 2 : 64;
+		const char** table = calloc(size, sizeof(const char*));
+		LAssertError(table, "Could not allocate RAM for string table");
+
+		for(int i = 0; i < me->internSize; i++){
+			const char* it = me->interned[i];
+			if(!it) continue;
+
+			uint32_t at = HashStr(it) & (size - 1);
+			while(table[at]) at = (at + 1) & (size - 1);
+			table[at] = it;
+		}
+
+		free(me->interned);
+		me->interned = table;
+		me->internSize = size;
+	}
+
+	uint32_t at = HashStr(str) & (me->internSize - 1);
+	while(me->interned[at]){
+		if(!strcmp(me->interned[at], str)) return me->interned[at];
+		at = (at + 1) & (me->internSize - 1);
+	}
+
+	me->interned[at] = DasmStrDup(me, str);
+	me->internCount++;
+	return me->interned[at];
+}
+
+// Use a cache shared with other assemblers, it's not destroyed with this one
+void Dasm_SetCache(Dasm* me, IncludeCache* cache)
+{
+	if(me->ownsCache) IncludeCache_Destroy(&me->cache);
+	me->cache = cache;
+	me->ownsCache = false;
+}
+
+void Dasm_SetReadFile(Dasm* me, DasmReadFile readFile, void* data)
+{
+	me->readFile = readFile;
+	me->readFileData = data;
+}
+
+void Dasm_SetLogLevel(Dasm* me, int level)
+{
+	me->logLevel = level;
+}
+
+void Dasm_SetThreads(Dasm* me, int numThreads)
+{
+	me->numThreads = numThreads;
+}
+
+void Dasm_SetDebugFile(Dasm* me, FILE* f)
+{
+	me->debugFile = f;
+}
+
+bool Dasm_UsedOrg(Dasm* me)
+{
+	return me->usedOrg;
+}
+
+size_t Dasm_GetArenaPeak(Dasm* me)
+{
+	return me->arena->peak;
+}
+
+char* Dasm_ReadFile(void* data, const char* filename, size_t* len)
+{
+	FILE* f = fopen(filename, "rb");
+	if(!f) return NULL;
+
+	size_t size = 4096, at = 0, n;
+	char* buffer = malloc(size);
+
+	while(buffer && (n = fread(buffer + at, 1, size - at, f)) > 0){
+		at += n;
+		if(at < size) continue;
+
+		char* grown = realloc(buffer, size *= 2);
+		if(!grown) free(buffer);
+		buffer = grown;
+	}
+
+	fclose(f);
+
+	*len = at;
+	return buffer;
+}
+
+// Reads a file through the assembler's readFile, it's kept until the assembler is destroyed
+char* ReadSource(Dasm* me, const char* filename, size_t* len)
+{
+	char* src = me->readFile(me->readFileData, filename, len);
+	if(!src) return NULL;
+
+	bool kept = Vector_Add(*me->sources, src);
+	if(!kept) free(src);
+	LAssertError(kept, "Could not allocate RAM for source");
+
+	return src;
+}
+
+void AddDiagnostic(Dasm* me, const char* file, int line, const char* fmt, ...)
+{
+	char message[MAX_STR_SIZE];
+
+	va_list args;
+	va_start(args, fmt);
+	vsnprintf(message, sizeof(message), fmt, args);
+	va_end(args);
+
+	// Out of memory the error is lost, assembling still fails
+	DasmDiagnostic d = {file ? strdup(file) : NULL, line, strdup(message)};
+	if(!d.message || (file && !d.file) || !Vector_Add(*me->diagnostics, d)){
+		free(d.file);
+		free(d.message);
+	}
+}
+
+// Gives up on assembling after an error, Dasm_Assemble* then return -1 with
+// the error in the diagnostics. Only code running under Run or a sub assembler
+// gets here and those always set a bail first, nothing else fails this way.
+void Bail(Dasm* me)
+{
+	longjmp(*me->bail, 1);
+}
+
+// Passes the errors of a sub assembler on to the including one
+void MoveDiagnostics(Dasm* to, Dasm* from)
+{
+	// Out of memory they stay with the sub assembler, which frees them
+	if(Vector_Concat(*to->diagnostics, *from->diagnostics)) from->diagnostics->count = 0;
+}
+
+int Dasm_NumDiagnostics(Dasm* me)
+{
+	return me->diagnostics->count;
+}
+
+const DasmDiagnostic* Dasm_GetDiagnostic(Dasm* me, int i)
+{
+	return me->diagnostics->elems + i;
+}
+
+void Dasm_PrintDiagnostics(Dasm* me)
+{
+	DasmDiagnostic* it;
+	Vector_ForEach(*me->diagnostics, it){
+		if(it->file) LogI("@ %s:%d", it->file, it->line);
+		LogF("%s", it->message);
+	}
+}
+
+void MarkWritten(Dasm* me, int addr, int count)
+{
+	if(me->written) MarkUsed(me->written, addr, count);
+}
+
+// Records the words of an object that were written, so that placing it
+// doesn't mark what .RESERVE skipped
+void AddWrittenRuns(Dasm* me, const uint32_t* written, DObj* object)
+{
+	int start, end;
+	for(int at = 0; NextUsedRange(written, at, &start, &end) && start < object->code.count; at = end){
+		if(end > object->code.count) end = object->code.count;
+		LAssertError(DObj_AddWritten(object, start, end - start), "Could not allocate RAM for object");
+	}
+}
+
+bool Dasm_WriteImage(Dasm* me, const char* filename, bool bigEndian)
+{
+	if(!me->ram || !me->written) return false;
+	return WriteImage(me->ram, me->written, me->startAddr, filename, bigEndian ? DBO_BigEndian : DBO_LittleEndian);
+}
+
+int Run(Dasm* me, const char* ifilename, const char* src, size_t len, uint16_t* ram, int startAddr, uint16_t endAddr)
 {
 	me->ram = ram;
+	me->startAddr = startAddr;
 	me->endAddr = endAddr;
 
+	ThreadPool* volatile pool = NULL;
+
+	jmp_buf bail;
+	me->bail = &bail;
+
+	if(setjmp(bail)){
+		if(pool) ThreadPool_Destroy((ThreadPool**)&pool);
+		me->bail = NULL;
+		return -1;
+	}
+
+	if(!me->cache){
+		me->cache = IncludeCache_Create(NULL);
+		me->ownsCache = true;
+	}
+	LAssertError(me->cache, "Could not allocate RAM for include cache");
+
 	if(me->baseDir) free(me->baseDir);
-	me->baseDir = calloc(1, GetDir(ifilename, NULL));
+	me->baseDir = calloc(1, GetDir(ifilename, NULL) + 1);
+	LAssertError(me->baseDir, "Could not allocate RAM for assembler");
 	GetDir(ifilename, me->baseDir);
 
-	uint16_t ret = Assemble(me, ifilename, startAddr, 0);
+	if(!me->written) me->written = malloc(USED_WORDS * sizeof(uint32_t));
+	LAssertError(me->written, "Could not allocate RAM for assembler");
+	memset(me->written, 0, USED_WORDS * sizeof(uint32_t));
 
-	Labels_Replace(me->labels, me->ram);
+	if(!src){
+		src = ReadSource(me, ifilename, &len);
+		LAssertError(src, "could not open file: %s", ifilename);
+	}
+
+	// Included files are assembled on the other threads while this one goes
+	if(me->numThreads > 1) pool = PrefetchIncludes(me, ifilename, src, len);
+
+	int ret = AssembleSource(me, ifilename, src, len, startAddr, 0);
+
+	if(pool) ThreadPool_Destroy((ThreadPool**)&pool);
+
+	if(me->object) Labels_Relocate(me->labels, me, me->ram, me->object);
+	else Labels_Replace(me->labels, me, me->ram);
+
+	me->bail = NULL;
+	return ret;
+}
+
+int Dasm_Assemble(Dasm* me, const char* ifilename, uint16_t* ram, int startAddr, uint16_t endAddr)
+{
+	return Run(me, ifilename, NULL, 0, ram, startAddr, endAddr);
+}
+
+int Dasm_AssembleBuffer(Dasm* me, const char* name, const char* src, size_t len, uint16_t* ram, int startAddr, uint16_t endAddr)
+{
+	return Run(me, name, src, len, ram, startAddr, endAddr);
+}
+
+int Dasm_AssembleObject(Dasm* me, const char* ifilename, uint16_t* ram, DObj* object)
+{
+	// Objects are always assembled at offset 0, dlink places them
+	me->object = object;
+	int ret = Dasm_Assemble(me, ifilename, ram, 0, 0xffff);
+
+	if(ret > 0 && !Vector_Append(object->code, ram, ret)){
+		AddDiagnostic(me, NULL, 0, "Could not allocate RAM for object");
+		ret = -1;
+	}
+	me->object = NULL;
 
 	return ret;
 }
@@ -6,29 +6,80 @@
 
 #include <stdint.h>
 #include <stdio.h>
+#include <stdbool.h>
+#include <stddef.h>
 
-extern int logLevel;
+// Dasm can be used as a library (libdasm.a). An assembler only touches its
+// own state and the include cache it uses, so different threads can each
+// assemble with their own Dasm. Errors don't end the process, they are
+// collected as diagnostics and the Dasm_Assemble* functions return -1.
+// A Dasm assembles one program, Dasm_Reset it (or create a new one) for the next.
 
-typedef struct Define_vec_s Defines;
-typedef struct Label_vec_s Labels;
+typedef struct Dasm Dasm;
+typedef struct IncludeCache IncludeCache;
+struct DObj;
 
 typedef struct {
-	const char* currentFile;
-	char* baseDir;
-	int lineNumber;
+	char* file;    // NULL if the error isn't about a particular line
+	int line;
+	char* message;
+} DasmDiagnostic;
 
-	uint16_t* ram;
+// Returns the contents of a file in a buffer allocated with malloc, which the
+// assembler frees, or NULL if there's no such file. Used for the main file,
+// .INCLUDE and .INCBIN. It's called from several threads at once when the
+// assembler has more than one thread (see Dasm_SetThreads).
+typedef char* (*DasmReadFile)(void* data, const char* filename, size_t* len);
 
-	uint16_t endAddr;
+// Returns NULL if out of memory
+Dasm* Dasm_Create();
+void Dasm_Destroy(Dasm** dasm);
 
-	Defines* defines;
-	Labels* labels;
+// Forgets the last program (labels, .DEFINEs, diagnostics) but keeps the
+// settings, the include cache and the allocated memory
+void Dasm_Reset(Dasm* me);
 
-	FILE* debugFile;
-} Dasm;
+// These return the address after the last word output, or -1 on errors
+int Dasm_Assemble(Dasm* me, const char* ifilename, uint16_t* ram, int startAddr, uint16_t endAddr);
+int Dasm_AssembleObject(Dasm* me, const char* ifilename, uint16_t* ram, struct DObj* object);
 
-Dasm* Dasm_Create();
-void Dasm_Destroy(Dasm** dasm);
-uint16_t Dasm_Assemble(Dasm* me, const char* ifilename, uint16_t* ram, int startAddr, uint16_t endAddr);
+// Assembles source that's already in memory, name is used for .INCLUDEs 
+// (relative to its directory) and diagnostics
+int Dasm_AssembleBuffer(Dasm* me, const char* name, const char* src, size_t len, uint16_t* ram, int startAddr, uint16_t endAddr);
+
+// Writes the last program as a segmented image (see common/ramio.h) with only
+// the words that were assembled to, and the start address as its entry point.
+// The words are big endian if bigEndian is set. Returns false on errors.
+bool Dasm_WriteImage(Dasm* me, const char* filename, bool bigEndian);
+
+int Dasm_NumDiagnostics(Dasm* me);
+const DasmDiagnostic* Dasm_GetDiagnostic(Dasm* me, int i);
+
+// Prints the diagnostics like the dasm command does
+void Dasm_PrintDiagnostics(Dasm* me);
+
+void Dasm_SetReadFile(Dasm* me, DasmReadFile readFile, void* data);
+char* Dasm_ReadFile(void* data, const char* filename, size_t* len);
+
+// Messages at this level and above are printed, see log.h
+void Dasm_SetLogLevel(Dasm* me, int level);
+
+// Included files are assembled ahead of time on this many threads, 1 by default
+void Dasm_SetThreads(Dasm* me, int numThreads);
+
+// Where debug symbols are written, NULL for none. The caller closes it.
+void Dasm_SetDebugFile(Dasm* me, FILE* f);
+
+// Whether the last program used .ORG, so it may have written past the
+// address Dasm_Assemble returned
+bool Dasm_UsedOrg(Dasm* me);
+
+// The most the assembler's arena has held, in bytes
+size_t Dasm_GetArenaPeak(Dasm* me);
+
+// Returns NULL if out of memory
+IncludeCache* IncludeCache_Create(const char* dir);
+void IncludeCache_Destroy(IncludeCache** cache);
+void Dasm_SetCache(Dasm* me, IncludeCache* cache);
 
 #endif
@@ -1,19 +1,40 @@
 #ifndef DASMI_H
 #define DASMI_H
 
+// Logging follows the assembler's own level, every function that logs has it as me
+#define LOG_LEVEL (me->logLevel)
+
 #include "common.h"
 #include "dasm.h"
+#include "dobj.h"
+#include "threadpool.h"
+#include "arena.h"
+
+#include <setjmp.h>
 
 #define MAX_STR_SIZE 8192
+#define MAX_INCLUDE_DEPTH 64
 #define LAssertError(__v, ...) \
 	if(!(__v)){ \
-		if(me->currentFile) LogI("@ %s:%d", me->currentFile, me->lineNumber); \
-		LogF(__VA_ARGS__); \
-		exit(1);\
+		AddDiagnostic(me, me->currentFile, me->lineNumber, __VA_ARGS__); \
+		Bail(me); \
 	}
 
 typedef Vector(char) CharVec;
 
+typedef char* CharPtr;
+Vector(CharPtr);
+Vector(DasmDiagnostic);
+
+// An object in the include cache, see cache.c
+typedef struct CachedObj CachedObj;
+
+// Where GetLine reads from
+typedef struct {
+	const char* at;
+	const char* end;
+} Source;
+
 typedef struct 
 {
 	int sourceLine; // Originating line
@@ -23,19 +44,20 @@ typedef struct
 typedef Macro* MacroPtr;
 typedef Vector(MacroPtr) MacroVec;
 
+// The strings of Defines and Labels are in the assembler's arena
 typedef struct { char* searchReplace[2]; } Define;
 Vector(Define);
 
-typedef struct
+typedef struct LabelRef
 {
 	uint16_t addr;
 	uint16_t insAddr;
-	char* filename;
+	const char* filename; // interned
 	int lineNumber;
 	bool relative;
-} LabelRef;
 
-typedef Vector(LabelRef) LabelRefs;
+	struct LabelRef* next;
+} LabelRef;
 
 typedef struct {
 	char* label;
@@ -45,21 +67,108 @@ typedef struct {
 	bool found;
 
 	int lineNumber;
-	char* filename;
+	const char* filename; // interned
 
-	LabelRefs references;
+	// In the order they were made
+	LabelRef* references;
+	LabelRef* lastReference;
 } Label;
 
 Vector(Label); 
 
+typedef struct Define_vec_s Defines;
+typedef struct Label_vec_s Labels;
+typedef struct DasmDiagnostic_vec_s DasmDiagnostics;
+typedef struct CharPtr_vec_s Sources;
+
+struct Dasm {
+	// Messages at this level and above are printed, see log.h
+	int logLevel;
+
+	// Where source files come from, Dasm_ReadFile (from disk) by default
+	DasmReadFile readFile;
+	void* readFileData;
+
+	const char* currentFile;
+	char* baseDir;
+	int lineNumber;
+
+	uint16_t* ram;
+
+	uint16_t startAddr;
+	uint16_t endAddr;
+
+	// The words of ram that were assembled to, as a bitmap (see ramio.h).
+	// Areas skipped with .ORG or .RESERVE aren't in it.
+	uint32_t* written;
+
+	Defines* defines;
+	Labels* labels;
+
+	FILE* debugFile;
+
+	// When set, assemble a relocatable object instead of a binary image
+	struct DObj* object;
+
+	// Included files are assembled into objects and cached, see cache.c
+	IncludeCache* cache;
+	bool ownsCache;
+	bool cachingInclude;
+	bool usedOrg;
+	bool speculative;  // assembling ahead of time, see prefetch.c
+
+	// Included files are assembled ahead of time on this many threads
+	int numThreads;
+
+	// Errors jump here after adding a diagnostic
+	jmp_buf* bail;
+	DasmDiagnostics* diagnostics;
+
+	// Source files read so far, freed with the assembler
+	Sources* sources;
+
+	// Labels, their references and .DEFINEs are allocated here and freed
+	// all at once on Dasm_Reset and Dasm_Destroy
+	struct Arena* arena;
+
+	// File names, each stored once in the arena (open addressing)
+	const char** interned;
+	int internSize;
+	int internCount;
+};
+
+void AddDiagnostic(Dasm* me, const char* file, int line, const char* fmt, ...) __attribute__((format(printf, 4, 5)));
+void Bail(Dasm* me) __attribute__((noreturn));
+void MoveDiagnostics(Dasm* to, Dasm* from);
+Dasm* CreateSub(Dasm* me);
+char* ReadSource(Dasm* me, const char* filename, size_t* len);
+const char* InternStr(Dasm* me, const char* str);
+char* DasmStrDup(Dasm* me, const char* str);
+void MarkWritten(Dasm* me, int addr, int count);
+void AddWrittenRuns(Dasm* me, const uint32_t* written, DObj* object);
+
 Labels* Labels_Create();
+void Labels_Clear(Labels* me);
+void Labels_Destroy(Labels** me);
 Label* Labels_Lookup(Labels* me, const char* label);
-Label* Labels_Add(Labels* me, const char* label);
-void Labels_Define(Labels* me, Dasm* d, const char* label, uint16_t address, const char* filename, int lineNumber);
-uint16_t Labels_Get(Labels* me, const char* label, uint16_t current, uint16_t insAddr, const char* filename, int lineNumber);
-void Labels_Replace(Labels* me, uint16_t* ram);
-bool GetLine(Dasm* me, FILE* f, char* buffer);
+Label* Labels_Add(Labels* lme, Dasm* me, const char* label);
+void Labels_Define(Labels* lme, Dasm* me, const char* label, uint16_t address, const char* filename, int lineNumber);
+uint16_t Labels_Get(Labels* lme, Dasm* me, const char* label, uint16_t current, uint16_t insAddr, const char* filename, int lineNumber);
+void Labels_Replace(Labels* lme, Dasm* me, uint16_t* ram);
+void Labels_Relocate(Labels* lme, Dasm* me, uint16_t* ram, DObj* object);
+bool GetLine(Dasm* me, Source* in, char* buffer);
 char* GetToken(Dasm* me, char* buffer, char* token);
 uint16_t Assemble(Dasm* me, const char* ifilename, int addr, int depth);
+uint16_t AssembleSource(Dasm* me, const char* ifilename, const char* src, size_t len, int addr, int depth);
+uint16_t IncludeFile(Dasm* me, const char* ifilename, int addr, int depth);
+ThreadPool* PrefetchIncludes(Dasm* me, const char* ifilename, const char* src, size_t len);
+char* UnquoteStr(Dasm* me, char* target, const char* str);
+bool HashFile(Dasm* me, const char* filename, uint64_t* hash);
+uint64_t HashData(const void* data, size_t len);
+bool IncludeKey(Dasm* me, const char* filename, uint64_t* key, uint64_t* contentHash);
+CachedObj* CacheInclude(Dasm* me, const char* filename, int depth, uint64_t key);
+void IncludeCache_Release(IncludeCache* me, CachedObj* held);
+void AddFileDep(Dasm* me, const char* filename, uint64_t hash);
+void WriteDebugLine(Dasm* me, uint16_t addr, uint16_t length, int line, const char* file, const char* labels);
 
 #endif
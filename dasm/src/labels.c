@@ -24,6 +24,22 @@ Labels* Labels_Create()
 	return me;
 }
 
+// Removes all labels but keeps the memory for the next program, the
+// strings and references are freed with the assembler's arena
+void Labels_Clear(Labels* me)
+{
+	me->count = 0;
+}
+
+void Labels_Destroy(Labels** me)
+{
+	Labels_Clear(*me);
+
+	Vector_Free(**me);
+	free(*me);
+	*me = NULL;
+}
+
 // XXX: use a hash map or something
 Label* Labels_Lookup(Labels* me, const char* label)
 {
@@ -35,22 +51,18 @@ Label* Labels_Lookup(Labels* me, const char* label)
 	return NULL;
 }
 
-Label* Labels_Add(Labels* me, const char* label)
+Label* Labels_Add(Labels* lme, Dasm* me, const char* label)
 {
 	label = GetName(label);
-	
-	// XXX: Why do I have two duplicate lable checks?
-	LAssert(Labels_Lookup(me, label) == NULL, "duplicate label: %s", label);
 
 	Label l;
 	memset(&l, 0, sizeof(Label));
-	l.label = strdup(label);
-	l.id = me->count;
-	Vector_Init(l.references, LabelRef);
+	l.label = DasmStrDup(me, label);
+	l.id = lme->count;
 
-	Vector_Add(*me, l);
+	LAssertError(Vector_Add(*lme, l), "Could not allocate RAM for label");
 
-	return &me->elems[me->count - 1];
+	return &lme->elems[lme->count - 1];
 }
 
 void Labels_Define(Labels* lme, Dasm* me, const char* label, uint16_t address, const char* filename, int lineNumber)
@@ -58,7 +70,7 @@ void Labels_Define(Labels* lme, Dasm* me, const char* label, uint16_t address, c
 	label = GetName(label);
 
 	Label* l = Labels_Lookup(lme, label);
-	if(!l) l = Labels_Add(lme, label);
+	if(!l) l = Labels_Add(lme, me, label);
 	else 
 		LAssertError(!l->found, 
 			"duplicate label: %s, first defined at %s:%d", 
@@ -66,53 +78,60 @@ void Labels_Define(Labels* lme, Dasm* me, const char* label, uint16_t address, c
 
 	l->addr = address;
 	l->found = true;
-	l->filename = strdup(filename);
+	l->filename = InternStr(me, filename);
 	l->lineNumber = lineNumber;
 } 
 
-uint16_t Labels_Get(Labels* me, const char* label, uint16_t current, uint16_t insAddr, const char* filename, int lineNumber)
+uint16_t Labels_Get(Labels* lme, Dasm* me, const char* label, uint16_t current, uint16_t insAddr, const char* filename, int lineNumber)
 {
 	bool isRelative = IsRelative(label);
 	label = GetName(label);
 
-	Label* l = Labels_Lookup(me, label);
-	if(!l) l = Labels_Add(me, label);
+	Label* l = Labels_Lookup(lme, label);
+	if(!l) l = Labels_Add(lme, me, label);
 
-	LabelRef ref;
+	LabelRef* ref = Arena_Alloc(me->arena, sizeof(LabelRef));
+	LAssertError(ref, "Could not allocate RAM for label reference");
 
-	ref.lineNumber = lineNumber;
-	ref.filename = strdup(filename);
-	ref.addr = current;
-	ref.insAddr = insAddr;
-	ref.relative = isRelative;
+	ref->lineNumber = lineNumber;
+	ref->filename = InternStr(me, filename);
+	ref->addr = current;
+	ref->insAddr = insAddr;
+	ref->relative = isRelative;
+	ref->next = NULL;
 
-	Vector_Add(l->references, ref);
+	if(l->lastReference) l->lastReference->next = ref;
+	else l->references = ref;
+	l->lastReference = ref;
 
 	return l->id;
 }
 	
-void Labels_Replace(Labels* me, uint16_t* ram)
+void Labels_Replace(Labels* lme, Dasm* me, uint16_t* ram)
 {
 	LogD("replacing labels");
 
-	LogD("label count: %d", me->count);
+	LogD("label count: %d", lme->count);
+
+	// Report every missing label before giving up
+	bool missing = false;
 
 	Label* l;
-	Vector_ForEach(*me, l){
+	Vector_ForEach(*lme, l){
 		if(!l->found){
-			LogF("No such label: %s", l->label);
-			LogI("Referenced from:");
-
-			LabelRef* ref;
-			Vector_ForEach(l->references, ref){
-				LogI("  %s:%d", ref->filename, ref->lineNumber);
+			for(LabelRef* ref = l->references; ref; ref = ref->next){
+				AddDiagnostic(me, ref->filename, ref->lineNumber, "No such label: %s", l->label);
 			}
-			exit(1);
+			missing = true;
 		}
+	}
+
+	if(missing) Bail(me);
+
+	Vector_ForEach(*lme, l){
 		LogD("label: %s", l->label);
 
-		LabelRef* ref;
-		Vector_ForEach(l->references, ref){
+		for(LabelRef* ref = l->references; ref; ref = ref->next){
 			const char* relname[] = {"absolute", "relative"};
 			uint16_t addr = ref->relative ? -(ref->addr - l->addr) - 1: l->addr;
 			ram[ref->addr] = addr;
@@ -123,3 +142,31 @@ void Labels_Replace(Labels* me, uint16_t* ram)
 }
 
 
+// Like Labels_Replace, but for relocatable objects. Defined labels are
+// exported and undefined ones imported. Every word that depends on where
+// the object ends up in memory gets a relocation for dlink to fix up.
+void Labels_Relocate(Labels* lme, Dasm* me, uint16_t* ram, DObj* object)
+{
+	LogD("relocating labels");
+
+	Label* l;
+	Vector_ForEach(*lme, l){
+		bool added = l->found ? DObj_AddExport(object, l->label, l->addr, l->filename, l->lineNumber)
+			: DObj_AddImport(object, l->label);
+		LAssertError(added, "Could not allocate RAM for object");
+
+		for(LabelRef* ref = l->references; ref; ref = ref->next){
+			// A relative reference to a label in the same object doesn't
+			// change when the object is moved, so it can be resolved right away
+			if(l->found && ref->relative){
+				ram[ref->addr] = -(ref->addr - l->addr) - 1;
+				continue;
+			}
+
+			ram[ref->addr] = 0;
+			LAssertError(DObj_AddReloc(object, ref->addr, l->label, ref->relative), "Could not allocate RAM for object");
+
+			LogD("relocation for %s @ 0x%04x", l->label, ref->addr);
+		}
+	}
+}
@@ -1,9 +1,177 @@
 #include "cvector.h"
 #include "common.h"
 #include "dasm.h"
+#include "dobj.h"
+#include "threadpool.h"
+
+#include <pthread.h>
+#include <time.h>
+#include <sys/resource.h>
 
 int logLevel;
 
+// Batch mode: jobs are read from a manifest, one "[dasm file] [out binary]"
+// per line, by a number of workers that each keep their assembler and RAM
+// between jobs. The include cache is shared by all of them.
+typedef struct {
+	FILE* manifest;
+	pthread_mutex_t lock;  // for the manifest, the counts and printing
+
+	unsigned addr;
+	bool debugSymbols;
+	bool object;
+	bool image;
+	DByteOrder byteOrder;
+	IncludeCache* cache;
+
+	int numJobs;
+	int numFailed;
+	size_t arenaPeak;   // the largest of the workers' arenas
+} Batch;
+
+// Returns how much of the RAM was used, or -1 if the job failed
+int BatchJob(Batch* b, Dasm* d, uint16_t* ram, const char* in, const char* out)
+{
+	char tmp[4096];
+	int len;
+	FILE* debugFile = NULL;
+
+	if(b->object){
+		DObj* o = DObj_Create();
+		len = o ? Dasm_AssembleObject(d, in, ram, o) : -1;
+
+		if(len >= 0 && !DObj_Write(o, out)){
+			LogE("could not write object file: %s", out);
+			len = -1;
+		}
+
+		if(o) DObj_Destroy(&o);
+		return len;
+	}
+
+	if(b->debugSymbols){
+		snprintf(tmp, sizeof(tmp), "%s.dbg", out);
+		debugFile = fopen(tmp, "w");
+		if(!debugFile){
+			LogE("could not open file: %s", tmp);
+			return -1;
+		}
+	}
+
+	Dasm_SetDebugFile(d, debugFile);
+	len = Dasm_Assemble(d, in, ram, b->addr, 0xffff);
+
+	if(debugFile) fclose(debugFile);
+	Dasm_SetDebugFile(d, NULL);
+
+	if(len < 0) return -1;
+
+	// The same length as dasm without --batch writes
+	uint16_t last = len - 1;
+	bool ok = b->image ? Dasm_WriteImage(d, out, b->byteOrder == DBO_BigEndian) : WriteRam(ram, out, last, b->byteOrder);
+	if(!ok){
+		LogE("could not open new file for writing: %s", out);
+		return -1;
+	}
+
+	LogV("Wrote: %s", out);
+	return len;
+}
+
+void BatchWorker(void* data)
+{
+	Batch* b = data;
+
+	Dasm* d = Dasm_Create();
+	uint16_t* ram = calloc(0x10000, sizeof(uint16_t));
+	LAssert(d && ram, "Could not allocate RAM for assembler");
+
+	Dasm_SetLogLevel(d, logLevel);
+	Dasm_SetCache(d, b->cache);
+
+	// Only the part of the RAM that was written needs to be cleared for the next job
+	int dirty = 0;
+
+	char line[4096], in[4096], out[4096];
+
+	for(;;){
+		pthread_mutex_lock(&b->lock);
+		char* got = fgets(line, sizeof(line), b->manifest);
+		pthread_mutex_unlock(&b->lock);
+
+		if(!got) break;
+
+		int n = sscanf(line, "%4095s %4095s", in, out);
+		if(n <= 0 || in[0] == ';' || in[0] == '#') continue;
+
+		memset(ram, 0, dirty * sizeof(uint16_t));
+		Dasm_Reset(d);
+
+		int len = n == 2 ? BatchJob(b, d, ram, in, out) : -1;
+		bool ok = len >= 0;
+
+		// .ORG can write past the end, and a failed job may have stopped anywhere
+		dirty = !ok || Dasm_UsedOrg(d) ? 0x10000 : len;
+
+		pthread_mutex_lock(&b->lock);
+		b->numJobs++;
+		if(!ok){
+			b->numFailed++;
+			if(n != 2) LogE("expected a dasm file and an out binary: %s", in);
+			Dasm_PrintDiagnostics(d);
+		}
+		pthread_mutex_unlock(&b->lock);
+	}
+
+	pthread_mutex_lock(&b->lock);
+	if(Dasm_GetArenaPeak(d) > b->arenaPeak) b->arenaPeak = Dasm_GetArenaPeak(d);
+	pthread_mutex_unlock(&b->lock);
+
+	Dasm_Destroy(&d);
+	free(ram);
+}
+
+// Logs the peak size of an assembler's arena and of the whole process
+void LogMemory(size_t arenaPeak)
+{
+	struct rusage usage;
+	long maxRss = getrusage(RUSAGE_SELF, &usage) == 0 ? usage.ru_maxrss : 0;
+
+	LogV("Peak memory: %zu kB in the assembler arena, %ld kB resident", (arenaPeak + 1023) / 1024, maxRss);
+}
+
+int RunBatch(Batch* b, int numThreads)
+{
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	pthread_mutex_init(&b->lock, NULL);
+
+	ThreadPool* pool = ThreadPool_Create(numThreads);
+	LAssert(pool, "could not create threads");
+
+	// Workers take programs until there are none left, so if they can't all be
+	// queued this thread works too
+	for(int i = 0; i < numThreads; i++){
+		if(!ThreadPool_Submit(pool, BatchWorker, b)){
+			BatchWorker(b);
+			break;
+		}
+	}
+	ThreadPool_Destroy(&pool);
+
+	pthread_mutex_destroy(&b->lock);
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+	LogV("Assembled %d programs in %.3f s (%.0f per second), %d failed", 
+		b->numJobs, secs, secs > 0 ? b->numJobs / secs : 0, b->numFailed);
+	LogMemory(b->arenaPeak);
+
+	return b->numFailed ? 1 : 0;
+}
+
 int main(int argc, char** argv)
 {
 	logLevel = 2;
@@ -12,17 +180,23 @@ int main(int argc, char** argv)
 	unsigned addr = 0;
 	unsigned lastAddr = 0xffff;
 	bool debugSymbols = false;
+	bool object = false;
+	bool image = false;
+	const char* cacheDir = NULL;
+	int numThreads = ThreadPool_NumCores();
+	bool batch = false;
 	char c;
 	DByteOrder byteOrder = DBO_LittleEndian;
 
 	const char* files[2] = {NULL, NULL};
-	const char* usage = "usage: %s (-vX | -h | -sX | -d | -eX) [dasm file] [out binary]";
+	const char* usage = "usage: %s (-vX | -h | -sX | -d | -eX | -c | -i | -CX | -jX) [dasm file] [out binary]\n"
+		"       %s (flags) --batch [manifest]";
 
 	for(int i = 1; i < argc; i++){
 		char* v = argv[i];
 		if(STARTSWITH(v, '-')){
 			if(!strcmp(v, "-h")){
-				LogI(usage, argv[0]);
+				LogI(usage, argv[0], argv[0]);
 				LogI(" ");
 				LogI("Available flags:");
 				LogI("  -vX   set log level, where X is [0-5] - default: 2");
@@ -30,12 +204,24 @@ int main(int argc, char** argv)
 				LogI("  -h    show this help message");
 				LogI("  -d    generate debug symbols");
 				LogI("  -eX   set endianness of output, where X is [l | b] default: l");
+				LogI("  -c    output a relocatable object for dlink instead of a binary");
+				LogI("  -i    output a segmented image with only the assembled words instead of a binary");
+				LogI("  -CX   keep assembled include files in directory X and reuse them between runs");
+				LogI("  -jX   assemble included files on X threads - default: number of cores");
+				LogI("  --batch  assemble every \"[dasm file] [out binary]\" line of the manifest");
+				LogI("           (or stdin), on -jX threads. The other flags apply to all of them");
 				return 0;
 			}
 			else if(sscanf(v, "-v%d", &logLevel) == 1){}
 			else if(sscanf(v, "-s%x", &addr) == 1){}
 			else if(sscanf(v, "-e%1c", &c) == 1){ byteOrder = c == 'l' ? DBO_LittleEndian : DBO_BigEndian; }
 			else if(!strcmp(v, "-d")){ debugSymbols = true; }
+			else if(!strcmp(v, "-c")){ object = true; }
+			else if(!strcmp(v, "-i")){ image = true; }
+			else if(!strncmp(v, "-C", 2) && v[2]){ cacheDir = v + 2; }
+			else if(sscanf(v, "-j%d", &numThreads) == 1){}
+			else if(!strcmp(v, "--batch")){ batch = true; }
+			else if(!strcmp(v, "-") && batch && atFile == 0){ files[atFile++] = v; }
 			else{
 				LogF("No such flag: %s", v);
 				return 1;
@@ -46,32 +232,101 @@ int main(int argc, char** argv)
 		}
 	}
 
-	LAssert(argc >= 3 && files[0] && files[1], usage, argv[0]);
+	LAssert(batch ? !files[1] : argc >= 3 && files[0] && files[1], usage, argv[0], argv[0]);
 	LAssert(addr <= 0xffff, "Assembly start address must be within range 0 - 0xFFFF (not %x)", addr);
+	LAssert(!object || addr == 0, "Objects are placed by dlink, -s can't be used with -c");
+	LAssert(!object || !image, "-c and -i can't be used together");
+
+	if(batch){
+		Batch b;
+		memset(&b, 0, sizeof(Batch));
+
+		b.addr = addr;
+		b.debugSymbols = debugSymbols;
+		b.object = object;
+		b.image = image;
+		b.byteOrder = byteOrder;
+
+		b.manifest = !files[0] || !strcmp(files[0], "-") ? stdin : fopen(files[0], "r");
+		LAssert(b.manifest, "could not open file: %s", files[0]);
+
+		b.cache = IncludeCache_Create(cacheDir);
+		LAssert(b.cache, "Could not allocate RAM for include cache");
+
+		int ret = RunBatch(&b, numThreads);
+
+		IncludeCache_Destroy(&b.cache);
+		if(b.manifest != stdin) fclose(b.manifest);
+
+		return ret;
+	}
 	
 	// Allocate 64 kword RAM file
 	uint16_t* ram = calloc(1, sizeof(uint16_t) * 0x10000);
 
 	Dasm* d = Dasm_Create();
+	LAssert(d, "Could not allocate RAM for assembler");
+	Dasm_SetLogLevel(d, logLevel);
+	Dasm_SetThreads(d, numThreads);
+	IncludeCache* cache = NULL;
+
+	if(cacheDir){
+		cache = IncludeCache_Create(cacheDir);
+		LAssert(cache, "Could not allocate RAM for include cache");
+		Dasm_SetCache(d, cache);
+	}
+
+	if(object){
+		DObj* o = DObj_Create();
+		LAssert(o, "Could not allocate RAM for object");
+
+		bool ok = Dasm_AssembleObject(d, files[0], ram, o) >= 0;
+		if(!ok) Dasm_PrintDiagnostics(d);
+		else LogMemory(Dasm_GetArenaPeak(d));
+
+		Dasm_Destroy(&d);
+		if(cache) IncludeCache_Destroy(&cache);
+
+		if(ok){
+			LogV("Writing object to: %s", files[1]);
+			ok = DObj_Write(o, files[1]);
+			if(!ok) LogE("could not write object file: %s", files[1]);
+		}
+
+		DObj_Destroy(&o);
+		free(ram);
+		return ok ? 0 : 1;
+	}
 	
+	FILE* debugFile = NULL;
 	if(debugSymbols){
 		char tmp[4096];
 		sprintf(tmp, "%s.dbg", files[1]);
-		d->debugFile = fopen(tmp, "w");
+		debugFile = fopen(tmp, "w");
 		LogV("Opening debug file: %s", tmp);
-		LAssert(d->debugFile, "could not open file: %s", tmp);
+		LAssert(debugFile, "could not open file: %s", tmp);
+		Dasm_SetDebugFile(d, debugFile);
 	}
 
-	uint16_t len = Dasm_Assemble(d, files[0], ram, addr, lastAddr);
+	int len = Dasm_Assemble(d, files[0], ram, addr, lastAddr);
 
-	if(d->debugFile) fclose(d->debugFile);
+	if(debugFile) fclose(debugFile);
 
-	Dasm_Destroy(&d);
+	if(len < 0){
+		Dasm_PrintDiagnostics(d);
+		exit(1);
+	}
+
+	LogMemory(Dasm_GetArenaPeak(d));
 
 	if(logLevel == 0) DumpRam(ram, len - 1);
 
 	LogV("Writing to: %s", files[1]);
-	WriteRam(ram, files[1], len - 1, byteOrder);
+	bool ok = image ? Dasm_WriteImage(d, files[1], byteOrder == DBO_BigEndian) : WriteRam(ram, files[1], len - 1, byteOrder);
+	LAssert(ok, "could not open new file for writing: %s", files[1]);
+
+	Dasm_Destroy(&d);
+	if(cache) IncludeCache_Destroy(&cache);
 
 	free(ram);
 	return 0;
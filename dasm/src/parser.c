@@ -43,19 +43,22 @@ uint16_t ParseLiteral(Dasm* me, const char* str, bool* success, bool failOnError
 	return lit;
 }
 
-void WriteDebugInfo(Dasm* me, uint16_t addr, int wrote, int labelsAdded)
+void WriteDebugLine(Dasm* me, uint16_t addr, uint16_t length, int line, const char* file, const char* labels)
 {
-	// Debug file
-	if(me->debugFile){
-		LogD("labels found: %d", labelsAdded);
-		// Write [address] [length of output (instruction, etc)] [line number] [file]
-		fprintf(me->debugFile, "%04x %04x %d %s", addr - wrote, wrote, me->lineNumber, me->currentFile);
-
-		// Write all labels associated with this address			
-		for(int i = 0; i < labelsAdded; i++) 
-			fprintf(me->debugFile, " %s", me->labels->elems[me->labels->count - 1 - i].label);
-		fprintf(me->debugFile, "\n");
+	// Objects carry their own debug info, dlink writes it out when linking
+	if(me->object){
+		LAssertError(DObj_AddDebug(me->object, addr, length, line, file, labels), "Could not allocate RAM for object");
 	}
+
+	// Write [address] [length of output (instruction, etc)] [line number] [file] [labels]
+	else if(me->debugFile) fprintf(me->debugFile, "%04x %04x %d %s%s%s\n", addr, length, line, file, labels[0] ? " " : "", labels);
+}
+
+// labels holds the labels defined since the last output, newest first
+void WriteDebugInfo(Dasm* me, uint16_t addr, int wrote, const char* labels)
+{
+	LogD("labels found: %s", labels);
+	WriteDebugLine(me, addr - wrote, wrote, me->lineNumber, me->currentFile, labels);
 }
 
 int LookUpReg(Dasm* me, char c, bool fail)
@@ -173,12 +176,20 @@ char* UnquoteStr(Dasm* me, char* target, const char* str)
 
 
 uint16_t Assemble(Dasm* me, const char* ifilename, int addr, int depth)
+{
+	size_t len;
+	const char* src = ReadSource(me, ifilename, &len);
+	LAssertError(src, "could not open file: %s", ifilename);
+
+	return AssembleSource(me, ifilename, src, len, addr, depth);
+}
+
+uint16_t AssembleSource(Dasm* me, const char* ifilename, const char* src, size_t len, int addr, int depth)
 {
 	LogV("Assembling: %s", ifilename);
 	LogD("at address: 0x%x", addr);
 
-	FILE* in = fopen(ifilename, "r");
-	LAssertError(in, "could not open file: %s", ifilename);
+	Source in = {src, src + len};
 
 	const char* saveFile = me->currentFile;
 	int saveLineNumber = me->lineNumber;
@@ -190,20 +201,21 @@ uint16_t Assemble(Dasm* me, const char* ifilename, int addr, int depth)
 	char token[MAX_STR_SIZE];
 
 	bool done = false;
-	int labelsAdded = 0;
+	char labelsAdded[MAX_STR_SIZE] = {0};
 
 	do{
 		int wrote = 0;
 		#define Write(__val) \
 			do{\
 				LAssertError(addr <= me->endAddr, "Out of space in binary, at last address %x", me->endAddr);\
+				MarkWritten(me, addr, 1);\
 				me->ram[addr++] = (uint16_t)(__val);\
 				wrote++;\
 			}while(0);
 
 		char* line = buffer;
 
-		done = GetLine(me, in, line);
+		done = GetLine(me, &in, line);
 
 		int insnum = -1;
 		Define def;
@@ -234,7 +246,10 @@ uint16_t Assemble(Dasm* me, const char* ifilename, int addr, int depth)
 			// A label, add it and continue	
 			if(toknum == 0 && STARTSWITH(token, ':')) {
 				Labels_Define(me->labels, me, token + 1, addr, me->currentFile, me->lineNumber);
-				labelsAdded++;
+
+				char tmp[MAX_STR_SIZE];
+				snprintf(tmp, sizeof(tmp), "%s%s%s", token + 1, labelsAdded[0] ? " " : "", labelsAdded);
+				strcpy(labelsAdded, tmp);
 				continue;
 			}
 
@@ -252,7 +267,7 @@ uint16_t Assemble(Dasm* me, const char* ifilename, int addr, int depth)
 					LogD(".dw data");
 					// List of characters on the "string" format
 					if(token[0] == '"'){
-						LAssert(ENDSWITH(token, '"'), "expected \"");
+						LAssertError(ENDSWITH(token, '"'), "expected \"");
 						int len = strlen(token) - 2;
 						for(int i = 0; i < len; i++){
 							Write(token[i + 1]);
@@ -268,19 +283,23 @@ uint16_t Assemble(Dasm* me, const char* ifilename, int addr, int depth)
 							Write(lit);
 						}else{
 							// A label
-							Labels_Get(me->labels, token, addr, addr - wrote, me->currentFile, me->lineNumber);
+							Labels_Get(me->labels, me, token, addr, addr - wrote, me->currentFile, me->lineNumber);
 							Write(0);
 						}
 					}
 				}
 
 				// .ORG
-				else if(ad == AD_Org) addr = ParseLiteral(me, token, NULL, true);
+				else if(ad == AD_Org){
+					LAssertError(!me->object || me->cachingInclude, ".ORG can't be used in relocatable objects");
+					me->usedOrg = true;
+					addr = ParseLiteral(me, token, NULL, true);
+				}
 		
 				// .DEFINE
 				else if(ad == AD_Define){	
-					def.searchReplace[toknum - 1] = strdup(token);
-					if(toknum == 2) Vector_Add(*me->defines, def); 
+					def.searchReplace[toknum - 1] = DasmStrDup(me, token);
+					if(toknum == 2) LAssertError(Vector_Add(*me->defines, def), "Could not allocate RAM for define");
 				}	
 
 				// .FILL
@@ -300,17 +319,32 @@ uint16_t Assemble(Dasm* me, const char* ifilename, int addr, int depth)
 					if(toknum == 1) UnquoteStr(me, ibFile, token);
 					if(toknum == 2){
 						char buffer[MAX_STR_SIZE];
-						sprintf(buffer, "%s%s", me->baseDir, ibFile);
-						DByteOrder bo = (!strcmp(tokenUpper, "BE")) ? DBO_BigEndian : DBO_LittleEndian;
-						addr += LoadRamMax(me->ram + addr, buffer, me->endAddr - addr, bo);
+						snprintf(buffer, sizeof(buffer), "%s%s", me->baseDir, ibFile);
+						bool bigEndian = !strcmp(tokenUpper, "BE");
+						LAssertError(addr <= me->endAddr, "Out of space in binary, at last address %x", me->endAddr);
+
+						size_t len;
+						uint8_t* data = (uint8_t*)me->readFile(me->readFileData, buffer, &len);
+						LAssertError(data, "could not open file: %s", buffer);
+						AddFileDep(me, buffer, HashData(data, len));
+
+						// .INCBIN has always left an extra word after the data, keep it that way
+						int words = len / 2, room = me->endAddr - addr;
+						if(words > room + 1) words = room + 1;
+
+						BytesToWords(me->ram + addr, data, words, bigEndian ? DBO_BigEndian : DBO_LittleEndian);
+						MarkWritten(me, addr, words);
+
+						free(data);
+						addr += (words > room ? room : words) + 1;
 					}
 				}
 
 				// .INCLUDE
 				else if(ad == AD_Include){
 					char buffer[MAX_STR_SIZE];
-					sprintf(buffer, "%s%s", me->baseDir, UnquoteStr(me, ibFile, token));
-					addr = Assemble(me, buffer, addr, depth + 1);
+					snprintf(buffer, sizeof(buffer), "%s%s", me->baseDir, UnquoteStr(me, ibFile, token));
+					addr = IncludeFile(me, buffer, addr, depth + 1);
 				}
 			}
 
@@ -355,7 +389,7 @@ uint16_t Assemble(Dasm* me, const char* ifilename, int addr, int depth)
 			if(wrote){
 				// An assembler direvtive wrote data, associate any labels with it
 				WriteDebugInfo(me, addr, wrote, labelsAdded);
-				labelsAdded = 0;
+				labelsAdded[0] = '\0';
 			}
 			continue;
 		}
@@ -403,7 +437,7 @@ uint16_t Assemble(Dasm* me, const char* ifilename, int addr, int depth)
 			if(hasNw[i]){
 				// This refers to a label
 				if(opLabels[i]){
-					Labels_Get(me->labels, opLabels[i], addr, addr - wrote, me->currentFile, me->lineNumber);
+					Labels_Get(me->labels, me, opLabels[i], addr, addr - wrote, me->currentFile, me->lineNumber);
 					free(opLabels[i]);
 				}
 
@@ -420,11 +454,9 @@ uint16_t Assemble(Dasm* me, const char* ifilename, int addr, int depth)
 	
 		WriteDebugInfo(me, addr, wrote, labelsAdded);
 		
-		labelsAdded = 0;
+		labelsAdded[0] = '\0';
 
 	} while (done);
-
-	fclose(in);
 	
 	me->currentFile = saveFile;
 	me->lineNumber = saveLineNumber;
@@ -0,0 +1,135 @@
+#include "dasmi.h"
+
+// Include prefetching
+//
+// How an included file assembles doesn't depend on where it ends up, only on
+// its contents and the .DEFINEs active where it's included (see cache.c).
+// Before the real pass, the source tree is scanned for .DEFINE and .INCLUDE
+// lines, which is enough to know which defines each include will see, and
+// the included files are assembled into the include cache on a thread pool.
+// The real pass then places them in order like any other cached include.
+// Should a guess be wrong the key won't match, and the file is assembled
+// again in order, so the output is always the same as without prefetching.
+
+typedef struct {
+	Dasm* dasm;      // with the .DEFINEs as they'll be at the .INCLUDE
+	char* filename;
+	int depth;
+} PrefetchJob;
+
+void Prefetch(void* data)
+{
+	PrefetchJob* job = data;
+	Dasm* me = job->dasm;
+
+	// Errors are left for the real pass to report
+	jmp_buf bail;
+	me->bail = &bail;
+
+	uint64_t key, contentHash;
+	if(!setjmp(bail) && IncludeKey(me, job->filename, &key, &contentHash)){
+		IncludeCache_Release(me->cache, CacheInclude(me, job->filename, job->depth, key));
+	}
+
+	Dasm_Destroy(&job->dasm);
+	free(job->filename);
+	free(job);
+}
+
+// Follows the source tree in the same order as Assemble, tracking .DEFINEs
+// and queueing every included file
+void ScanIncludes(Dasm* me, ThreadPool** pool, const char* filename, const char* src, size_t len, int depth)
+{
+	if(depth >= MAX_INCLUDE_DEPTH) return;
+
+	if(!src){
+		src = ReadSource(me, filename, &len);
+		if(!src) return;
+	}
+
+	Source in = {src, src + len};
+
+	const char* saveFile = me->currentFile;
+	int saveLineNumber = me->lineNumber;
+
+	me->currentFile = filename;
+	me->lineNumber = 0;
+
+	char buffer[MAX_STR_SIZE];
+	char token[MAX_STR_SIZE];
+	char arg[MAX_STR_SIZE];
+
+	bool more;
+
+	do{
+		more = GetLine(me, &in, buffer);
+
+		// Only the directive itself and its arguments need to be tokenized
+		char* line = GetToken(me, buffer, token);
+		if(STARTSWITH(token, ':')) line = GetToken(me, line, token);
+
+		for(int i = 0; token[i]; i++) token[i] = toupper(token[i]);
+
+		if(!strcmp(token, ".DEFINE")){
+			line = GetToken(me, line, token);
+			GetToken(me, line, arg);
+
+			if(token[0] && arg[0]){
+				Define d = {{DasmStrDup(me, token), DasmStrDup(me, arg)}};
+				LAssertError(Vector_Add(*me->defines, d), "Could not allocate RAM for define");
+			}
+		}
+
+		else if(!strcmp(token, ".INCLUDE")){
+			GetToken(me, line, token);
+
+			char path[MAX_STR_SIZE];
+			snprintf(path, sizeof(path), "%s%s", me->baseDir, UnquoteStr(me, arg, token));
+
+			if(!*pool) *pool = ThreadPool_Create(me->numThreads);
+			if(!*pool) break;
+
+			// Prefetching is only a head start, out of memory it's skipped
+			PrefetchJob* job = calloc(1, sizeof(PrefetchJob));
+			if(!job) break;
+			job->dasm = CreateSub(me);
+			job->filename = strdup(path);
+			if(!job->dasm || !job->filename){
+				if(job->dasm) Dasm_Destroy(&job->dasm);
+				free(job->filename);
+				free(job);
+				break;
+			}
+			job->dasm->speculative = true;
+			job->depth = depth + 1;
+
+			if(!ThreadPool_Submit(*pool, Prefetch, job)) Prefetch(job);
+
+			// The included file's .DEFINEs apply to the rest of this file
+			ScanIncludes(me, pool, path, NULL, 0, depth + 1);
+		}
+	} while(more);
+
+	me->currentFile = saveFile;
+	me->lineNumber = saveLineNumber;
+}
+
+// Returns the pool assembling the included files, or NULL if there are none.
+// It must be destroyed once the real pass is done.
+ThreadPool* PrefetchIncludes(Dasm* me, const char* filename, const char* src, size_t len)
+{
+	Dasm* scan = CreateSub(me);
+	if(!scan) return NULL;
+	scan->numThreads = me->numThreads;
+
+	ThreadPool* volatile pool = NULL;
+
+	// Stop scanning on errors, the real pass reports them
+	jmp_buf bail;
+	scan->bail = &bail;
+
+	if(!setjmp(bail)) ScanIncludes(scan, (ThreadPool**)&pool, filename, src, len, 0);
+
+	Dasm_Destroy(&scan);
+	return pool;
+}
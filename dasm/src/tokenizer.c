@@ -1,19 +1,20 @@
 #include "dasmi.h"
 
-bool GetLine(Dasm* me, FILE* f, char* buffer)
+bool GetLine(Dasm* me, Source* in, char* buffer)
 {
 	me->lineNumber++;
 	int at = 0;
 
 	for(;;) {
-		int c = fgetc(f);
-		if(c == '\r' || c == '\n' || c == EOF || c == ';'){
+		int c = in->at < in->end ? (unsigned char)*(in->at++) : EOF;
+		if(c == '\r' || c == '\n' || c == EOF || c == ';' || c == '\0'){
 			bool ret = c != EOF;
-			while(c != '\n' && c != EOF){ c = fgetc(f); }
+			while(c != '\n' && c != EOF){ c = in->at < in->end ? (unsigned char)*(in->at++) : EOF; }
 			buffer[at] = '\0';
 			return ret;
 		}
 
+		LAssertError(at < MAX_STR_SIZE - 1, "line too long, lines can be at most %d characters", MAX_STR_SIZE - 1);
 		buffer[at++] = c;
 	}
 }
@@ -35,7 +36,7 @@ char* GetToken(Dasm* me, char* line, char* token)
 	while((expecting || (*line > 32 && *line != ',')) && *line != 0){
 		if(*line == '\\'){
 			line++;
-			LAssert(*line != 0, "can't end a line with escaping backslash");
+			LAssertError(*line != 0, "can't end a line with escaping backslash");
 		}else{
 			if(expecting){
 				if(*line == expecting) expecting = 0;
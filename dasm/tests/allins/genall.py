@@ -4,7 +4,7 @@ allops = ["A", "B", "C", "X", "Y", "Z", "I", "J", "[A]", "[B]", "[C]", "[X]", "[
 
 allins = ["SET", "ADD", "SUB", "MUL", "DIV", "MOD", "SHL", "SHR", "AND", "BOR", "XOR", "IFE", "IFN", "IFG", "IFB"]
 
-allins_ext = ["JSR", "SYS"]
+allins_ext = ["JSR", "SYS", "INT", "IAG", "IAS", "RFI", "IAQ"]
 
 for ins in allins:
 	for op1 in allops:
@@ -0,0 +1,78 @@
+// Assembles from memory with libdasm and compares with what dasm made of the same files
+#include "dasm.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+const char* files[][2] = {
+	{"main.dasm", ".DEFINE VALUE 7\nSET A, 1\n.INCLUDE \"lib/fun.dasm\"\n:loop SET PC, loop"},
+	{"lib/fun.dasm", ":fun SET B, VALUE\nSET PC, POP\n.INCBIN \"lib/data.bin\" LE\n"},
+	{"lib/data.bin", "\x01\x02\x03\x04"},
+	{"bad.dasm", "SET A, 1\n\nJSR nowhere\n"},
+};
+
+char* ReadFile(void* data, const char* filename, size_t* len)
+{
+	__atomic_add_fetch((int*)data, 1, __ATOMIC_RELAXED);
+
+	for(int i = 0; i < sizeof(files) / sizeof(files[0]); i++){
+		if(!strcmp(files[i][0], filename)){
+			*len = strlen(files[i][1]);
+			return strdup(files[i][1]);
+		}
+	}
+
+	return NULL;
+}
+
+#define CHECK(__v) if(!(__v)){ printf("%s:%d: failed: %s\n", __FILE__, __LINE__, #__v); return 1; }
+
+int main(int argc, char** argv)
+{
+	uint16_t ram[0x10000], expected[0x10000];
+
+	FILE* f = fopen(argv[1], "rb");
+	CHECK(f);
+	int n = fread(expected, sizeof(uint16_t), 0x10000, f);
+	fclose(f);
+
+	int reads = 0;
+	Dasm* d;
+
+	// Once without and once with included files assembled on other threads
+	for(int threads = 1; threads <= 4; threads += 3){
+		d = Dasm_Create();
+		Dasm_SetThreads(d, threads);
+		Dasm_SetReadFile(d, ReadFile, &reads);
+
+		memset(ram, 0, sizeof(ram));
+		int len = Dasm_AssembleBuffer(d, "main.dasm", files[0][1], strlen(files[0][1]), ram, 0, 0xffff);
+		CHECK(len == n);
+		CHECK(!memcmp(ram, expected, n * sizeof(uint16_t)));
+		CHECK(Dasm_NumDiagnostics(d) == 0);
+		CHECK(reads > 0);
+		Dasm_Destroy(&d);
+	}
+
+	// Errors come back as diagnostics
+	d = Dasm_Create();
+	Dasm_SetReadFile(d, ReadFile, &reads);
+
+	CHECK(Dasm_Assemble(d, "bad.dasm", ram, 0, 0xffff) == -1);
+	CHECK(Dasm_NumDiagnostics(d) == 1);
+
+	const DasmDiagnostic* diag = Dasm_GetDiagnostic(d, 0);
+	CHECK(!strcmp(diag->file, "bad.dasm"));
+	CHECK(diag->line == 3);
+	CHECK(!strcmp(diag->message, "No such label: nowhere"));
+	Dasm_Destroy(&d);
+
+	d = Dasm_Create();
+	Dasm_SetReadFile(d, ReadFile, &reads);
+	CHECK(Dasm_Assemble(d, "missing.dasm", ram, 0, 0xffff) == -1);
+	CHECK(Dasm_NumDiagnostics(d) == 1);
+	Dasm_Destroy(&d);
+
+	printf("ok\n");
+	return 0;
+}
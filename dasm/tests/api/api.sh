@@ -0,0 +1,12 @@
+#!/bin/bash
+echo " == Library test == "
+set -e
+rm -rf /tmp/dasm_api
+mkdir -p /tmp/dasm_api/lib
+printf '.DEFINE VALUE 7\nSET A, 1\n.INCLUDE "lib/fun.dasm"\n:loop SET PC, loop' > /tmp/dasm_api/main.dasm
+printf ':fun SET B, VALUE\nSET PC, POP\n.INCBIN "lib/data.bin" LE\n' > /tmp/dasm_api/lib/fun.dasm
+printf '\x01\x02\x03\x04' > /tmp/dasm_api/lib/data.bin
+(cd /tmp/dasm_api && $OLDPWD/../../dasm main.dasm out.dbin)
+
+gcc -std=gnu99 -Wall -I../../src -o /tmp/dasm_api/api api.c ../../libdasm.a -lpthread
+/tmp/dasm_api/api /tmp/dasm_api/out.dbin
@@ -0,0 +1,29 @@
+#!/bin/bash
+echo " == Batch test == "
+set -e
+rm -rf /tmp/dasm_batch
+mkdir -p /tmp/dasm_batch
+
+# the same programs as the other tests, a few times over so that the workers reuse their state
+for i in 1 2 3; do
+	echo "../include/main.dasm /tmp/dasm_batch/include$i.dbin"
+	echo "../labels/relative.dasm /tmp/dasm_batch/relative$i.dbin"
+	echo "../directives/dw.dasm /tmp/dasm_batch/dw$i.dbin"
+done > /tmp/dasm_batch/manifest
+
+../../dasm -j4 --batch /tmp/dasm_batch/manifest
+../../dasm ../labels/relative.dasm /tmp/dasm_batch/relative.dbin
+
+for i in 1 2 3; do
+	diff /tmp/dasm_batch/include$i.dbin ../include/correct_output.dbin
+	diff /tmp/dasm_batch/dw$i.dbin ../directives/dw_correct.dbin
+	diff /tmp/dasm_batch/relative$i.dbin /tmp/dasm_batch/relative.dbin
+done
+
+# jobs from stdin, a failing job fails the batch but not the others
+if printf '../include/main.dasm /tmp/dasm_batch/stdin.dbin\nmissing.dasm /tmp/dasm_batch/missing.dbin\n' | ../../dasm --batch; then
+	exit 1
+fi
+diff /tmp/dasm_batch/stdin.dbin ../include/correct_output.dbin
+
+echo "ok"
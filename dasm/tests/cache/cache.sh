@@ -0,0 +1,17 @@
+#!/bin/bash
+echo " == Include cache test == "
+set -e
+rm -rf /tmp/dasm_cache
+mkdir -p /tmp/dasm_cache/objects
+
+../../dasm main.dasm /tmp/dasm_cache/plain.dbin
+
+# the first run writes the include's object, the second loads it
+../../dasm -C/tmp/dasm_cache/objects main.dasm /tmp/dasm_cache/first.dbin
+test $(ls /tmp/dasm_cache/objects | wc -l) = 1
+../../dasm -C/tmp/dasm_cache/objects main.dasm /tmp/dasm_cache/second.dbin
+
+diff /tmp/dasm_cache/first.dbin /tmp/dasm_cache/plain.dbin
+diff /tmp/dasm_cache/second.dbin /tmp/dasm_cache/plain.dbin
+
+echo "ok"
@@ -0,0 +1,38 @@
+#!/bin/bash
+echo " == Segmented image test == "
+set -e
+rm -rf /tmp/dasm_image
+mkdir -p /tmp/dasm_image
+
+../../dasm image.dasm /tmp/dasm_image/image.dbin
+../../dasm -i image.dasm /tmp/dasm_image/image.dimg
+../../dasm -i -eb image.dasm /tmp/dasm_image/image_be.dimg
+
+# the header (12 bytes), two segments (6 bytes each) and 9 + 5 words
+size=$(stat -c %s /tmp/dasm_image/image.dimg)
+if [ "$size" != "52" ]; then
+	echo "image is $size bytes instead of 52"
+	exit 1
+fi
+
+# both byte orders load to the same words as the raw binary
+../../../ddisasm/ddisasm /tmp/dasm_image/image.dimg > /tmp/dasm_image/image.txt
+../../../ddisasm/ddisasm /tmp/dasm_image/image_be.dimg > /tmp/dasm_image/image_be.txt
+diff /tmp/dasm_image/image.txt /tmp/dasm_image/image_be.txt
+grep -q "; segment 0x0000 - 0x0008" /tmp/dasm_image/image.txt
+grep -q "; segment 0x8000 - 0x8004" /tmp/dasm_image/image.txt
+
+../../../ddisasm/ddisasm -s0x8000 /tmp/dasm_image/image.dbin | head -5 | grep -o "0x8[0-9a-f]* | [0-9a-f]*" > /tmp/dasm_image/raw_words.txt
+grep -A5 "segment 0x8000" /tmp/dasm_image/image.txt | grep -o "0x8[0-9a-f]* | [0-9a-f]*" > /tmp/dasm_image/image_words.txt
+diff /tmp/dasm_image/raw_words.txt /tmp/dasm_image/image_words.txt
+
+# an included file's reserved area is left out too, also when it comes from the cache
+mkdir -p /tmp/dasm_image/cache
+for run in 1 2; do
+	../../dasm -i -C/tmp/dasm_image/cache include.dasm /tmp/dasm_image/include.dimg
+	../../../ddisasm/ddisasm /tmp/dasm_image/include.dimg > /tmp/dasm_image/include.txt
+	grep -q "; segment 0x0000 - 0x0003" /tmp/dasm_image/include.txt
+	grep -q "; segment 0x0104 - 0x0105" /tmp/dasm_image/include.txt
+done
+
+echo "ok"
@@ -0,0 +1,16 @@
+#!/bin/bash
+set -e
+echo " == Link test =="
+../../dasm -c ../include/inc1.dasm /tmp/inc1.dobj
+../../dasm -c ../include/inc2.dasm /tmp/inc2.dobj
+../../dasm -c main.dasm /tmp/main.dobj
+../../../dlink/dlink /tmp/out.dbin /tmp/inc1.dobj /tmp/inc2.dobj /tmp/main.dobj
+diff /tmp/out.dbin ../include/correct_output.dbin
+
+echo " == Relative link test =="
+../../dasm -c rel1.dasm /tmp/rel1.dobj
+../../dasm -c rel2.dasm /tmp/rel2.dobj
+../../../dlink/dlink -s100 /tmp/out.dbin /tmp/rel1.dobj /tmp/rel2.dobj
+../../dasm -s100 ../labels/relative.dasm /tmp/out_correct.dbin
+diff /tmp/out.dbin /tmp/out_correct.dbin
+echo "ok"
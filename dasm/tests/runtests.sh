@@ -1,6 +1,6 @@
 #!/bin/bash
 
-for t in "allins" "include" "labels" "maximinus-thrax-testsuite" "directives"
+for t in "allins" "include" "labels" "maximinus-thrax-testsuite" "directives" "link" "api" "batch" "image" "cache"
 do
 	cd $t && ./$t.sh && cd -
 	if [ $? != 0 ]; then
@@ -5,14 +5,12 @@ static const char* valNames[] = VALNAMES;
 
 int logLevel;
 
-void Disasm(uint16_t* ram, uint16_t start)
+// Disassembles ram[start .. end]
+void Disasm(uint16_t* ram, uint16_t start, int end)
 {
 	LogV("starting disassembly at: 0x%04x", start);
 	int pc = start;
 	
-	int end = 0xffff;
-	while(ram[--end] == 0);
-	
 	while(pc <= end){
 		int hasRead = 0;
 		uint16_t read(){ hasRead++; return ram[pc++]; }
@@ -81,6 +79,7 @@ int main(int argc, char** argv)
 				LogI("Available flags:");
 				LogI("  -vX   set log level, where X is [0-5] - default: 2");
 				LogI("  -sX   start disassembly at address X - default 0");
+				LogI("Segmented images (dasm -i) are disassembled a segment at a time, from -sX on");
 				return 0;
 			}
 			else if(sscanf(v, "-v%d", &logLevel) == 1){}
@@ -100,8 +99,28 @@ int main(int argc, char** argv)
 	// Allocate 64 kword RAM file
 	uint16_t* ram = calloc(1, sizeof(uint16_t) * 0x10000);
 
-	LoadRam(ram, file);
-	Disasm(ram, start);
+	uint32_t used[USED_WORDS] = {0};
+	uint16_t entry;
+	int words = LoadImage(ram, file, &entry, used);
+	LAssert(words >= 0, "could not load file: %s", file);
+
+	int rangeStart, rangeEnd;
+	bool segmented = NextUsedRange(used, 0, &rangeStart, &rangeEnd) && (rangeStart != 0 || rangeEnd != words || entry != 0);
+
+	if(!segmented){
+		// A raw binary, up to the last word that isn't 0
+		int end = 0xffff;
+		while(ram[--end] == 0);
+		Disasm(ram, start, end);
+	}else{
+		// Only the segments of an image
+		LogV("entry point: 0x%04x", entry);
+
+		for(int at = start; NextUsedRange(used, at, &rangeStart, &rangeEnd); at = rangeEnd){
+			printf("; segment 0x%04x - 0x%04x\n", rangeStart, rangeEnd - 1);
+			Disasm(ram, rangeStart, rangeEnd - 1);
+		}
+	}
 
 	free(ram);
 }
@@ -71,7 +71,7 @@ const char* SourceFile_GetLine(SourceFile* me, int line)
 void Debug_AddBreakPointAddr(Debug* me, uint16_t addr)
 {
 	BreakPoint bp = {addr, true};
-	Vector_Add(me->breakPoints, bp);
+	LAssert(Vector_Add(me->breakPoints, bp), "Could not allocate RAM for breakpoint");
 }
 
 bool Debug_AddBreakPointLine(Debug* me, const char* filename, int line)
@@ -544,6 +544,11 @@ bool Debug_LoadSymbols(Debug* me, const char* filename)
 		FILE* f = fopen(filename, "r");
 		LAssert(f, "could not locate source file: %s", filename);
 
+		fseek(f, 0, SEEK_END);
+		long size = ftell(f);
+		rewind(f);
+		if(size > 0) Vector_Reserve(sf->file, size + 1);
+
 		bool done = false;
 		int lineIndex = 0;
 		int lineLength = 0;
@@ -559,21 +564,21 @@ bool Debug_LoadSymbols(Debug* me, const char* filename)
 				lineLength++;
 
 				if(c == '\n' || c == '\r'){
-					Vector_Add(sf->file, '\0');
+					LAssert(Vector_Add(sf->file, '\0'), "Could not allocate RAM for source file");
 					break;
 				}
 
-				Vector_Add(sf->file, c);
+				LAssert(Vector_Add(sf->file, c), "Could not allocate RAM for source file");
 			}
 
-			Vector_Add(sf->lineIndices, lineIndex);
+			LAssert(Vector_Add(sf->lineIndices, lineIndex), "Could not allocate RAM for source file");
 			lineIndex += lineLength;
 			lineLength = 0;
 		}
 
 		fclose(f);
 
-		Vector_Add(me->sourceFiles, sf);
+		LAssert(Vector_Add(me->sourceFiles, sf), "Could not allocate RAM for source file");
 
 		LogI("Loaded source file from: %s", filename);
 		return sf;
@@ -607,10 +612,11 @@ bool Debug_LoadSymbols(Debug* me, const char* filename)
 		Vector_Init(s.items, CharPtr);
 		
 		for(int i = 0; i < ret - 4; i++){
-			Vector_Add(s.items, strdup(t[i]));
+			char* item = strdup(t[i]);
+			LAssert(item && Vector_Add(s.items, item), "Could not allocate RAM for debug symbols");
 		}
 
-		Vector_Add(me->debugSymbols, s);
+		LAssert(Vector_Add(me->debugSymbols, s), "Could not allocate RAM for debug symbols");
 
 		//puts(buffer);
 	}
@@ -61,4 +61,42 @@ bool Debug_AddBreakPointItem(Debug* debug, const char* item);
 bool Debug_RemoveBreakPoint(Debug* debug, int index);
 bool Debug_EnableBreakPoint(Debug* debug, int index, bool enabled);
 
+#define DISPLAY_SCREEN 0x8000
+#define DISPLAY_FONT 0x8180
+#define DISPLAY_COLUMNS 32
+#define DISPLAY_ROWS 12
+#define DISPLAY_CELLS (DISPLAY_COLUMNS * DISPLAY_ROWS)
+#define DISPLAY_CELL_WIDTH 4
+#define DISPLAY_CELL_HEIGHT 8
+#define DISPLAY_WIDTH (DISPLAY_COLUMNS * DISPLAY_CELL_WIDTH)
+#define DISPLAY_HEIGHT (DISPLAY_ROWS * DISPLAY_CELL_HEIGHT)
+
+typedef struct {
+	Dcpu* dcpu;
+	DcpuDevice* screen;
+	DcpuDevice* font;
+	DcpuEvent* frameEvent;
+
+	uint8_t pixels[DISPLAY_WIDTH * DISPLAY_HEIGHT * 4];   // RGBA
+	uint16_t drawn[DISPLAY_CELLS];   // the word each cell was drawn from
+
+	int frameCycles;
+	uint64_t nextFrame;
+	int frame;
+	bool blinkOff;
+	bool changed;   // since the last dump
+	int cellsDrawn;
+
+	const char* dumpPrefix;
+	int framesDumped;
+} Display;
+
+// freq is in cycles per millisecond, a frame is drawn every 1/60 s of them
+// by an event on the cpu. With dumpPrefix every frame that changed is
+// written to PREFIX0000.ppm, PREFIX0001.ppm and so on.
+Display* Display_Create(Dcpu* dcpu, int freq, const char* dumpPrefix);
+void Display_Destroy(Display** display);
+void Display_Update(Display* display);
+bool Display_Dump(Display* display);
+
 #endif
@@ -0,0 +1,214 @@
+#include "common.h"
+#include "dcpu.h"
+#include "dinterpret.h"
+
+// The notch machine's display, drawn into memory rather than a window
+//
+// The screen is 32x12 cells at 0x8000, one word each: the foreground colour
+// in bits 15-12, the background in bits 11-8, blink in bit 7 and the
+// character in bits 6-0. The font is at 0x8180, two words per character,
+// each holding two of its four 8 pixel columns (high byte first, bit 0 at
+// the top). Both are mapped as devices, so a frame only redraws the cells
+// whose words were written, or whose glyph changed, or that blink.
+
+#define FONT_WORDS (128 * 2)
+#define BLINK_FRAMES 30
+
+static const uint8_t palette[16][3] = {
+	{ 0x00, 0x00, 0x00 }, { 0x00, 0x00, 0xaa }, { 0x00, 0xaa, 0x00 }, { 0x00, 0xaa, 0xaa },
+	{ 0xaa, 0x00, 0x00 }, { 0xaa, 0x00, 0xaa }, { 0xaa, 0x55, 0x00 }, { 0xaa, 0xaa, 0xaa },
+	{ 0x55, 0x55, 0x55 }, { 0x55, 0x55, 0xff }, { 0x55, 0xff, 0x55 }, { 0x55, 0xff, 0xff },
+	{ 0xff, 0x55, 0x55 }, { 0xff, 0x55, 0xff }, { 0xff, 0xff, 0x55 }, { 0xff, 0xff, 0xff },
+};
+
+// 3x5 glyphs for the printable ASCII characters, loaded if the program has
+// no font of its own
+static const uint16_t defaultFont[FONT_WORDS] = {
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x002e, 0x0000, 0x0600, 0x0600, 0x3e14, 0x3e00,
+	0x243e, 0x1200, 0x1208, 0x2400, 0x142a, 0x3400, 0x0006, 0x0000,
+	0x001c, 0x2200, 0x221c, 0x0000, 0x1408, 0x1400, 0x081c, 0x0800,
+	0x2010, 0x0000, 0x0808, 0x0800, 0x0020, 0x0000, 0x3008, 0x0600,
+	0x3e22, 0x3e00, 0x243e, 0x2000, 0x3a2a, 0x2e00, 0x222a, 0x3e00,
+	0x0e08, 0x3e00, 0x2e2a, 0x3a00, 0x3e2a, 0x3a00, 0x023a, 0x0600,
+	0x3e2a, 0x3e00, 0x2e2a, 0x3e00, 0x0014, 0x0000, 0x2014, 0x0000,
+	0x0814, 0x2200, 0x1414, 0x1400, 0x2214, 0x0800, 0x022a, 0x0600,
+	0x3e22, 0x2e00, 0x3c0a, 0x3c00, 0x3e2a, 0x1400, 0x1c22, 0x2200,
+	0x3e22, 0x1c00, 0x3e2a, 0x2200, 0x3e0a, 0x0200, 0x1c22, 0x3a00,
+	0x3e08, 0x3e00, 0x223e, 0x2200, 0x1020, 0x1e00, 0x3e08, 0x3600,
+	0x3e20, 0x2000, 0x3e0c, 0x3e00, 0x3e02, 0x3c00, 0x1c22, 0x1c00,
+	0x3e0a, 0x0400, 0x1c32, 0x2c00, 0x3e0a, 0x3400, 0x242a, 0x1200,
+	0x023e, 0x0200, 0x3e20, 0x3e00, 0x1e20, 0x1e00, 0x3e18, 0x3e00,
+	0x3608, 0x3600, 0x0638, 0x0600, 0x322a, 0x2600, 0x3e22, 0x0000,
+	0x0608, 0x3000, 0x0022, 0x3e00, 0x0402, 0x0400, 0x2020, 0x2000,
+	0x0204, 0x0000, 0x1824, 0x3c00, 0x3e24, 0x1800, 0x1824, 0x2400,
+	0x1824, 0x3e00, 0x182c, 0x2800, 0x083c, 0x0a00, 0x2834, 0x1c00,
+	0x3e04, 0x3800, 0x003a, 0x0000, 0x1020, 0x1a00, 0x3e18, 0x2400,
+	0x223e, 0x2000, 0x3c0c, 0x3c00, 0x3c04, 0x3800, 0x1824, 0x1800,
+	0x3c14, 0x0800, 0x0814, 0x3c00, 0x3804, 0x0400, 0x283c, 0x1400,
+	0x041e, 0x2400, 0x1c20, 0x3c00, 0x1c20, 0x1c00, 0x3c30, 0x3c00,
+	0x2418, 0x2400, 0x2c30, 0x1c00, 0x343c, 0x2c00, 0x083e, 0x2200,
+	0x003e, 0x0000, 0x223e, 0x0800, 0x1808, 0x0c00, 0x0000, 0x0000,
+};
+
+static void DrawCell(Display* me, int cell)
+{
+	uint16_t* ram = Dcpu_GetRam(me->dcpu);
+	uint16_t word = ram[DISPLAY_SCREEN + cell];
+	const uint16_t* glyph = ram + DISPLAY_FONT + (word & 0x7f) * 2;
+
+	const uint8_t* fg = palette[word >> 12];
+	const uint8_t* bg = palette[word >> 8 & 0xf];
+	if(word & 0x80 && me->blinkOff) fg = bg;
+
+	int x0 = cell % DISPLAY_COLUMNS * DISPLAY_CELL_WIDTH;
+	int y0 = cell / DISPLAY_COLUMNS * DISPLAY_CELL_HEIGHT;
+
+	for(int x = 0; x < DISPLAY_CELL_WIDTH; x++){
+		uint8_t column = glyph[x / 2] >> (x % 2 ? 0 : 8);
+
+		for(int y = 0; y < DISPLAY_CELL_HEIGHT; y++){
+			const uint8_t* color = column >> y & 1 ? fg : bg;
+			uint8_t* pixel = me->pixels + ((y0 + y) * DISPLAY_WIDTH + x0 + x) * 4;
+
+			pixel[0] = color[0];
+			pixel[1] = color[1];
+			pixel[2] = color[2];
+			pixel[3] = 0xff;
+		}
+	}
+
+	me->drawn[cell] = word;
+	me->cellsDrawn++;
+}
+
+// A frame every frameCycles, to the cycle
+static void OnFrame(Dcpu* dcpu, void* data)
+{
+	Display* me = data;
+	Display_Update(me);
+
+	if(!Display_Dump(me)){
+		LogE("could not write a frame to %s, not writing any more", me->dumpPrefix);
+		me->dumpPrefix = NULL;
+	}
+
+	me->nextFrame += me->frameCycles;
+	Dcpu_ScheduleEvent(dcpu, me->frameEvent, me->nextFrame);
+}
+
+Display* Display_Create(Dcpu* dcpu, int freq, const char* dumpPrefix)
+{
+	Display* me = calloc(1, sizeof(Display));
+	if(!me) return NULL;
+
+	me->dcpu = dcpu;
+	me->dumpPrefix = dumpPrefix;
+	me->frameCycles = (freq ? freq : 7000) * 1000 / 60;
+
+	me->screen = Dcpu_MapDevice(dcpu, DISPLAY_SCREEN, DISPLAY_CELLS, NULL, NULL, NULL);
+	me->font = Dcpu_MapDevice(dcpu, DISPLAY_FONT, FONT_WORDS, NULL, NULL, NULL);
+	me->frameEvent = Dcpu_AddEvent(dcpu, OnFrame, me);
+	if(!me->screen || !me->font || !me->frameEvent){
+		Display_Destroy(&me);
+		return NULL;
+	}
+
+	uint16_t* font = Dcpu_GetRam(dcpu) + DISPLAY_FONT;
+	int used = 0;
+	for(int i = 0; i < FONT_WORDS; i++) used |= font[i];
+
+	if(!used){
+		memcpy(font, defaultFont, sizeof(defaultFont));
+		Dcpu_MarkDirty(dcpu, DISPLAY_FONT, FONT_WORDS);
+	}
+
+	// The first frame has everything, the bitmaps start from there
+	for(int cell = 0; cell < DISPLAY_CELLS; cell++) DrawCell(me, cell);
+	DcpuDevice_ClearDirty(me->screen);
+	DcpuDevice_ClearDirty(me->font);
+
+	me->changed = true;
+
+	me->nextFrame = Dcpu_GetCycleCount(dcpu) + me->frameCycles;
+	Dcpu_ScheduleEvent(dcpu, me->frameEvent, me->nextFrame);
+
+	return me;
+}
+
+void Display_Destroy(Display** me)
+{
+	Display* display = *me;
+	*me = NULL;
+
+	if(display->screen) Dcpu_UnmapDevice(display->dcpu, &display->screen);
+	if(display->font) Dcpu_UnmapDevice(display->dcpu, &display->font);
+	if(display->frameEvent) Dcpu_RemoveEvent(display->dcpu, &display->frameEvent);
+	free(display);
+}
+
+// Redraws the cells that show any of the glyphs marked in redraw, or that blink
+static void DrawMatching(Display* me, const bool* redraw, bool blinking)
+{
+	uint16_t* screen = Dcpu_GetRam(me->dcpu) + DISPLAY_SCREEN;
+
+	for(int cell = 0; cell < DISPLAY_CELLS; cell++){
+		if((redraw && redraw[screen[cell] & 0x7f]) || (blinking && screen[cell] & 0x80)) DrawCell(me, cell);
+	}
+}
+
+void Display_Update(Display* me)
+{
+	uint16_t* screen = Dcpu_GetRam(me->dcpu) + DISPLAY_SCREEN;
+	int start, end, drawn = me->cellsDrawn;
+
+	for(int at = DISPLAY_SCREEN; DcpuDevice_NextDirty(me->screen, at, &start, &end); at = end){
+		for(int addr = start; addr < end; addr++){
+			int cell = addr - DISPLAY_SCREEN;
+			if(screen[cell] != me->drawn[cell]) DrawCell(me, cell);
+		}
+	}
+
+	bool glyphs[128] = { false }, anyGlyph = false;
+	for(int at = DISPLAY_FONT; DcpuDevice_NextDirty(me->font, at, &start, &end); at = end){
+		for(int addr = start; addr < end; addr++) glyphs[(addr - DISPLAY_FONT) / 2] = true;
+		anyGlyph = true;
+	}
+
+	bool blink = me->frame % BLINK_FRAMES == 0 && me->frame;
+	if(blink) me->blinkOff = !me->blinkOff;
+
+	if(anyGlyph || blink) DrawMatching(me, anyGlyph ? glyphs : NULL, blink);
+
+	DcpuDevice_ClearDirty(me->screen);
+	DcpuDevice_ClearDirty(me->font);
+
+	if(me->cellsDrawn != drawn) me->changed = true;
+	me->frame++;
+}
+
+bool Display_Dump(Display* me)
+{
+	if(!me->changed || !me->dumpPrefix) return true;
+	me->changed = false;
+
+	char filename[512];
+	snprintf(filename, sizeof(filename), "%s%04d.ppm", me->dumpPrefix, me->framesDumped++);
+
+	FILE* file = fopen(filename, "wb");
+	if(!file) return false;
+
+	uint8_t rgb[DISPLAY_WIDTH * DISPLAY_HEIGHT * 3];
+	for(int i = 0; i < DISPLAY_WIDTH * DISPLAY_HEIGHT; i++) memcpy(rgb + i * 3, me->pixels + i * 4, 3);
+
+	fprintf(file, "P6\n%d %d\n255\n", DISPLAY_WIDTH, DISPLAY_HEIGHT);
+	bool ok = fwrite(rgb, sizeof(rgb), 1, file) == 1;
+	return fclose(file) == 0 && ok;
+}
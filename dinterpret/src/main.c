@@ -1,7 +1,14 @@
 #include "common.h"
 #include "dcpu.h"
 #include "dinterpret.h"
-#include <SDL.h>
+#include "threadpool.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/uio.h>
 
 int logLevel;
 
@@ -14,57 +21,470 @@ typedef struct {
 	int freq;
 	const char* file;
 	const char* debugFile;
+	const char* ramFile;
+	const char* framePrefix;
+	int cores;
+	int vms;
+	int threads;
+	int sharedStart;
+	int sharedCount;
 } Settings;
 
-void SysWrite(Dcpu* me, void* data)
+// At most, each gets a thread
+#define MAX_CORES 16
+
+// Console output is gathered in outBuffer and written when the cpu stops
+// running, or when it's full. With the debugger it's written right away,
+// so that it comes out between the debugger's lines. Every core writes to
+// it, under outLock.
+#define OUT_SIZE 0x10000
+
+static char outBuffer[OUT_SIZE];
+static int outUsed;
+static bool outUnbuffered;
+static pthread_mutex_t outLock = PTHREAD_MUTEX_INITIALIZER;
+
+// Writes all of iov to stdout, after anything printed with stdio
+static void WriteOut(struct iovec* iov, int count)
+{
+	fflush(stdout);
+
+	while(count){
+		ssize_t written = writev(STDOUT_FILENO, iov, count);
+		if(written < 0){
+			if(errno == EINTR) continue;
+			return;
+		}
+
+		while(count && (size_t)written >= iov->iov_len){
+			written -= iov->iov_len;
+			iov++;
+			count--;
+		}
+
+		if(count){
+			iov->iov_base = (char*)iov->iov_base + written;
+			iov->iov_len -= written;
+		}
+	}
+}
+
+// With outLock held
+static void WriteBuffered()
 {
-	uint16_t* msg = Dcpu_GetRam(me) + Dcpu_Pop(me);
-	while(*msg) fputc(*msg++, stdout);
+	struct iovec iov = { outBuffer, outUsed };
+	if(outUsed) WriteOut(&iov, 1);
+	outUsed = 0;
 }
 
+static void FlushOutput()
+{
+	pthread_mutex_lock(&outLock);
+	WriteBuffered();
+	pthread_mutex_unlock(&outLock);
+}
+
+static void Output(const uint16_t* text, int count)
+{
+	pthread_mutex_lock(&outLock);
+
+	if(outUsed + count <= OUT_SIZE){
+		WordsToChars(outBuffer + outUsed, text, count);
+		outUsed += count;
+	}
+	else{
+		// What's buffered and the new text go out in one call
+		static char chars[0x10000];
+		WordsToChars(chars, text, count);
+
+		struct iovec iov[2] = { { outBuffer, outUsed }, { chars, count } };
+		WriteOut(iov, 2);
+		outUsed = 0;
+	}
+
+	if(outUnbuffered) WriteBuffered();
+	pthread_mutex_unlock(&outLock);
+}
+
+// A read from stdin that a program is waiting for. Stdin is read with read()
+// into buffer, not with stdio: a line stdio had buffered would be invisible to
+// epoll. With the debugger, which reads its commands with stdio, the lines go
+// through stdio too.
+typedef struct {
+	int epoll;      // -1 if stdin can't be waited on, eg. a regular file
+	bool stdio;     // read with fgets, for the debugger
+	uint16_t addr;  // where the line goes
+	int max;        // characters that fit
+	bool count;     // whether A gets the number of characters read
+	char buffer[0x10000];
+	int used;       // characters in buffer
+	bool eof;
+} Reader;
+
+static Reader reader = { -1 };
+
+static Display* display;
+
+// The number of words from addr up to count, or to the end of the RAM
+static int ClipLength(uint16_t addr, int count)
+{
+	return count < 0x10000 - addr ? count : 0x10000 - addr;
+}
+
+// SYS 1: reads a line to [top of stack], up to 511 characters
 void SysRead(Dcpu* me, void* data)
 {
-	char lb[512];
-	char* lbuffer = lb;
+	Reader* r = data;
+	r->addr = Dcpu_Pop(me);
+	r->max = ClipLength(r->addr, 511);
+	r->count = false;
+	Dcpu_Suspend(me);
+}
+
+// SYS 4: reads a line of at most [second on stack] characters to [top of
+// stack], A is set to the number of characters read
+void SysReadBuffer(Dcpu* me, void* data)
+{
+	Reader* r = data;
+	r->addr = Dcpu_Pop(me);
+	r->max = ClipLength(r->addr, Dcpu_Pop(me));
+	r->count = true;
+	Dcpu_Suspend(me);
+}
+
+// Reads a line of at most max characters to line, or what's left at the end
+// of the input. Returns its length, with the newline if there's one.
+static int ReadLine(Reader* r, char* line, int max)
+{
+	if(max <= 0) return 0;
 
-	uint16_t* buffer = Dcpu_GetRam(me) + Dcpu_Pop(me);
-	fgets(lbuffer, sizeof(lb), stdin);
+	if(r->stdio) return fgets(line, max + 1, stdin) ? strlen(line) : 0;
 
-	while(*lbuffer) *buffer++ = *lbuffer++;
+	for(;;){
+		int have = r->used < max ? r->used : max;
+		char* newline = memchr(r->buffer, '\n', have);
+
+		if(newline || have == max || r->eof){
+			int length = newline ? newline - r->buffer + 1 : have;
+			memcpy(line, r->buffer, length);
+			memmove(r->buffer, r->buffer + length, r->used - length);
+			r->used -= length;
+			return length;
+		}
+
+		// Only waited on when nothing is buffered that could complete the read
+		struct epoll_event event;
+		if(r->epoll >= 0) while(epoll_wait(r->epoll, &event, 1, -1) < 0 && errno == EINTR);
+
+		ssize_t got = read(STDIN_FILENO, r->buffer + r->used, sizeof(r->buffer) - r->used);
+		if(got < 0 && errno == EINTR) continue;
+		if(got <= 0) r->eof = true;
+		else r->used += got;
+	}
+}
+
+// Waits until stdin has a line and gives it to the program
+void CompleteRead(Dcpu* me, Reader* r)
+{
+	FlushOutput();
+
+	char line[0x10001];
+	int length = ReadLine(r, line, r->max);
+
+	CharsToWords(Dcpu_GetRam(me) + r->addr, line, length);
+	Dcpu_MarkDirty(me, r->addr, length);
+
+	if(r->count) Dcpu_SetRegister(me, DR_A, length);
+	Dcpu_Resume(me);
+}
+
+// Completes reads, writes the output, and stops idle programs: only another
+// core, or another process writing to the RAM file, can wake one
+bool OnStatus(Dcpu* me, DcpuStatus status, void* data)
+{
+	Settings* settings = data;
+
+	FlushOutput();
+
+	if(status == DCPU_WAITING) CompleteRead(me, &reader);
+
+	if(status == DCPU_IDLE && !settings->ramFile && settings->cores == 1){
+		LogI("program is idle and nothing can wake it, stopping");
+		return false;
+	}
+
+	return true;
+}
+
+// SYS 2: writes the zero terminated string at [top of stack]
+void SysWrite(Dcpu* me, void* data)
+{
+	uint16_t addr = Dcpu_Pop(me);
+	uint16_t* text = Dcpu_GetRam(me) + addr;
+	Output(text, FindZeroWord(text, 0x10000 - addr));
+}
+
+// SYS 3: writes [second on stack] characters from [top of stack]
+void SysWriteBuffer(Dcpu* me, void* data)
+{
+	uint16_t addr = Dcpu_Pop(me);
+	int count = ClipLength(addr, Dcpu_Pop(me));
+	Output(Dcpu_GetRam(me) + addr, count);
+}
+
+// With -c the cores after the first run on threads of their own, at the
+// same frequency, until they exit or the program exits on the first core.
+// They can write to the console, only the first one reads.
+typedef struct {
+	Dcpu* dcpu;
+	pthread_t thread;
+	int freq;
+} Core;
+
+static bool coresStop;
+
+// An idle core is run again, the others may write its memory
+static bool OnCoreStatus(Dcpu* me, DcpuStatus status, void* data)
+{
+	return !__atomic_load_n(&coresStop, __ATOMIC_RELAXED);
+}
+
+static void* RunCore(void* data)
+{
+	Core* core = data;
+
+	if(core->freq){
+		DcpuPacer* pacer = DcpuPacer_Create();
+		LAssert(pacer && DcpuPacer_Add(pacer, core->dcpu, core->freq * 1000, OnCoreStatus, NULL), "out of memory");
+		DcpuPacer_Run(pacer);
+		DcpuPacer_Destroy(&pacer);
+	}
+	else{
+		DcpuStatus status;
+		while((status = Dcpu_Execute(core->dcpu, 1000)) != DCPU_EXITED && OnCoreStatus(core->dcpu, status, NULL)){
+			if(status == DCPU_IDLE) sched_yield();
+		}
+	}
+
+	return NULL;
+}
+
+// With -s the program runs as the VMs of a deterministic simulation (see
+// DcpuSim in dcpu.h), as fast as they can. Their output has to come out the
+// same too, so each VM's is kept and written at the barriers in VM order.
+#define SIM_EPOCH_CYCLES 10000
+
+typedef struct {
+	Dcpu* dcpu;
+	CharVec out;
+} SimVm;
+
+static SimVm* simVms;
+
+static void SimOutput(SimVm* vm, const uint16_t* text, int count)
+{
+	if(!Vector_Reserve(vm->out, vm->out.count + count)) return;
+
+	WordsToChars(vm->out.elems + vm->out.count, text, count);
+	vm->out.count += count;
+}
+
+// SYS 2 of a VM
+void SysSimWrite(Dcpu* me, void* data)
+{
+	uint16_t addr = Dcpu_Pop(me);
+	uint16_t* text = Dcpu_GetRam(me) + addr;
+	SimOutput(data, text, FindZeroWord(text, 0x10000 - addr));
+}
+
+// SYS 3 of a VM
+void SysSimWriteBuffer(Dcpu* me, void* data)
+{
+	uint16_t addr = Dcpu_Pop(me);
+	int count = ClipLength(addr, Dcpu_Pop(me));
+	SimOutput(data, Dcpu_GetRam(me) + addr, count);
+}
+
+static void OnBarrier(DcpuSim* sim, void* data)
+{
+	Settings* settings = data;
+
+	for(int i = 0; i < settings->vms; i++){
+		SimVm* vm = simVms + i;
+		struct iovec iov = { vm->out.elems, vm->out.count };
+		if(vm->out.count) WriteOut(&iov, 1);
+		vm->out.count = 0;
+	}
+}
+
+// FNV-1a over the RAM and registers of every VM, which has to be the same
+// whatever the number of threads
+static uint64_t HashVms(SimVm* vms, int count)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+
+	for(int i = 0; i < count; i++){
+		uint16_t* ram = Dcpu_GetRam(vms[i].dcpu);
+
+		for(int addr = 0; addr < 0x10000 + DR_O + 1; addr++){
+			uint16_t word = addr < 0x10000 ? ram[addr] : Dcpu_GetRegister(vms[i].dcpu, addr - 0x10000);
+			hash = (hash ^ (word & 0xff)) * 0x100000001b3ULL;
+			hash = (hash ^ (word >> 8)) * 0x100000001b3ULL;
+		}
+	}
+
+	return hash;
+}
+
+int StartSim(Settings* settings)
+{
+	DcpuImage* image = DcpuImage_Get(settings->file);
+	LAssert(image, "could not load file: %s", settings->file);
+
+	DcpuSim* sim = DcpuSim_Create(SIM_EPOCH_CYCLES, settings->threads);
+	LAssert(sim, "could not start the simulation's threads");
+
+	if(settings->sharedCount)
+		LAssert(DcpuSim_Share(sim, settings->sharedStart, settings->sharedCount), "the shared range is outside the RAM");
+
+	SimVm* vms = simVms = calloc(settings->vms, sizeof(SimVm));
+	LAssert(vms, "out of memory");
+
+	for(int i = 0; i < settings->vms; i++){
+		vms[i].dcpu = Dcpu_CreateFromImage(image);
+		LAssert(vms[i].dcpu && DcpuSim_Add(sim, vms[i].dcpu), "out of memory");
+		Vector_Init(vms[i].out, char);
+
+		Dcpu_SetSysCall(vms[i].dcpu, SysSimWrite, 2, vms + i);
+		Dcpu_SetSysCall(vms[i].dcpu, SysSimWriteBuffer, 3, vms + i);
+	}
+
+	DcpuImage_Release(&image);
+
+	LogV("running %d VMs on %d threads", settings->vms, settings->threads);
+	while(DcpuSim_Run(sim, 1000, OnBarrier, settings));
+
+	LogI("%d VMs ran %llu epochs, state %016llx", settings->vms, 
+		(unsigned long long)DcpuSim_GetEpoch(sim), (unsigned long long)HashVms(vms, settings->vms));
+
+	int returnValue = Dcpu_GetRegister(vms[0].dcpu, DR_A);
+
+	DcpuSim_Destroy(&sim);
+	for(int i = 0; i < settings->vms; i++){
+		Vector_Free(vms[i].out);
+		Dcpu_Destroy(&vms[i].dcpu);
+	}
+	free(vms);
+
+	return returnValue;
 }
 
 int Start(Settings* settings)
 {
-	Dcpu* cpu = Dcpu_Create();
+	Dcpu* cpu;
+
+	if(settings->ramFile){
+		cpu = Dcpu_CreateWithBackingFile(settings->ramFile);
+		LAssert(cpu, "could not map the RAM file: %s", settings->ramFile);
+
+		uint16_t entry;
+		int words = LoadImage(Dcpu_GetRam(cpu), settings->file, &entry, NULL);
+		LAssert(words >= 0, "could not load file: %s", settings->file);
+
+		Dcpu_SetRegister(cpu, DR_PC, entry);
+		LogV("Loaded %d words, starting at 0x%04x", words, entry);
+	}else{
+		// The program's pages are shared with any other Dcpu running it
+		DcpuImage* image = DcpuImage_Get(settings->file);
+		LAssert(image, "could not load file: %s", settings->file);
+
+		cpu = Dcpu_CreateFromImage(image);
+		DcpuImage_Release(&image);
+		LAssert(cpu, "could not allocate RAM for the cpu");
+	}
+
 	uint16_t* ram = Dcpu_GetRam(cpu);
 	
-	Dcpu_SetSysCall(cpu, SysRead, 1, NULL);
+	reader.stdio = settings->debugFile != NULL;
+	reader.epoll = reader.stdio ? -1 : epoll_create1(EPOLL_CLOEXEC);
+	struct epoll_event event = { .events = EPOLLIN };
+	if(reader.epoll >= 0 && epoll_ctl(reader.epoll, EPOLL_CTL_ADD, STDIN_FILENO, &event) != 0){
+		close(reader.epoll);
+		reader.epoll = -1;
+	}
+
+	Dcpu_SetSysCall(cpu, SysRead, 1, &reader);
 	Dcpu_SetSysCall(cpu, SysWrite, 2, NULL);
+	Dcpu_SetSysCall(cpu, SysWriteBuffer, 3, NULL);
+	Dcpu_SetSysCall(cpu, SysReadBuffer, 4, &reader);
+
+	if(settings->machine == MT_Notch){
+		display = Display_Create(cpu, settings->freq, settings->framePrefix);
+		LAssert(display, "out of memory");
+	}
 
-	LoadRam(ram, settings->file);
+	Core cores[MAX_CORES];
+
+	for(int i = 1; i < settings->cores; i++){
+		cores[i].dcpu = Dcpu_CreateCore(cpu);
+		LAssert(cores[i].dcpu, "out of memory");
+		cores[i].freq = settings->freq;
+
+		Dcpu_SetSysCall(cores[i].dcpu, SysWrite, 2, NULL);
+		Dcpu_SetSysCall(cores[i].dcpu, SysWriteBuffer, 3, NULL);
+	}
+
+	// Started once they're all created, so that every core sees the number of them
+	for(int i = 1; i < settings->cores; i++)
+		LAssert(pthread_create(&cores[i].thread, NULL, RunCore, cores + i) == 0, "could not start a thread for core %d", i);
 
 	Debug* debugger = NULL;
 
 	if(settings->debugFile){
 		debugger = Debug_Create(cpu);
+		outUnbuffered = true;
 		Debug_LoadSymbols(debugger, settings->debugFile);
 	}
 	
 	LogV("Ram before execution:");
 	if(logLevel <= 1) DumpRam(ram, GetUsedRam(ram));
 
-	LogV("sleeping every %d instructions", settings->freq);
+	if(settings->freq && !debugger){
+		LogV("running at %d cycles per millisecond", settings->freq);
+
+		DcpuPacer* pacer = DcpuPacer_Create();
+		LAssert(pacer && DcpuPacer_Add(pacer, cpu, settings->freq * 1000, OnStatus, settings), "out of memory");
+		DcpuPacer_Run(pacer);
+		DcpuPacer_Destroy(&pacer);
+	}
+	else{
+		DcpuStatus status;
+		while((status = Dcpu_Execute(cpu, 1000)) != DCPU_EXITED || debugger){
+			if(debugger && status == DCPU_EXITED){
+				LogI("program finished");
+				debugger->runInstructions = 0;
+				Debug_Inspector(cpu, debugger);
+			}
+
+			if(status != DCPU_EXITED && !OnStatus(cpu, status, settings)) break;
 
-	int stillRunning = 0;
-	while((stillRunning = Dcpu_Execute(cpu, settings->freq ? settings->freq : 1000)) || debugger){
-		if(debugger && !stillRunning){
-			LogI("program finished");
-			debugger->runInstructions = 0;
-			Debug_Inspector(cpu, debugger);
+			// Other cores wake one sooner than the RAM file
+			if(status == DCPU_IDLE && settings->cores > 1) sched_yield();
+			else if(status == DCPU_IDLE) usleep(1000);
 		}
+	}
+
+	__atomic_store_n(&coresStop, true, __ATOMIC_RELAXED);
+	for(int i = 1; i < settings->cores; i++) pthread_join(cores[i].thread, NULL);
 
-		// Sleep 1 millisecond for every ~freq cycles executed (default 7000)
-		if(settings->freq) SDL_Delay(1);
+	FlushOutput();
+
+	if(display){
+		Display_Update(display);
+		if(!Display_Dump(display)) LogE("could not write a frame to %s", settings->framePrefix);
+
+		LogV("display: %d frames, %d cells drawn", display->frame, display->cellsDrawn);
+		Display_Destroy(&display);
 	}
 
 	int returnValue = Dcpu_GetRegister(cpu, DR_A);
@@ -72,6 +492,14 @@ int Start(Settings* settings)
 	LogV("Ram after execution:");
 	if(logLevel <= 1) DumpRam(ram, GetUsedRam(ram));
 
+	if(!Dcpu_Sync(cpu)) LogE("could not write the RAM file: %s", settings->ramFile);
+
+	int resident, shared;
+	if(Dcpu_GetRamPages(cpu, &resident, &shared))
+		LogV("RAM pages in memory: %d, %d of them shared", resident, shared);
+
+	if(reader.epoll >= 0) close(reader.epoll);
+	for(int i = 1; i < settings->cores; i++) Dcpu_Destroy(&cores[i].dcpu);
 	Dcpu_Destroy(&cpu);
 	if(debugger) Debug_Destroy(&debugger);
 	return returnValue;
@@ -80,13 +508,15 @@ int Start(Settings* settings)
 
 int main(int argc, char** argv)
 {
-	const char* usage = "usage: %s (-vX | -d) [dcpu-16 binary]";
+	const char* usage = "usage: %s (-vX | -d | -rF) [dcpu-16 binary]";
 	LAssert(argc >= 2, usage, argv[0]);
 
 	Settings settings;
 	memset(&settings, 0, sizeof(Settings));
 
 	settings.freq = 7000;
+	settings.cores = 1;
+	settings.threads = ThreadPool_NumCores();
 
 	bool debugging = false;
 
@@ -107,13 +537,33 @@ int main(int argc, char** argv)
 				LogI("Available flags:");
 				LogI("  -vX   set log level, where X is [0-5] - default: 2");
 				LogI("  -d    start with debugger");
+				LogI("  -rF   keep the RAM in file F, which is created if needed and kept between runs.");
+				LogI("        The program is loaded into it on every run, over the words it has");
 				LogI("  -fF   interpret at frequency F in MHz - default 7.0 MHz, 0.0 = as fast as possible");
 				LogI("  -mM   start with machine M - none (default, only cpu), notch (speculative), noname (my own awesome machine)");
+				LogI("        notch has a 128x96 display, kept in memory: its screen is at 0x8000 and its font at 0x8180");
+				LogI("  -oP   write the notch display's frames to P0000.ppm, P0001.ppm... whenever they change");
+				LogI("  -cN   run the program on N cores sharing its RAM, each on a thread of its own - default 1, at most %d", MAX_CORES);
+				LogI("  -sN   run the program as N VMs of a deterministic simulation, as fast as possible (not with -d, -r or -m)");
+				LogI("  -tT   run the VMs on T threads - default: one per processor. The VMs come out the same on any number.");
+				LogI("  -wA,N share the N words from address A between the VMs");
 				return 0;
 			}
 			else if(sscanf(v, "-f%f", &fFreq) == 1){ settings.freq = (int)(fFreq * 1000.0f); }
 			else if(sscanf(v, "-v%d", &logLevel) == 1){}
+			else if(sscanf(v, "-s%d", &settings.vms) == 1){
+				LAssert(settings.vms >= 1 && settings.vms <= 0xffff, "the number of VMs must be 1 to 65535");
+			}
+			else if(sscanf(v, "-t%d", &settings.threads) == 1){
+				LAssert(settings.threads >= 1, "the number of threads must be at least 1");
+			}
+			else if(sscanf(v, "-w%i,%i", &settings.sharedStart, &settings.sharedCount) == 2){}
+			else if(sscanf(v, "-c%d", &settings.cores) == 1){
+				LAssert(settings.cores >= 1 && settings.cores <= MAX_CORES, "the number of cores must be 1 to %d", MAX_CORES);
+			}
 			else if(!strcmp(v, "-d")){ debugging = true; }
+			else if(!strncmp(v, "-r", 2) && v[2]){ settings.ramFile = v + 2; }
+			else if(!strncmp(v, "-o", 2) && v[2]){ settings.framePrefix = v + 2; }
 			else if(sscanf(v, "-m%s", machineStr)){}
 			else{
 				LogF("No such flag: %s", v);
@@ -138,4 +588,10 @@ int main(int argc, char** argv)
 		settings.debugFile = tmp;
 	}
 
+	if(settings.vms){
+		LAssert(!debugging && !settings.ramFile && settings.machine == MT_None && settings.cores == 1, 
+			"-s can't be used with -d, -r, -m or -c");
+		return StartSim(&settings);
+	}
+
 	return Start(&settings);}
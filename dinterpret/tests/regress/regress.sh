@@ -13,4 +13,161 @@ if [ "$ret" != "123" ]; then
 	exit 1
 fi
 
+echo "executing as a segmented image"
+
+../../../dasm/dasm -i reg_ref_overflow.dasm /tmp/out.dimg
+../../dinterpret /tmp/out.dimg
+ret=$?
+
+if [ "$ret" != "123" ]; then
+	echo "reg_ref_overflow image returned $ret instead of 123"
+	exit 1
+fi
+
+echo "executing with a RAM file"
+
+rm -f /tmp/persist.ram
+../../../dasm/dasm -i persist.dasm /tmp/persist.dimg
+
+for i in 1 2 3; do
+	../../dinterpret -r/tmp/persist.ram /tmp/persist.dimg
+	ret=$?
+
+	if [ "$ret" != "$i" ]; then
+		echo "persist returned $ret instead of $i"
+		exit 1
+	fi
+done
+
+echo "executing an idle program"
+
+../../../dasm/dasm idle.dasm /tmp/idle.dbin
+timeout 10 ../../dinterpret /tmp/idle.dbin
+ret=$?
+
+if [ "$ret" != "42" ]; then
+	echo "idle returned $ret instead of 42"
+	exit 1
+fi
+
+echo "reading from stdin"
+
+../../../dasm/dasm ../syshello.dasm /tmp/syshello.dbin
+out=$(echo bob | ../../dinterpret /tmp/syshello.dbin | tail -2 | tr -d '\n')
+
+if [ "$out" != "> Hello bob!" ]; then
+	echo "syshello printed '$out' instead of '> Hello bob!'"
+	exit 1
+fi
+
+echo "reading lines that came in together"
+
+../../../dasm/dasm tworeads.dasm /tmp/tworeads.dbin
+ret=$( (printf 'a\nb\n'; sleep 3) | (timeout 2 ../../dinterpret -f0 /tmp/tworeads.dbin > /dev/null; echo $?) )
+
+if [ "$ret" != "123" ]; then
+	echo "tworeads returned $ret instead of 123"
+	exit 1
+fi
+
+echo "bulk reads and writes"
+
+../../../dasm/dasm bulkio.dasm /tmp/bulkio.dbin
+echo abcdefgh | ../../dinterpret /tmp/bulkio.dbin > /tmp/bulkio.out
+ret=$?
+out=$(head -c 10 /tmp/bulkio.out)
+
+if [ "$out" != "abcdeabcde" ] || [ "$ret" != "5" ]; then
+	echo "bulkio printed '$out' and returned $ret instead of 'abcdeabcde' and 5"
+	exit 1
+fi
+
+echo "memory intrinsics"
+
+../../../dasm/dasm intrinsics.dasm /tmp/intrinsics.dbin
+../../dinterpret /tmp/intrinsics.dbin
+ret=$?
+
+if [ "$ret" != "123" ]; then
+	echo "intrinsics returned $ret instead of 123"
+	exit 1
+fi
+
+echo "loop idioms"
+
+../../../dasm/dasm idioms.dasm /tmp/idioms.dbin
+../../dinterpret /tmp/idioms.dbin
+ret=$?
+
+if [ "$ret" != "123" ]; then
+	echo "idioms returned $ret instead of 123"
+	exit 1
+fi
+
+echo "interrupts"
+
+../../../dasm/dasm interrupts.dasm /tmp/interrupts.dbin
+../../dinterpret /tmp/interrupts.dbin
+ret=$?
+
+if [ "$ret" != "123" ]; then
+	echo "interrupts returned $ret instead of 123"
+	exit 1
+fi
+
+echo "scheduler on cores"
+
+../../../dasm/dasm ../scheduler.dasm /tmp/scheduler.dbin
+
+for cores in 1 4; do
+	../../dinterpret -f0 -c$cores /tmp/scheduler.dbin > /dev/null
+	ret=$?
+
+	if [ "$ret" != "123" ]; then
+		echo "scheduler on $cores cores returned $ret instead of 123"
+		exit 1
+	fi
+done
+
+echo "deterministic simulation"
+
+../../../dasm/dasm sim.dasm /tmp/sim.dbin
+../../dinterpret -s8 -t1 -w0xf000,32 /tmp/sim.dbin > /tmp/sim_t1.txt
+
+for threads in 3 8; do
+	../../dinterpret -s8 -t$threads -w0xf000,32 /tmp/sim.dbin > /tmp/sim_t$threads.txt
+
+	if ! cmp -s /tmp/sim_t1.txt /tmp/sim_t$threads.txt; then
+		echo "the simulation came out different on $threads threads than on one"
+		exit 1
+	fi
+done
+
+echo "stack in a shared range"
+
+../../../dasm/dasm stack_share.dasm /tmp/stack_share.dbin
+timeout 10 ../../dinterpret -s2 -w0xf000,32 /tmp/stack_share.dbin > /dev/null
+ret=$?
+
+if [ "$ret" != "123" ]; then
+	echo "stack_share returned $ret instead of 123"
+	exit 1
+fi
+
+echo "notch display"
+
+../../../dasm/dasm display.dasm /tmp/display.dbin
+rm -f /tmp/display_frame*.ppm
+../../dinterpret -f0 -mnotch -o/tmp/display_frame /tmp/display.dbin
+
+# Pixels of each colour in the two frames, the header is 14 bytes
+first=$(tail -c +15 /tmp/display_frame0000.ppm | od -An -v -tx1 -w3 | grep -c "ff ff ff")
+second=$(tail -c +15 /tmp/display_frame0001.ppm | od -An -v -tx1 -w3 | grep -c "ff ff ff")
+blue=$(tail -c +15 /tmp/display_frame0001.ppm | od -An -v -tx1 -w3 | grep -c "00 00 aa")
+
+if [ "$first" != "20" ] || [ "$second" != "15" ] || [ "$blue" != "32" ] || [ -e /tmp/display_frame0002.ppm ]; then
+	echo "display frames had $first, $second white and $blue blue pixels instead of 20, 15 and 32"
+	exit 1
+fi
+
 echo "ok"
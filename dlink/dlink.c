@@ -0,0 +1,183 @@
+#include "common.h"
+#include "dobj.h"
+
+int logLevel;
+
+typedef struct {
+	const char* name;
+	uint16_t addr;
+	int object;
+} Symbol;
+
+typedef struct {
+	DObj* obj;
+	const char* filename;
+	uint16_t base;
+} Input;
+
+typedef Vector(Input) InputVec;
+
+int CompareSymbols(const void* a, const void* b)
+{
+	return strcmp(((const Symbol*)a)->name, ((const Symbol*)b)->name);
+}
+
+Symbol* FindSymbol(Symbol* symbols, int count, const char* name)
+{
+	Symbol key = {name, 0, 0};
+	return bsearch(&key, symbols, count, sizeof(Symbol), CompareSymbols);
+}
+
+int main(int argc, char** argv)
+{
+	logLevel = 2;
+
+	unsigned start = 0;
+	bool debugSymbols = false;
+	char c;
+	DByteOrder byteOrder = DBO_LittleEndian;
+
+	const char* outFile = NULL;
+	InputVec inputs;
+	Vector_Init(inputs, Input);
+
+	const char* usage = "usage: %s (-vX | -h | -sX | -d | -eX) [out binary] [object] ([object] ...)";
+
+	for(int i = 1; i < argc; i++){
+		char* v = argv[i];
+		if(v[0] == '-'){
+			if(!strcmp(v, "-h")){
+				LogI(usage, argv[0]);
+				LogI(" ");
+				LogI("Available flags:");
+				LogI("  -vX   set log level, where X is [0-5] - default: 2");
+				LogI("  -sX   set the address of the first object [0-FFFF] - default 0");
+				LogI("  -h    show this help message");
+				LogI("  -d    generate debug symbols");
+				LogI("  -eX   set endianness of output, where X is [l | b] default: l");
+				return 0;
+			}
+			else if(sscanf(v, "-v%d", &logLevel) == 1){}
+			else if(sscanf(v, "-s%x", &start) == 1){}
+			else if(sscanf(v, "-e%1c", &c) == 1){ byteOrder = c == 'l' ? DBO_LittleEndian : DBO_BigEndian; }
+			else if(!strcmp(v, "-d")){ debugSymbols = true; }
+			else{
+				LogF("No such flag: %s", v);
+				return 1;
+			}
+		}else if(!outFile){
+			outFile = v;
+		}else{
+			Input in = {NULL, v, 0};
+			LAssert(Vector_Add(inputs, in), "Could not allocate RAM for inputs");
+		}
+	}
+
+	LAssert(outFile && inputs.count > 0, usage, argv[0]);
+	LAssert(start <= 0xffff, "Start address must be within range 0 - 0xFFFF (not %x)", start);
+
+	// Load the objects and place them one after another
+	int addr = start;
+	int numSymbols = 0;
+
+	Input* in;
+	Vector_ForEach(inputs, in){
+		LogV("Loading: %s", in->filename);
+		char error[4096];
+		in->obj = DObj_Load(in->filename, error, sizeof(error));
+		LAssert(in->obj, "%s", error);
+
+		in->base = addr;
+		addr += in->obj->code.count;
+		numSymbols += in->obj->exports.count;
+
+		LAssert(addr <= 0x10000, "Out of space in binary when placing %s at 0x%04x", in->filename, in->base);
+		LogV("  placed at 0x%04x - 0x%04x", in->base, addr);
+	}
+
+	// Collect the exported symbols of all objects
+	Symbol* symbols = calloc(numSymbols + 1, sizeof(Symbol));
+	int at = 0;
+
+	for(int i = 0; i < inputs.count; i++){
+		DObjSymbol* s;
+		Vector_ForEach(inputs.elems[i].obj->exports, s){
+			Symbol sym = {s->name, inputs.elems[i].base + s->offset, i};
+			symbols[at++] = sym;
+		}
+	}
+
+	qsort(symbols, numSymbols, sizeof(Symbol), CompareSymbols);
+
+	bool failed = false;
+
+	for(int i = 1; i < numSymbols; i++){
+		if(!strcmp(symbols[i - 1].name, symbols[i].name)){
+			LogE("duplicate label: %s, defined in both %s and %s", symbols[i].name,
+				inputs.elems[symbols[i - 1].object].filename, inputs.elems[symbols[i].object].filename);
+			failed = true;
+		}
+	}
+
+	Vector_ForEach(inputs, in){
+		DObjStr* imp;
+		Vector_ForEach(in->obj->imports, imp){
+			if(!FindSymbol(symbols, numSymbols, *imp)){
+				LogE("No such label: %s, imported by %s", *imp, in->filename);
+				failed = true;
+			}
+		}
+	}
+
+	LAssert(!failed, "linking failed");
+
+	// Copy the code into place and apply the relocations
+	uint16_t* ram = calloc(1, sizeof(uint16_t) * 0x10000);
+
+	Vector_ForEach(inputs, in){
+		memcpy(ram + in->base, in->obj->code.elems, in->obj->code.count * sizeof(uint16_t));
+
+		DObjReloc* r;
+		Vector_ForEach(in->obj->relocs, r){
+			uint16_t at = in->base + r->offset;
+			Symbol* target = FindSymbol(symbols, numSymbols, r->symbol);
+			LAssert(target, "No such label: %s, referenced from %s", r->symbol, in->filename);
+
+			// The stored word is an addend, dasm leaves it at 0
+			if(r->relative) ram[at] += target->addr - at - 1;
+			else ram[at] += target->addr;
+
+			LogD("relocated 0x%04x in %s against %s: 0x%04x", at, in->filename, r->symbol, ram[at]);
+		}
+	}
+
+	if(debugSymbols){
+		char tmp[4096];
+		snprintf(tmp, sizeof(tmp), "%s.dbg", outFile);
+		FILE* debugFile = fopen(tmp, "w");
+		LogV("Opening debug file: %s", tmp);
+		LAssert(debugFile, "could not open file: %s", tmp);
+
+		Vector_ForEach(inputs, in){
+			DObjDebug* d;
+			Vector_ForEach(in->obj->debug, d){
+				fprintf(debugFile, "%04x %04x %d %s%s%s\n", (uint16_t)(in->base + d->offset), d->length,
+					d->line, d->file, d->labels[0] ? " " : "", d->labels);
+			}
+		}
+
+		fclose(debugFile);
+	}
+
+	if(logLevel == 0) DumpRam(ram, addr - 1);
+
+	LogV("Writing to: %s", outFile);
+	if(addr > start) LAssert(WriteRam(ram, outFile, addr - 1, byteOrder), "could not open new file for writing: %s", outFile);
+
+	Vector_ForEach(inputs, in) DObj_Destroy(&in->obj);
+	Vector_Free(inputs);
+	free(symbols);
+	free(ram);
+
+	return 0;
+}
@@ -5,13 +5,185 @@
 #include <stdbool.h>
 
 typedef struct Dcpu Dcpu;
+typedef struct DcpuImage DcpuImage;
 
+// Returns NULL if out of memory
 Dcpu* Dcpu_Create();
+
+// RAM mapped from a 128 kB file, created if it doesn't exist. NULL on errors.
+Dcpu* Dcpu_CreateWithBackingFile(const char* path);
+
+// A program, loaded once and shared by the Dcpus created from it. NULL on errors.
+DcpuImage* DcpuImage_Get(const char* filename);
+void DcpuImage_AddRef(DcpuImage* me);
+void DcpuImage_Release(DcpuImage** me);
+uint16_t DcpuImage_GetEntry(DcpuImage* me);
+
+// A private copy on write view of the image, NULL if out of memory
+uint16_t* DcpuImage_Map(DcpuImage* me);
+void DcpuImage_Unmap(DcpuImage* me, uint16_t* ram);
+
+// Starts at the image's entry point, NULL if out of memory
+Dcpu* Dcpu_CreateFromImage(DcpuImage* image);
+
+// A Dcpu sharing first's RAM, to run on another thread (see libdcpu/lib/smp.dasm). NULL if out of memory.
+Dcpu* Dcpu_CreateCore(Dcpu* first);
+
+#define DCPU_SYS_CAS 0xff20    // if [A] is B sets it to C, A = what [A] was (B if it was set)
+#define DCPU_SYS_FENCE 0xff21  // a full memory barrier
+#define DCPU_SYS_CORE 0xff22   // A = the number of the core, 0 for the first, B = the number of cores
+
+// The RAM's pages in memory, and those of them not the Dcpu's own, false on errors
+bool Dcpu_GetRamPages(Dcpu* me, int* resident, int* shared);
+
+// Writes the RAM of a file backed Dcpu to the file, false on errors
+bool Dcpu_Sync(Dcpu* me);
+
 void Dcpu_Destroy(Dcpu** me);
 uint16_t* Dcpu_GetRam(Dcpu* me);
-int Dcpu_Execute(Dcpu* me, int cycles);
 
-void Dcpu_SetSysCall(Dcpu* me, void (*sc)(Dcpu* me, void* data), int id, void* data);
+// Marks words the host or a syscall wrote through Dcpu_GetRam
+void Dcpu_MarkDirty(Dcpu* me, uint16_t addr, int count);
+
+// Puts the Dcpu back in the state it was created in, keeping its syscalls
+void Dcpu_Reset(Dcpu* me);
+
+// Thread safe, clean Dcpus made from image (NULL for zeroed RAM), each set up once
+typedef struct DcpuPool DcpuPool;
+
+DcpuPool* DcpuPool_Create(DcpuImage* image, void (*setup)(Dcpu* dcpu, void* data), void* data);
+void DcpuPool_Destroy(DcpuPool** me);
+
+// Creates numDcpus up front, false if out of memory
+bool DcpuPool_Fill(DcpuPool* me, int numDcpus);
+
+// NULL if the pool is empty and a new Dcpu can't be created
+Dcpu* DcpuPool_Acquire(DcpuPool* me);
+void DcpuPool_Release(DcpuPool* me, Dcpu* dcpu);
+
+typedef enum {
+	DCPU_EXITED,    // the program ended (SYS 0)
+	DCPU_RUNNING,   // ran for the cycles given
+	DCPU_IDLE,      // in a loop that only reads memory
+	DCPU_WAITING,   // suspended by a syscall, until Dcpu_Resume
+} DcpuStatus;
+
+// Runs for about the number of cycles given
+DcpuStatus Dcpu_Execute(Dcpu* me, int cycles);
+
+// The cycles the last Dcpu_Execute ran, which can be a few more than asked for
+int Dcpu_GetCycles(Dcpu* me);
+
+// All the cycles run since the Dcpu was created or reset
+uint64_t Dcpu_GetCycleCount(Dcpu* me);
+
+// Callbacks fired when the cycle count reaches the cycle they're scheduled for
+typedef struct DcpuEvent DcpuEvent;
+
+// NULL if out of memory
+DcpuEvent* Dcpu_AddEvent(Dcpu* me, void (*fire)(Dcpu* dcpu, void* data), void* data);
+void Dcpu_RemoveEvent(Dcpu* me, DcpuEvent** event);
+void Dcpu_ScheduleEvent(Dcpu* me, DcpuEvent* event, uint64_t cycle);
+void Dcpu_CancelEvent(Dcpu* me, DcpuEvent* event);
+bool DcpuEvent_IsArmed(DcpuEvent* me);
+
+// Runs Dcpus at their clock rates in real time, on the calling thread
+typedef struct DcpuPacer DcpuPacer;
+
+DcpuPacer* DcpuPacer_Create();
+void DcpuPacer_Destroy(DcpuPacer** me);
+
+// status (may be NULL) is called after each batch, false to leave. False if out of memory.
+bool DcpuPacer_Add(DcpuPacer* me, Dcpu* dcpu, int hz, 
+	bool (*status)(Dcpu* dcpu, DcpuStatus status, void* data), void* data);
+
+// Returns when no Dcpus are left
+void DcpuPacer_Run(DcpuPacer* me);
+
+// Runs Dcpus (VMs) in parallel epochs, with the same results on any number of threads
+typedef struct DcpuSim DcpuSim;
+
+// NULL if out of memory or no thread could be started
+DcpuSim* DcpuSim_Create(int epochCycles, int numThreads);
+
+// Destroy it before the Dcpus, which can't be run after that
+void DcpuSim_Destroy(DcpuSim** me);
+
+// Words every VM has a copy of, set before VMs are added. False on errors.
+bool DcpuSim_Share(DcpuSim* me, uint16_t start, int count);
+
+// Adds a VM numbered from 0 and sets the syscalls below on it, false if out of memory
+bool DcpuSim_Add(DcpuSim* me, Dcpu* dcpu);
+
+// Raised at the next barrier, false if there's no such VM or out of memory
+bool DcpuSim_Interrupt(DcpuSim* me, int vm, uint16_t message);
+
+// Runs up to epochs epochs, calling barrier (may be NULL) after each. Returns the number run.
+int DcpuSim_Run(DcpuSim* me, int epochs, void (*barrier)(DcpuSim* sim, void* data), void* data);
+
+// The epochs run so far
+uint64_t DcpuSim_GetEpoch(DcpuSim* me);
+
+#define DCPU_SIM_INBOX_WORDS 0x10000
+
+#define DCPU_SYS_SIM_ID 0xff30       // A = the number of the VM, B = the number of VMs
+#define DCPU_SYS_SIM_SEND 0xff31     // sends C words from [B] to VM A, A = C or 0 if it can't be sent
+#define DCPU_SYS_SIM_RECEIVE 0xff32  // receives up to C words to [B], A = the length or 0xffff, C = the sender
+#define DCPU_SYS_SIM_NOTIFY 0xff33   // interrupts with message B at barriers that deliver messages, 0 to stop
+
+// Setting an id again replaces its syscall, false if out of memory
+bool Dcpu_SetSysCall(Dcpu* me, void (*sc)(Dcpu* me, void* data), int id, void* data);
+
+// For a syscall that can't complete right away, Dcpu_Execute returns DCPU_WAITING until resumed
+void Dcpu_Suspend(Dcpu* me);
+void Dcpu_Resume(Dcpu* me);
+bool Dcpu_IsWaiting(Dcpu* me);
+
+// Raises an interrupt from any thread, false if 256 are already waiting
+bool Dcpu_Interrupt(Dcpu* me, uint16_t message);
+
+// A device on the memory bus, count words from start, with hooks that may be NULL
+typedef struct DcpuDevice DcpuDevice;
+
+// NULL if out of memory or the range is outside the RAM
+DcpuDevice* Dcpu_MapDevice(Dcpu* me, uint16_t start, int count, 
+	uint16_t (*read)(Dcpu* dcpu, uint16_t addr, void* data), 
+	void (*write)(Dcpu* dcpu, uint16_t addr, uint16_t value, void* data), void* data);
+void Dcpu_UnmapDevice(Dcpu* me, DcpuDevice** device);
+
+// The first run [start, end) of words written at or after from, false if none
+bool DcpuDevice_NextDirty(DcpuDevice* me, int from, int* start, int* end);
+void DcpuDevice_ClearDirty(DcpuDevice* me);
+
+// Memory intrinsics, syscalls set on every Dcpu (see libdcpu/lib/mem.dasm)
+#define DCPU_SYS_MEMCPY 0xff00   // copies C words from [B] to [A], they may overlap
+#define DCPU_SYS_MEMSET 0xff01   // sets C words from [A] to B
+#define DCPU_SYS_MEMCMP 0xff02   // compares C words at [A] and [B]: A = 0, 1 if [A] is greater or 0xffff
+#define DCPU_SYS_STRLEN 0xff03   // A = the number of words from [A] up to a zero
+
+// What an intrinsic costs on top of SYS: call cycles, and word cycles per word
+#define DCPU_INTRINSIC_CALL_CYCLES 2
+#define DCPU_INTRINSIC_WORD_CYCLES 1
+
+void Dcpu_SetIntrinsicCost(Dcpu* me, int callCycles, int wordCycles);
+
+// Channels carry words one way between Dcpus, on any threads (see libdcpu/lib/channel.dasm)
+#define DCPU_CHANNELS 16
+
+#define DCPU_SYS_SEND 0xff10     // sends C words from [B] on channel A, A = C if they fit, 0 if not
+#define DCPU_SYS_RECEIVE 0xff11  // receives up to C words to [B], A = the number received
+#define DCPU_SYS_POLL 0xff12     // A = the words waiting to be received, or that would fit to send
+#define DCPU_SYS_NOTIFY 0xff13   // interrupts the receiver with message B when words come in, 0 to stop
+
+typedef struct DcpuChannel DcpuChannel;
+
+// words is rounded up to a power of two, at most 0x10000. NULL if out of memory.
+DcpuChannel* DcpuChannel_Create(int words);
+void DcpuChannel_Destroy(DcpuChannel** channel);
+
+// False if id isn't a channel number
+bool Dcpu_AttachChannel(Dcpu* me, int id, DcpuChannel* channel, bool sends);
+void Dcpu_DetachChannel(Dcpu* me, int id);
 
 uint16_t Dcpu_Pop(Dcpu* me);
 void Dcpu_Push(Dcpu* me, uint16_t v);
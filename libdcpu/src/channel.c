@@ -0,0 +1,261 @@
+#include "common.h"
+#include "dcpui.h"
+
+// A channel is attached to a Dcpu as one of its DCPU_CHANNELS numbers, as
+// the end that sends or the one that receives, and each end to one Dcpu
+// only. The channel must outlive the Dcpus it's attached to, and the
+// receiver must outlive the sender, which raises its notification
+// interrupts. Channels stay attached over Dcpu_Reset, but notifications are
+// turned off.
+//
+// The syscalls take the channel number in A, and the other arguments and
+// the result like the memory intrinsics (and cost what they do). A is
+// 0xffff if the Dcpu doesn't have that end of the channel. A send that
+// doesn't fit sends nothing, so one of more than the ring's words never
+// fits. NOTIFY interrupts the receiver once, and again after a receive that
+// leaves the channel empty.
+//
+// A channel is a ring of words with one sender and one receiver, usually on
+// different threads. Only the sender moves tail and only the receiver moves
+// head, so neither needs a lock: a side publishes the words it wrote (or
+// the room it freed) with a release store of its index, and the other side
+// loads it with acquire before touching the words. Each side keeps its own
+// copy of the other's index and loads the real one only when the copy says
+// the ring is full (or empty), so the cache lines aren't passed back and
+// forth on every call.
+//
+// Notification: the receiver arms the channel when it empties it, and the
+// sender that finds it armed after adding words disarms it and raises the
+// interrupt. Both store and then load the other's variable with a full fence
+// in between, so either the sender sees armed or the receiver sees the new
+// words (and raises the interrupt itself), it can't be missed.
+
+#define CACHE_LINE 64
+
+struct DcpuChannel {
+	uint32_t size;   // a power of two
+	uint16_t* words;
+	Dcpu* receiver;
+
+	// The sender's
+	uint32_t tail __attribute__((aligned(CACHE_LINE)));
+	uint32_t senderHead;
+
+	// The receiver's
+	uint32_t head __attribute__((aligned(CACHE_LINE)));
+	uint32_t receiverTail;
+
+	// Both sides'
+	bool armed __attribute__((aligned(CACHE_LINE)));
+	uint16_t message;   // of the notification interrupt, 0 for none
+};
+
+DcpuChannel* DcpuChannel_Create(int words)
+{
+	if(words <= 0 || words > 0x10000) return NULL;
+
+	DcpuChannel* me;
+	if(posix_memalign((void**)&me, CACHE_LINE, sizeof(DcpuChannel)) != 0) return NULL;
+	memset(me, 0, sizeof(DcpuChannel));
+
+	me->size = 1;
+	while(me->size < (uint32_t)words) me->size *= 2;
+
+	me->words = calloc(me->size, sizeof(uint16_t));
+	if(!me->words){
+		free(me);
+		return NULL;
+	}
+
+	return me;
+}
+
+void DcpuChannel_Destroy(DcpuChannel** me)
+{
+	free((*me)->words);
+	free(*me);
+	*me = NULL;
+}
+
+bool Dcpu_AttachChannel(Dcpu* me, int id, DcpuChannel* channel, bool sends)
+{
+	if(id < 0 || id >= DCPU_CHANNELS) return false;
+
+	me->channels[id] = channel;
+	me->channelSends[id] = sends;
+	if(!sends) __atomic_store_n(&channel->receiver, me, __ATOMIC_RELEASE);
+
+	return true;
+}
+
+void Dcpu_DetachChannel(Dcpu* me, int id)
+{
+	if(id < 0 || id >= DCPU_CHANNELS) return;
+
+	DcpuChannel* channel = me->channels[id];
+	if(channel && !me->channelSends[id]){
+		__atomic_store_n(&channel->message, 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&channel->armed, false, __ATOMIC_SEQ_CST);
+		__atomic_store_n(&channel->receiver, NULL, __ATOMIC_RELEASE);
+	}
+
+	me->channels[id] = NULL;
+}
+
+// What fits in a register
+static uint16_t Clip(uint32_t words)
+{
+	return words < 0xffff ? words : 0xffff;
+}
+
+// The channel A names, if the Dcpu has that end of it, sets A to 0xffff if not
+static DcpuChannel* GetChannel(Dcpu* me, bool sends)
+{
+	uint16_t id = me->regs[DR_A];
+
+	if(id >= DCPU_CHANNELS || !me->channels[id] || me->channelSends[id] != sends){
+		me->regs[DR_A] = 0xffff;
+		return NULL;
+	}
+
+	return me->channels[id];
+}
+
+// Raises the notification if the channel is armed, from either side. A
+// sender may have found it armed just before the receiver was detached, then
+// there's no one to notify.
+static void Notify(DcpuChannel* me)
+{
+	uint16_t message = __atomic_load_n(&me->message, __ATOMIC_RELAXED);
+
+	if(message && __atomic_load_n(&me->armed, __ATOMIC_RELAXED) && __atomic_exchange_n(&me->armed, false, __ATOMIC_SEQ_CST)){
+		Dcpu* receiver = __atomic_load_n(&me->receiver, __ATOMIC_ACQUIRE);
+		if(receiver) Dcpu_Interrupt(receiver, message);
+	}
+}
+
+// The receiver ran out of words: arm the notification, and in case words
+// came in meanwhile look once more
+static void Arm(DcpuChannel* me)
+{
+	if(!__atomic_load_n(&me->message, __ATOMIC_RELAXED)) return;
+
+	__atomic_store_n(&me->armed, true, __ATOMIC_SEQ_CST);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	if(__atomic_load_n(&me->tail, __ATOMIC_ACQUIRE) != me->head) Notify(me);
+}
+
+static void SysChannelSend(Dcpu* me, void* data)
+{
+	DcpuChannel* channel = GetChannel(me, true);
+	if(!channel) return;
+
+	uint16_t addr = me->regs[DR_B];
+	uint32_t count = ClipLength(addr, me->regs[DR_C]);
+	uint32_t tail = channel->tail;
+
+	// Sent whole or not at all, so that a message is never split
+	if(channel->size - (tail - channel->senderHead) < count){
+		channel->senderHead = __atomic_load_n(&channel->head, __ATOMIC_ACQUIRE);
+
+		if(channel->size - (tail - channel->senderHead) < count){
+			me->regs[DR_A] = 0;
+			ChargeIntrinsic(me, 0);
+			return;
+		}
+	}
+
+	uint32_t at = tail & (channel->size - 1);
+	uint32_t first = count < channel->size - at ? count : channel->size - at;
+
+	memcpy(channel->words + at, me->ram + addr, first * sizeof(uint16_t));
+	memcpy(channel->words, me->ram + addr + first, (count - first) * sizeof(uint16_t));
+
+	__atomic_store_n(&channel->tail, tail + count, __ATOMIC_RELEASE);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if(count) Notify(channel);
+
+	me->regs[DR_A] = count;
+	ChargeIntrinsic(me, count);
+}
+
+static void SysChannelReceive(Dcpu* me, void* data)
+{
+	DcpuChannel* channel = GetChannel(me, false);
+	if(!channel) return;
+
+	uint16_t addr = me->regs[DR_B];
+	uint32_t count = ClipLength(addr, me->regs[DR_C]);
+	uint32_t head = channel->head;
+
+	if(channel->receiverTail - head < count) channel->receiverTail = __atomic_load_n(&channel->tail, __ATOMIC_ACQUIRE);
+	if(channel->receiverTail - head < count) count = channel->receiverTail - head;
+
+	uint32_t at = head & (channel->size - 1);
+	uint32_t first = count < channel->size - at ? count : channel->size - at;
+
+	memcpy(me->ram + addr, channel->words + at, first * sizeof(uint16_t));
+	memcpy(me->ram + addr + first, channel->words, (count - first) * sizeof(uint16_t));
+	if(count) Dcpu_MarkDirty(me, addr, count);
+
+	__atomic_store_n(&channel->head, head + count, __ATOMIC_RELEASE);
+	if(channel->receiverTail == head + count) Arm(channel);
+
+	me->regs[DR_A] = count;
+	ChargeIntrinsic(me, count);
+}
+
+static void SysChannelPoll(Dcpu* me, void* data)
+{
+	uint16_t id = me->regs[DR_A];
+	if(id >= DCPU_CHANNELS || !me->channels[id]){
+		me->regs[DR_A] = 0xffff;
+		return;
+	}
+
+	DcpuChannel* channel = me->channels[id];
+
+	if(me->channelSends[id]){
+		channel->senderHead = __atomic_load_n(&channel->head, __ATOMIC_ACQUIRE);
+		me->regs[DR_A] = Clip(channel->size - (channel->tail - channel->senderHead));
+	}
+	else{
+		channel->receiverTail = __atomic_load_n(&channel->tail, __ATOMIC_ACQUIRE);
+		me->regs[DR_A] = Clip(channel->receiverTail - channel->head);
+	}
+
+	ChargeIntrinsic(me, 0);
+}
+
+static void SysChannelNotify(Dcpu* me, void* data)
+{
+	DcpuChannel* channel = GetChannel(me, false);
+	if(!channel) return;
+
+	__atomic_store_n(&channel->message, me->regs[DR_B], __ATOMIC_RELAXED);
+	if(me->regs[DR_B]) Arm(channel);
+	else __atomic_store_n(&channel->armed, false, __ATOMIC_SEQ_CST);
+
+	ChargeIntrinsic(me, 0);
+}
+
+bool InitChannels(Dcpu* me)
+{
+	return Dcpu_SetSysCall(me, SysChannelSend, DCPU_SYS_SEND, NULL)
+		&& Dcpu_SetSysCall(me, SysChannelReceive, DCPU_SYS_RECEIVE, NULL)
+		&& Dcpu_SetSysCall(me, SysChannelPoll, DCPU_SYS_POLL, NULL)
+		&& Dcpu_SetSysCall(me, SysChannelNotify, DCPU_SYS_NOTIFY, NULL);
+}
+
+void ResetChannels(Dcpu* me)
+{
+	// A new program doesn't get the old one's notifications
+	for(int id = 0; id < DCPU_CHANNELS; id++){
+		DcpuChannel* channel = me->channels[id];
+		if(!channel || me->channelSends[id]) continue;
+
+		__atomic_store_n(&channel->message, 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&channel->armed, false, __ATOMIC_SEQ_CST);
+	}
+}
@@ -1,55 +1,80 @@
 #include "common.h"
-#include "dcpu.h"
+#include "dcpui.h"
 
-typedef void (*InsPtr)(Dcpu* me, uint16_t* v1, uint16_t* v2);
-typedef void (*SysCallPtr)(Dcpu* me, void* data);
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
-typedef struct {
-	SysCallPtr fun;
-	int id;
-	void* data;
-} SysCall;
+typedef void (*InsPtr)(Dcpu* me, uint16_t* v1, uint16_t* v2);
 
 //static const char* dinsNames[] = DINSNAMES;
 
-typedef Vector(SysCall) SysCallVector;
-
-struct Dcpu {
-	uint16_t* ram;
-	uint16_t regs[8];
-	uint16_t sp, pc, o;
-
-	bool performNextIns;
-	bool exit;
+void Dcpu_SetExit(Dcpu* me, bool e)
+{
+	me->exit = e;
+}
 
-	int cycles;
+bool Dcpu_GetExit(Dcpu* me)
+{
+	return me->exit;
+}
 
-	SysCallVector sysCalls;
-	void (*inspector)(Dcpu* dcpu, void* data);
-	void* inspectorData;
+// A syscall that can't complete right away (eg. it waits for input) calls
+// Dcpu_Suspend and returns. Dcpu_Execute then returns DCPU_WAITING after the
+// SYS instruction, and keeps doing so without running anything, until the
+// host has the result, writes it to the registers or the RAM (marking it
+// with Dcpu_MarkDirty) and calls Dcpu_Resume. This way one thread can serve
+// the I/O of many Dcpus from an event loop.
+void Dcpu_Suspend(Dcpu* me)
+{
+	me->waiting = true;
+}
 
-	InsPtr ins[DINS_NUM];
-};
+void Dcpu_Resume(Dcpu* me)
+{
+	me->waiting = false;
+}
 
-// Cast to uint16_t
-#define U16C(__w) ((uint16_t)(__w))
+bool Dcpu_IsWaiting(Dcpu* me)
+{
+	return me->waiting;
+}
 
-void Dcpu_SetExit(Dcpu* me, bool e)
+int Dcpu_GetCycles(Dcpu* me)
 {
-	me->exit = e;
+	return me->cycles;
 }
 
-bool Dcpu_GetExit(Dcpu* me)
+// Including those of a Dcpu_Execute in progress (eg. when asked from a syscall)
+uint64_t Dcpu_GetCycleCount(Dcpu* me)
 {
-	return me->exit;
+	return me->cycleBase + me->cycles;
 }
 
+// The stack is memory like any other, it can be in a device's range
 uint16_t Dcpu_Pop(Dcpu* me) { 
-	return me->ram[me->sp++];
+	uint16_t addr = me->sp++;
+	ReadWord(me, addr);
+	return LoadWord(me, me->ram + addr);
 }
 
 void Dcpu_Push(Dcpu* me, uint16_t v){
-	me->ram[--me->sp] = v;
+	--me->sp;
+	StoreWord(me, me->ram + me->sp, v);
+	WroteWord(me, me->sp);
+}
+
+// The cpu's own writes are tracked, those through Dcpu_GetRam have to be
+// marked for Dcpu_Reset to clear them
+void Dcpu_MarkDirty(Dcpu* me, uint16_t addr, int count)
+{
+	me->loopClean = false;
+	if(me->devices.count) MarkDevicesDirty(me, addr, count);
+
+	for(int page = addr >> DIRTY_PAGE_SHIFT; page <= (addr + count - 1) >> DIRTY_PAGE_SHIFT && page < 32; page++){
+		me->dirty |= 1u << page;
+	}
 }
 
 void Dcpu_SetInspector(Dcpu* me, void (*ins)(Dcpu* dcpu, void* data), void* data)
@@ -58,6 +83,103 @@ void Dcpu_SetInspector(Dcpu* me, void (*ins)(Dcpu* dcpu, void* data), void* data
 	me->inspectorData = data;
 }
 
+// The memory intrinsics are syscalls so that guests don't have to loop over
+// the words. The arguments are in A, B and C, the result in A, and lengths
+// are cut short at the end of the RAM. A host can raise what they cost to
+// what the guest's own loop would have, so that using them isn't an
+// advantage.
+void Dcpu_SetIntrinsicCost(Dcpu* me, int callCycles, int wordCycles)
+{
+	me->intrinsicCallCycles = callCycles;
+	me->intrinsicWordCycles = wordCycles;
+}
+
+void ChargeIntrinsic(Dcpu* me, int words)
+{
+	me->cycles += me->intrinsicCallCycles + words * me->intrinsicWordCycles;
+}
+
+// With hooked devices the intrinsics go word by word, like the guest's own
+// loop would, so that the hooks see the words they read and write
+
+static void SysMemCopy(Dcpu* me, void* data)
+{
+	uint16_t dst = me->regs[DR_A], src = me->regs[DR_B];
+	int count = ClipLength(dst > src ? dst : src, me->regs[DR_C]);
+
+	if(me->hookedDevices){
+		// Backwards when the source is below, so that overlapping words are read first
+		for(int i = 0; i < count; i++){
+			int at = dst > src ? count - 1 - i : i;
+			ReadWord(me, src + at);
+			me->ram[dst + at] = me->ram[src + at];
+			WroteWord(me, dst + at);
+		}
+	}
+	else{
+		memmove(me->ram + dst, me->ram + src, count * sizeof(uint16_t));
+		if(count) Dcpu_MarkDirty(me, dst, count);
+	}
+
+	ChargeIntrinsic(me, count);
+}
+
+static void SysMemSet(Dcpu* me, void* data)
+{
+	uint16_t dst = me->regs[DR_A], value = me->regs[DR_B];
+	int count = ClipLength(dst, me->regs[DR_C]);
+
+	if(me->hookedDevices){
+		for(int i = 0; i < count; i++){
+			me->ram[dst + i] = value;
+			WroteWord(me, dst + i);
+		}
+	}
+	else{
+		for(uint16_t* it = me->ram + dst; it < me->ram + dst + count; it++) *it = value;
+		if(count) Dcpu_MarkDirty(me, dst, count);
+	}
+
+	ChargeIntrinsic(me, count);
+}
+
+static void SysMemCompare(Dcpu* me, void* data)
+{
+	uint16_t a = me->regs[DR_A], b = me->regs[DR_B];
+	int count = ClipLength(a > b ? a : b, me->regs[DR_C]);
+
+	int i = 0;
+	if(me->hookedDevices){
+		for(; i < count; i++){
+			ReadWord(me, a + i);
+			ReadWord(me, b + i);
+			if(me->ram[a + i] != me->ram[b + i]) break;
+		}
+	}
+	else while(i < count && me->ram[a + i] == me->ram[b + i]) i++;
+
+	me->regs[DR_A] = i == count ? 0 : me->ram[a + i] > me->ram[b + i] ? 1 : 0xffff;
+	ChargeIntrinsic(me, i < count ? i + 1 : i);
+}
+
+static void SysStrLen(Dcpu* me, void* data)
+{
+	uint16_t addr = me->regs[DR_A];
+	int length = 0;
+
+	if(me->hookedDevices){
+		while(addr + length < 0x10000){
+			ReadWord(me, addr + length);
+			if(!me->ram[addr + length]) break;
+			length++;
+		}
+	}
+	else length = FindZeroWord(me->ram + addr, 0x10000 - addr);
+
+	me->regs[DR_A] = length;
+	ChargeIntrinsic(me, length + 1);
+}
+
 // Extended instructions
 void NonBasic(Dcpu* me, uint16_t* v1, uint16_t* v2)
 {
@@ -67,6 +189,36 @@ void NonBasic(Dcpu* me, uint16_t* v1, uint16_t* v2)
 		me->cycles += 2;
 	}
 
+	else if(*v1 == DI_ExtInt - DINS_EXT_BASE){
+		me->cycles += 4;
+		if(!Dcpu_Interrupt(me, *v2)) LogW("Interrupt queue full, dropped: 0x%04x", *v2);
+	}
+
+	else if(*v1 == DI_ExtIag - DINS_EXT_BASE){
+		*v2 = me->ia;
+		me->cycles += 1;
+
+		// The only extended instruction that writes its operand, Execute doesn't track it
+		if(v2 >= me->ram && v2 < me->ram + 0x10000) WroteWord(me, v2 - me->ram);
+	}
+
+	else if(*v1 == DI_ExtIas - DINS_EXT_BASE){
+		me->ia = *v2;
+		me->cycles += 1;
+	}
+
+	else if(*v1 == DI_ExtRfi - DINS_EXT_BASE){
+		me->queueing = false;
+		me->regs[DR_A] = Dcpu_Pop(me);
+		me->pc = Dcpu_Pop(me);
+		me->cycles += 3;
+	}
+
+	else if(*v1 == DI_ExtIaq - DINS_EXT_BASE){
+		me->queueing = *v2 != 0;
+		me->cycles += 2;
+	}
+
 	else if(*v1 == DI_ExtSys - DINS_EXT_BASE){
 		me->cycles += 1;
 
@@ -75,6 +227,8 @@ void NonBasic(Dcpu* me, uint16_t* v1, uint16_t* v2)
 			return;
 		}
 
+		me->loopClean = false;
+
 		SysCall* s;
 		bool found = false;
 		Vector_ForEach(me->sysCalls, s){
@@ -89,6 +243,9 @@ void NonBasic(Dcpu* me, uint16_t* v1, uint16_t* v2)
 
 	else
 		me->cycles += 1;
+
+	// The interrupt instructions take one they let in before the next instruction
+	if(*v1 >= DI_ExtInt - DINS_EXT_BASE && *v1 <= DI_ExtIaq - DINS_EXT_BASE && InterruptReady(me)) TakeInterrupt(me);
 }
 
 // Basic instructions
@@ -158,48 +315,254 @@ void Ifn(Dcpu* me, uint16_t* v1, uint16_t* v2){ me->performNextIns = *v1 != *v2;
 void Ifg(Dcpu* me, uint16_t* v1, uint16_t* v2){ me->performNextIns = *v1 > *v2; me->cycles += 2 + (uint16_t)me->performNextIns; }
 void Ifb(Dcpu* me, uint16_t* v1, uint16_t* v2){ me->performNextIns = (*v1 & *v2) != 0; me->cycles += 2 + (uint16_t)me->performNextIns; }
 
-Dcpu* Dcpu_Create()
+static const InsPtr instructions[DINS_NUM] = {
+	[DI_NonBasic] = NonBasic,
+	[DI_Set] = Set,
+	[DI_Add] = Add,
+	[DI_Sub] = Sub,
+	[DI_Mul] = Mul,
+	[DI_Div] = Div,
+	[DI_Mod] = Mod,
+	[DI_Shl] = Shl,
+	[DI_Shr] = Shr,
+	[DI_And] = And,
+	[DI_Bor] = Bor,
+	[DI_Xor] = Xor,
+	[DI_Ife] = Ife,
+	[DI_Ifn] = Ifn,
+	[DI_Ifg] = Ifg,
+	[DI_Ifb] = Ifb,
+};
+
+static Dcpu* CreateWithRam(uint16_t* ram)
 {
 	Dcpu* me = calloc(1, sizeof(Dcpu));
-	me->ram = calloc(1, sizeof(uint16_t) * 0x10000);
+	if(!me) return NULL;
 
+	me->ram = ram;
 	me->performNextIns = true;
 
 	Vector_Init(me->sysCalls, SysCall);
+	Vector_Init(me->devices, DcpuDevicePtr);
+	Vector_Init(me->events, DcpuEventPtr);
+	Vector_Init(me->eventHeap, DcpuEventPtr);
+	InitInterrupts(me);
+
+	Dcpu_SetIntrinsicCost(me, DCPU_INTRINSIC_CALL_CYCLES, DCPU_INTRINSIC_WORD_CYCLES);
+	bool ok = Dcpu_SetSysCall(me, SysMemCopy, DCPU_SYS_MEMCPY, NULL)
+		&& Dcpu_SetSysCall(me, SysMemSet, DCPU_SYS_MEMSET, NULL)
+		&& Dcpu_SetSysCall(me, SysMemCompare, DCPU_SYS_MEMCMP, NULL)
+		&& Dcpu_SetSysCall(me, SysStrLen, DCPU_SYS_STRLEN, NULL)
+		&& InitChannels(me)
+		&& InitSmp(me);
+
+	if(!ok){
+		Vector_Free(me->sysCalls);
+		free(me);
+		return NULL;
+	}
 
-	me->ins[DI_NonBasic] = NonBasic;
-	me->ins[DI_Set] = Set;
-	me->ins[DI_Add] = Add;
-	me->ins[DI_Sub] = Sub;
-	me->ins[DI_Mul] = Mul;
-	me->ins[DI_Div] = Div;
-	me->ins[DI_Mod] = Mod;
-	me->ins[DI_Shl] = Shl;
-	me->ins[DI_Shr] = Shr;
-	me->ins[DI_And] = And;
-	me->ins[DI_Bor] = Bor;
-	me->ins[DI_Xor] = Xor;
-	me->ins[DI_Ife] = Ife;
-	me->ins[DI_Ifn] = Ifn;
-	me->ins[DI_Ifg] = Ifg;
-	me->ins[DI_Ifb] = Ifb;
+	return me;
+}
+
+Dcpu* Dcpu_Create()
+{
+	uint16_t* ram = calloc(1, RAM_SIZE);
+	if(!ram) return NULL;
+
+	Dcpu* me = CreateWithRam(ram);
+	if(!me) free(ram);
 
 	return me;
 }
 
+// The RAM is a shared mapping of the file, so it outlives the process and
+// other processes can map it to watch it. Changes reach the file when the
+// kernel writes them back, or at the latest on Dcpu_Sync.
+Dcpu* Dcpu_CreateWithBackingFile(const char* path)
+{
+	int fd = open(path, O_RDWR | O_CREAT, 0644);
+	if(fd < 0) return NULL;
+
+	// A new (or short) file is extended with zeros
+	struct stat st;
+	if(fstat(fd, &st) != 0 || (st.st_size < RAM_SIZE && ftruncate(fd, RAM_SIZE) != 0)){
+		close(fd);
+		return NULL;
+	}
+
+	void* ram = mmap(NULL, RAM_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if(ram == MAP_FAILED) return NULL;
+
+	Dcpu* me = CreateWithRam(ram);
+	if(!me){
+		munmap(ram, RAM_SIZE);
+		return NULL;
+	}
+
+	me->ramMapped = true;
+	return me;
+}
+
+Dcpu* Dcpu_CreateFromImage(DcpuImage* image)
+{
+	uint16_t* ram = DcpuImage_Map(image);
+	if(!ram) return NULL;
+
+	Dcpu* me = CreateWithRam(ram);
+	if(!me){
+		DcpuImage_Unmap(image, ram);
+		return NULL;
+	}
+
+	me->image = image;
+	me->pc = DcpuImage_GetEntry(image);
+
+	return me;
+}
+
+// Cores share the RAM of the first one, which owns it and keeps the others
+// on a list, so that its reset restores the pages any of them wrote. A
+// core's reset only restores its own state.
+//
+// A core has registers, syscalls, devices, events and interrupts of its
+// own, and starts at the first one's entry point with SP 0: a program gives
+// each core a stack before it pushes anything. Cores are created before any
+// of them runs, and destroyed before the first. A core waiting in a loop
+// that only reads memory is DCPU_IDLE, but other cores write its memory
+// without Dcpu_MarkDirty, so the host runs it again (after yielding its
+// thread).
+Dcpu* Dcpu_CreateCore(Dcpu* first)
+{
+	Dcpu* owner = first->ramOwner ? first->ramOwner : first;
+
+	Dcpu* me = CreateWithRam(owner->ram);
+	if(!me) return NULL;
+
+	me->ramOwner = owner;
+	me->coreId = owner->numCores++;
+	me->pc = owner->image ? DcpuImage_GetEntry(owner->image) : 0;
+
+	// After the owner, in the order they were created
+	Dcpu** last = &owner->nextCore;
+	while(*last) last = &(*last)->nextCore;
+	*last = me;
+
+	return me;
+}
+
+static void UnlinkCore(Dcpu* me)
+{
+	Dcpu* owner = me->ramOwner;
+
+	for(Dcpu** it = &owner->nextCore; *it; it = &(*it)->nextCore){
+		if(*it == me){
+			*it = me->nextCore;
+			break;
+		}
+	}
+
+	owner->numCores--;
+	owner->dirty |= me->dirty;
+}
+
+// The registers are cleared and only the pages written since the last
+// reset are zeroed, or restored to the image's
+void Dcpu_Reset(Dcpu* me)
+{
+	Dcpu* owner = me->ramOwner ? me->ramOwner : me;
+
+	// Other cores leave the RAM, and the pages they wrote, to the owner
+	if(me == owner){
+		for(Dcpu* core = me->nextCore; core; core = core->nextCore){
+			me->dirty |= core->dirty;
+			core->dirty = 0;
+		}
+	}
+
+	if(me->dirty && me == owner){
+		long pageSize = sysconf(_SC_PAGESIZE);
+
+		for(int page = 0; page < 32; page++){
+			if(!(me->dirty >> page & 1)) continue;
+
+			// Runs of dirty pages at a time
+			int end = page;
+			while(end < 32 && me->dirty >> end & 1) end++;
+
+			uint8_t* from = (uint8_t*)(me->ram + page * DIRTY_PAGE_WORDS);
+			uint8_t* to = (uint8_t*)(me->ram + end * DIRTY_PAGE_WORDS);
+
+			// An image's copied pages are dropped, so they're the image's again.
+			// madvise works on whole system pages, dropping clean ones too is harmless.
+			if(me->image){
+				from = (uint8_t*)((uintptr_t)from / pageSize * pageSize);
+				to = (uint8_t*)(((uintptr_t)to + pageSize - 1) / pageSize * pageSize);
+				madvise(from, to - from, MADV_DONTNEED);
+			}
+			else memset(from, 0, to - from);
+
+			// What devices there show has changed
+			MarkDevicesDirty(me, page * DIRTY_PAGE_WORDS, (end - page) * DIRTY_PAGE_WORDS);
+
+			page = end;
+		}
+
+		me->dirty = 0;
+	}
+
+	memset(me->regs, 0, sizeof(me->regs));
+	me->sp = me->o = 0;
+	me->loopValid = false;
+	me->idiomMiss = false;
+	me->pc = owner->image ? DcpuImage_GetEntry(owner->image) : 0;
+	me->performNextIns = true;
+	me->exit = false;
+	me->waiting = false;
+	me->cycles = 0;
+	me->cycleBase = 0;
+	CancelEvents(me);
+	DropInterrupts(me);
+	ResetChannels(me);
+}
+
+// Always true without a backing file
+bool Dcpu_Sync(Dcpu* me)
+{
+	return !me->ramMapped || msync(me->ram, RAM_SIZE, MS_SYNC) == 0;
+}
+
 void Dcpu_Destroy(Dcpu** me)
 {
 	Vector_Free((*me)->sysCalls);
+	FreeDevices(*me);
+	FreeEvents(*me);
+
+	if((*me)->ramOwner) UnlinkCore(*me);
+	else if((*me)->image) DcpuImage_Unmap((*me)->image, (*me)->ram);
+	else if((*me)->ramMapped) munmap((*me)->ram, RAM_SIZE);
+	else free((*me)->ram);
 
-	free((*me)->ram);
 	free(*me);
 	*me = NULL;
 }
 
-void Dcpu_SetSysCall(Dcpu* me, void (*sc)(Dcpu* me, void* data), int id, void* data)
+bool Dcpu_SetSysCall(Dcpu* me, void (*sc)(Dcpu* me, void* data), int id, void* data)
 {
 	SysCall s = {sc, id, data};
-	Vector_Add(me->sysCalls, s);
+
+	// A syscall set again (eg. over an intrinsic) is replaced
+	SysCall* it;
+	Vector_ForEach(me->sysCalls, it){
+		if(it->id == id){
+			*it = s;
+			return true;
+		}
+	}
+
+	return Vector_Add(me->sysCalls, s);
 }
 
 uint16_t* Dcpu_GetRam(Dcpu* me)
@@ -242,14 +605,96 @@ void Dcpu_DumpState(Dcpu* me)
 	LogD(" ");
 }
 
-int Dcpu_Execute(Dcpu* me, int execCycles)
+static void GetLoopState(Dcpu* me, uint16_t* state)
+{
+	memcpy(state, me->regs, sizeof(me->regs));
+	state[8] = me->sp;
+	state[9] = me->o;
+	state[10] = me->pc;
+}
+
+// Called after a branch backwards (or to itself), returns true if the loop
+// that just went around can't do anything but go around again
+static bool IsIdleLoop(Dcpu* me)
+{
+	uint16_t state[11];
+	GetLoopState(me, state);
+
+	bool idle = me->loopValid && me->loopClean && me->loopHead == me->pc 
+		&& !memcmp(state, me->loopRegs, sizeof(state));
+
+	me->loopValid = true;
+	me->loopClean = true;
+	me->loopHead = me->pc;
+	memcpy(me->loopRegs, state, sizeof(state));
+
+	return idle;
+}
+
+// An instruction on RAM other cores run on too works on copies of its
+// words, loaded atomically (see SharedRam), and the one it writes is stored
+// back after. IAG is the only extended instruction that writes its operand.
+static void ExecuteShared(Dcpu* me, DIns ins, uint16_t** pv)
+{
+	uint16_t copies[2];
+	uint16_t* words[2] = { NULL, NULL };
+
+	for(int i = 0; i < 2; i++){
+		if(pv[i] >= me->ram && pv[i] < me->ram + 0x10000){
+			words[i] = pv[i];
+			copies[i] = __atomic_load_n(words[i], __ATOMIC_RELAXED);
+			pv[i] = copies + i;
+		}
+	}
+
+	uint16_t op = *pv[0];
+	instructions[ins](me, pv[0], pv[1]);
+
+	int written = ins == DI_NonBasic ? (op == DI_ExtIag - DINS_EXT_BASE ? 1 : -1) : ins < DI_Ife ? 0 : -1;
+
+	if(written >= 0 && words[written]){
+		__atomic_store_n(words[written], copies[written], __ATOMIC_RELAXED);
+		WroteWord(me, words[written] - me->ram);
+	}
+}
+
+// A program found idle returns DCPU_IDLE right away as if the cycles had
+// passed. The host doesn't need to run it again until it changes its memory
+// (Dcpu_MarkDirty) or it gets input through a syscall. Idle detection is off
+// while an inspector is set.
+DcpuStatus Dcpu_Execute(Dcpu* me, int execCycles)
 {
-	#define READ me->ram[me->pc++]
+	#define READ LoadWord(me, me->ram + me->pc++)
+	me->cycleBase += me->cycles;
 	me->cycles = 0;
+	me->execCycles = execCycles;
+	SetEventStop(me);
+
+	// The host may have changed the memory since the last call
+	me->loopValid = false;
+
+	if(me->waiting) return DCPU_WAITING;
+
+	// Interrupts are looked for where blocks end: here, after events, on
+	// branches backwards, and after the instructions that let them in (see
+	// NonBasic). Straight code in between doesn't pay for them.
+	if(InterruptReady(me)) TakeInterrupt(me);
+
+	// eventStop is never past execCycles, it's all the loop has to look at
+	for(;;){
+		if(me->cycles >= me->eventStop){
+			if(me->cycles >= execCycles) break;
+
+			FireEvents(me);
+			if(me->exit) return DCPU_EXITED;
+			if(me->waiting) return DCPU_WAITING;
+			if(InterruptReady(me)) TakeInterrupt(me);
+		}
 
-	while(me->cycles < execCycles){
 		if(me->inspector) me->inspector(me, me->inspectorData);
 
+		uint16_t insAddr = me->pc;
+
 		bool hasNextWord[2];
 		uint16_t val[2];
 		uint16_t pIns = READ;
@@ -311,16 +756,48 @@ int Dcpu_Execute(Dcpu* me, int execCycles)
 		}
 		
 		if(me->performNextIns){ 
-			//LogD("%s", dinsNames[ins]);
-			me->ins[ins](me, pv[0], pv[1]);
+			// Devices give the words they have hooks for, SET doesn't read what it writes
+			for(int i = ins == DI_Set || ins == DI_NonBasic; i < 2 && me->devices.count; i++){
+				if(pv[i] >= me->ram && pv[i] < me->ram + 0x10000) ReadWord(me, pv[i] - me->ram);
+			}
+
+			if(SharedRam(me)) ExecuteShared(me, ins, pv);
+			else{
+				//LogD("%s", dinsNames[ins]);
+				instructions[ins](me, pv[0], pv[1]);
+
+				// The first operand is the one written, except by IF* and extended instructions
+				if(ins != DI_NonBasic && ins < DI_Ife && pv[0] >= me->ram && pv[0] < me->ram + 0x10000){
+					WroteWord(me, pv[0] - me->ram);
+				}
+			}
 		}
 
 		else me->performNextIns = true;
 
 		//Dcpu_DumpState(me);
 
-		if(me->exit) return 0;
+		if(me->exit) return DCPU_EXITED;
+		if(me->waiting) return DCPU_WAITING;
+
+		// Idle loops skip the rest of the cycles, or up to the next event.
+		// With an inspector every instruction is run, eg. for the debugger
+		// to step through them.
+		if(me->pc <= insAddr && InterruptReady(me)){
+			TakeInterrupt(me);
+			continue;
+		}
+
+		if(me->pc <= insAddr && !me->inspector){
+			if(IsIdleLoop(me)){
+				me->cycles = me->eventStop;
+				if(!me->eventHeap.count) return DCPU_IDLE;
+				continue;
+			}
+
+			FastForwardLoop(me, insAddr, me->eventStop);
+		}
 	}
 
-	return 1;
+	return DCPU_RUNNING;
 }
@@ -0,0 +1,197 @@
+#ifndef DCPUI_H
+#define DCPUI_H
+
+#include "common.h"
+#include "dcpu.h"
+
+// Cast to uint16_t
+#define U16C(__w) ((uint16_t)(__w))
+
+#define RAM_SIZE (sizeof(uint16_t) * 0x10000)
+
+// Writes to RAM are tracked in 32 pages of 2048 words, for Dcpu_Reset
+#define DIRTY_PAGE_SHIFT 11
+#define DIRTY_PAGE_WORDS (1 << DIRTY_PAGE_SHIFT)
+
+// Pages of the device lookup table
+#define DEVICE_PAGE_SHIFT 8
+#define DEVICE_PAGES (0x10000 >> DEVICE_PAGE_SHIFT)
+
+typedef DcpuDevice* DcpuDevicePtr;
+typedef Vector(DcpuDevicePtr) DeviceVector;
+
+typedef DcpuEvent* DcpuEventPtr;
+typedef Vector(DcpuEventPtr) EventVector;
+
+// Interrupts waiting to be taken, see interrupts.c
+#define INTERRUPT_QUEUE_SIZE 256
+
+typedef struct {
+	uint32_t seq;
+	uint16_t message;
+} InterruptSlot;
+
+typedef struct {
+	// Only used by the cpu's thread: the slot's sequence when it holds the
+	// message at head
+	uint32_t head;
+	uint32_t* headSeq;
+	uint32_t headReady;
+
+	InterruptSlot slots[INTERRUPT_QUEUE_SIZE];
+	uint32_t tail;   // moved by the threads raising interrupts
+} InterruptQueue;
+
+typedef void (*SysCallPtr)(Dcpu* me, void* data);
+
+typedef struct {
+	SysCallPtr fun;
+	int id;
+	void* data;
+} SysCall;
+
+typedef Vector(SysCall) SysCallVector;
+
+struct Dcpu {
+	uint16_t* ram;
+	bool ramMapped;   // a mapping of the backing file instead of calloc'd
+	DcpuImage* image; // or a view of this image
+	uint32_t dirty;   // pages written since the last reset
+
+	// Cores sharing the RAM (see Dcpu_CreateCore): the one that owns it, NULL
+	// on the owner, and on the owner the list of the others and how many
+	// there are with it
+	Dcpu* ramOwner;
+	Dcpu* nextCore;
+	int coreId;
+	int numCores;
+
+	uint16_t regs[8];
+	uint16_t sp, pc, o;
+
+	bool performNextIns;
+	bool exit;
+	bool waiting;
+
+	int cycles;         // run by this Dcpu_Execute
+	uint64_t cycleBase; // run before it
+	int execCycles;     // asked for
+	int eventStop;      // the cycles until the first event is due, at most execCycles
+	bool firing;        // in FireEvents, which fires what's due up to firingAt
+	uint64_t firingAt;
+
+	// What the memory intrinsics charge
+	int intrinsicCallCycles;
+	int intrinsicWordCycles;
+
+	// Idle detection: a branch back to loopHead with the registers as they
+	// were the last time (loopRegs) and no writes or syscalls in between
+	// (loopClean) repeats the same way forever
+	bool loopValid;
+	bool loopClean;
+	uint16_t loopHead;
+	uint16_t loopRegs[11];
+
+	// The last loop that didn't match an idiom, so it isn't decoded again
+	// on every iteration (see loops.c)
+	bool idiomMiss;
+	uint16_t idiomMissHead;
+	uint16_t idiomMissBranch;
+
+	DeviceVector devices;
+	uint16_t devicePages[DEVICE_PAGES];   // how many devices are on each page
+	int hookedDevices;                    // devices with a read or write hook
+
+	// Interrupts: the handler's address (IA, 0 for none), and whether they
+	// wait in the queue rather than being taken (IAQ, and while handling one)
+	uint16_t ia;
+	bool queueing;
+	InterruptQueue interrupts;
+
+	// The ends of channels the program can use, by number
+	DcpuChannel* channels[DCPU_CHANNELS];
+	bool channelSends[DCPU_CHANNELS];
+
+	EventVector events;     // all of them
+	EventVector eventHeap;  // the armed ones, by cycle
+
+	SysCallVector sysCalls;
+	void (*inspector)(Dcpu* dcpu, void* data);
+	void* inspectorData;
+};
+
+// Whether other cores run on this RAM (see Dcpu_CreateCore). Their words
+// are then loaded and stored with relaxed atomics, which cost nothing more
+// than plain moves but keep the compiler from tearing, merging or caching
+// them. Macros, like InterruptPending, to be inlined into Execute.
+#define SharedRam(me) ((me)->ramOwner || (me)->numCores > 1)
+#define LoadWord(me, p) (SharedRam(me) ? __atomic_load_n((p), __ATOMIC_RELAXED) : *(p))
+#define StoreWord(me, p, v) do{ \
+	if(SharedRam(me)) __atomic_store_n((p), (v), __ATOMIC_RELAXED); \
+	else *(p) = (v); \
+}while(0)
+
+// Device hooks, for a word on a page that has a device (see device.c)
+void DeviceRead(Dcpu* me, uint16_t addr);
+void DeviceWrite(Dcpu* me, uint16_t addr);
+void MarkDevicesDirty(Dcpu* me, int addr, int count);
+void FreeDevices(Dcpu* me);
+
+// What every read of a word by the program goes through: a device's hook
+// can give the word first
+static inline void ReadWord(Dcpu* me, uint16_t addr)
+{
+	if(me->devices.count && me->devicePages[addr >> DEVICE_PAGE_SHIFT]) DeviceRead(me, addr);
+}
+
+// And every write, after the word is stored: it's dirty and devices see it
+static inline void WroteWord(Dcpu* me, uint16_t addr)
+{
+	me->dirty |= 1u << (addr >> DIRTY_PAGE_SHIFT);
+	me->loopClean = false;
+
+	if(me->devices.count && me->devicePages[addr >> DEVICE_PAGE_SHIFT]) DeviceWrite(me, addr);
+}
+
+// Events (see events.c)
+void SetEventStop(Dcpu* me);
+void FireEvents(Dcpu* me);
+void CancelEvents(Dcpu* me);
+void FreeEvents(Dcpu* me);
+
+// The number of words from addr up to count, or to the end of the RAM
+static inline int ClipLength(int addr, int count)
+{
+	return count < 0x10000 - addr ? count : 0x10000 - addr;
+}
+
+// Charges what an intrinsic handling words costs
+void ChargeIntrinsic(Dcpu* me, int words);
+
+// Channels (see channel.c)
+bool InitChannels(Dcpu* me);
+void ResetChannels(Dcpu* me);
+
+// The syscalls for cores (see smp.c)
+bool InitSmp(Dcpu* me);
+
+// Interrupts (see interrupts.c)
+void InitInterrupts(Dcpu* me);
+void TakeInterrupt(Dcpu* me);
+void DropInterrupts(Dcpu* me);
+
+// Whether an interrupt is waiting, with one relaxed load. A macro so that
+// it's inlined into Execute without optimizations too.
+#define InterruptPending(me) \
+	(__atomic_load_n((me)->interrupts.headSeq, __ATOMIC_RELAXED) == (me)->interrupts.headReady)
+
+// Whether the program would take a waiting interrupt now, not before an
+// instruction that's skipped
+#define InterruptReady(me) ((me)->performNextIns && InterruptPending(me) && !(me)->queueing)
+
+// Runs the rest of a copy, fill or compare loop natively, if the branch at
+// branchAddr that just went back to the loop's start is the end of one.
+// Stops short of execCycles, leaving the cpu as if it had run the iterations.
+void FastForwardLoop(Dcpu* me, uint16_t branchAddr, int execCycles);
+
+#endif
@@ -0,0 +1,175 @@
+#include "common.h"
+#include "dcpui.h"
+
+// Devices are kept in a list, and devicePages counts the devices on each
+// page of DEVICE_PAGE_WORDS. Execute only looks a device up for words on a
+// page that has any, so the rest of the RAM costs a table lookup.
+//
+// Words the program writes on a device are marked in its dirty bitmap, so
+// that eg. a display only redraws what changed. read is called before an
+// instruction reads one of the words, what it returns is put in the RAM for
+// the instruction, and write after an instruction has written one. Hooks
+// are called for the cpu's own instructions, Dcpu_Push and Dcpu_Pop, and
+// the memory intrinsics. Other syscalls and the host use the RAM directly,
+// writes they mark with Dcpu_MarkDirty are marked in the bitmap too. A Dcpu
+// with hooked devices doesn't run loops natively.
+
+struct DcpuDevice {
+	uint16_t start;
+	int count;
+
+	uint16_t (*read)(Dcpu* dcpu, uint16_t addr, void* data);
+	void (*write)(Dcpu* dcpu, uint16_t addr, uint16_t value, void* data);
+	void* data;
+
+	uint32_t* dirty;   // bit (offset % 32) of dirty[offset / 32]
+};
+
+static void CountPages(Dcpu* me, DcpuDevice* device, int add)
+{
+	int first = device->start >> DEVICE_PAGE_SHIFT;
+	int last = (device->start + device->count - 1) >> DEVICE_PAGE_SHIFT;
+
+	for(int page = first; page <= last; page++) me->devicePages[page] += add;
+}
+
+DcpuDevice* Dcpu_MapDevice(Dcpu* me, uint16_t start, int count, 
+	uint16_t (*read)(Dcpu* dcpu, uint16_t addr, void* data), 
+	void (*write)(Dcpu* dcpu, uint16_t addr, uint16_t value, void* data), void* data)
+{
+	if(count <= 0 || start + count > 0x10000) return NULL;
+
+	DcpuDevice* device = calloc(1, sizeof(DcpuDevice));
+	if(!device) return NULL;
+
+	device->dirty = calloc((count + 31) / 32, sizeof(uint32_t));
+	if(!device->dirty){
+		free(device);
+		return NULL;
+	}
+
+	device->start = start;
+	device->count = count;
+	device->read = read;
+	device->write = write;
+	device->data = data;
+
+	if(!Vector_Add(me->devices, device)){
+		free(device->dirty);
+		free(device);
+		return NULL;
+	}
+	CountPages(me, device, 1);
+	if(read || write) me->hookedDevices++;
+
+	return device;
+}
+
+static void FreeDevice(DcpuDevice* device)
+{
+	free(device->dirty);
+	free(device);
+}
+
+void Dcpu_UnmapDevice(Dcpu* me, DcpuDevice** device)
+{
+	for(int i = 0; i < me->devices.count; i++){
+		if(me->devices.elems[i] != *device) continue;
+
+		CountPages(me, *device, -1);
+		if((*device)->read || (*device)->write) me->hookedDevices--;
+
+		Vector_Remove(me->devices, i);
+		break;
+	}
+
+	FreeDevice(*device);
+	*device = NULL;
+}
+
+void FreeDevices(Dcpu* me)
+{
+	DcpuDevice** it;
+	Vector_ForEach(me->devices, it) FreeDevice(*it);
+	Vector_Free(me->devices);
+}
+
+static bool Covers(DcpuDevice* device, int addr)
+{
+	return addr >= device->start && addr < device->start + device->count;
+}
+
+static void SetDirty(DcpuDevice* device, int from, int to)
+{
+	for(int offset = from - device->start; offset < to - device->start; offset++)
+		device->dirty[offset / 32] |= 1u << (offset % 32);
+}
+
+void DeviceRead(Dcpu* me, uint16_t addr)
+{
+	DcpuDevice** it;
+	Vector_ForEach(me->devices, it){
+		DcpuDevice* device = *it;
+		if(!device->read || !Covers(device, addr)) continue;
+
+		me->ram[addr] = device->read(me, addr, device->data);
+
+		// The device can answer differently every time, a loop reading it isn't idle
+		me->loopClean = false;
+		return;
+	}
+}
+
+void DeviceWrite(Dcpu* me, uint16_t addr)
+{
+	DcpuDevice** it;
+	Vector_ForEach(me->devices, it){
+		DcpuDevice* device = *it;
+		if(!Covers(device, addr)) continue;
+
+		SetDirty(device, addr, addr + 1);
+		if(device->write) device->write(me, addr, me->ram[addr], device->data);
+	}
+}
+
+void MarkDevicesDirty(Dcpu* me, int addr, int count)
+{
+	DcpuDevice** it;
+	Vector_ForEach(me->devices, it){
+		DcpuDevice* device = *it;
+
+		int from = addr > device->start ? addr : device->start;
+		int to = addr + count < device->start + device->count ? addr + count : device->start + device->count;
+		if(from < to) SetDirty(device, from, to);
+	}
+}
+
+static bool IsDirty(DcpuDevice* me, int offset)
+{
+	return me->dirty[offset / 32] >> (offset % 32) & 1;
+}
+
+bool DcpuDevice_NextDirty(DcpuDevice* me, int from, int* start, int* end)
+{
+	int offset = from > me->start ? from - me->start : 0;
+
+	// Whole clean words of the bitmap are skipped
+	while(offset < me->count && !IsDirty(me, offset)){
+		if(offset % 32 == 0 && !me->dirty[offset / 32]) offset += 32;
+		else offset++;
+	}
+
+	if(offset >= me->count) return false;
+
+	int last = offset;
+	while(last < me->count && IsDirty(me, last)) last++;
+
+	*start = me->start + offset;
+	*end = me->start + last;
+	return true;
+}
+
+void DcpuDevice_ClearDirty(DcpuDevice* me)
+{
+	memset(me->dirty, 0, (me->count + 31) / 32 * sizeof(uint32_t));
+}
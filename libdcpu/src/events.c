@@ -0,0 +1,189 @@
+#include "common.h"
+#include "dcpui.h"
+
+// Armed events are kept in a binary min-heap on their cycle, each event
+// knowing its place in it so that it can be moved or taken out in log n.
+// Execute only looks at the top: it runs until the first one is due
+// (eventStop), fires what's due and looks again.
+//
+// So an event fires between two instructions as soon as the count has
+// reached its cycle: never early, and late only by what's left of the
+// instruction that passed it. An idle program skips ahead to the next event
+// instead of returning DCPU_IDLE, so only a Dcpu with no events armed is
+// ever idle.
+//
+// An event is made once and armed with Dcpu_ScheduleEvent for every time it
+// should fire, its callback may arm it again (eg. cycle + period). Scheduling
+// an armed event moves it. Events can be scheduled from syscalls and
+// callbacks too, a cycle that has passed fires before the next instruction,
+// except from a callback: there it fires after the next instruction, so that
+// an event armed again for the current cycle doesn't fire in a loop.
+// Dcpu_Reset disarms all events.
+
+struct DcpuEvent {
+	void (*fire)(Dcpu* dcpu, void* data);
+	void* data;
+
+	uint64_t cycle;
+	int heapIndex;   // -1 while not armed
+};
+
+DcpuEvent* Dcpu_AddEvent(Dcpu* me, void (*fire)(Dcpu* dcpu, void* data), void* data)
+{
+	// The heap can always take every event, so arming one never fails
+	if(!Vector_Grow(me->events, 1) || !Vector_Reserve(me->eventHeap, me->events.count + 1))
+		return NULL;
+
+	DcpuEvent* event = calloc(1, sizeof(DcpuEvent));
+	if(!event) return NULL;
+
+	event->fire = fire;
+	event->data = data;
+	event->heapIndex = -1;
+
+	Vector_Add(me->events, event);
+	return event;
+}
+
+static bool Before(DcpuEvent* a, DcpuEvent* b)
+{
+	return a->cycle < b->cycle;
+}
+
+static void Place(Dcpu* me, DcpuEvent* event, int index)
+{
+	me->eventHeap.elems[index] = event;
+	event->heapIndex = index;
+}
+
+static void SiftUp(Dcpu* me, int index)
+{
+	DcpuEvent* event = me->eventHeap.elems[index];
+
+	while(index > 0){
+		int parent = (index - 1) / 2;
+		if(!Before(event, me->eventHeap.elems[parent])) break;
+
+		Place(me, me->eventHeap.elems[parent], index);
+		index = parent;
+	}
+
+	Place(me, event, index);
+}
+
+static void SiftDown(Dcpu* me, int index)
+{
+	DcpuEvent* event = me->eventHeap.elems[index];
+	int count = me->eventHeap.count;
+
+	for(;;){
+		int child = index * 2 + 1;
+		if(child >= count) break;
+		if(child + 1 < count && Before(me->eventHeap.elems[child + 1], me->eventHeap.elems[child])) child++;
+		if(!Before(me->eventHeap.elems[child], event)) break;
+
+		Place(me, me->eventHeap.elems[child], index);
+		index = child;
+	}
+
+	Place(me, event, index);
+}
+
+static void TakeOut(Dcpu* me, DcpuEvent* event)
+{
+	int index = event->heapIndex;
+	DcpuEvent* last = me->eventHeap.elems[--me->eventHeap.count];
+	event->heapIndex = -1;
+
+	if(last == event) return;
+
+	Place(me, last, index);
+	SiftUp(me, index);
+	SiftDown(me, last->heapIndex);
+}
+
+// Execute runs up to eventStop, the cycles of this call until the first
+// event is due, or all of them
+void SetEventStop(Dcpu* me)
+{
+	me->eventStop = me->execCycles;
+	if(!me->eventHeap.count) return;
+
+	uint64_t first = me->eventHeap.elems[0]->cycle;
+	if(first < me->cycleBase + me->execCycles) me->eventStop = first > me->cycleBase ? first - me->cycleBase : 0;
+}
+
+void Dcpu_ScheduleEvent(Dcpu* me, DcpuEvent* event, uint64_t cycle)
+{
+	if(event->heapIndex >= 0) TakeOut(me, event);
+
+	// Armed by a callback for a cycle FireEvents is firing, it would fire
+	// again right away and forever: it waits for the next cycle instead
+	if(me->firing && cycle <= me->firingAt) cycle = me->firingAt + 1;
+
+	event->cycle = cycle;
+	Place(me, event, me->eventHeap.count++);
+	SiftUp(me, event->heapIndex);
+
+	SetEventStop(me);
+}
+
+void Dcpu_CancelEvent(Dcpu* me, DcpuEvent* event)
+{
+	if(event->heapIndex < 0) return;
+
+	TakeOut(me, event);
+	SetEventStop(me);
+}
+
+bool DcpuEvent_IsArmed(DcpuEvent* me)
+{
+	return me->heapIndex >= 0;
+}
+
+void Dcpu_RemoveEvent(Dcpu* me, DcpuEvent** event)
+{
+	Dcpu_CancelEvent(me, *event);
+
+	for(int i = 0; i < me->events.count; i++){
+		if(me->events.elems[i] == *event){
+			Vector_Remove(me->events, i);
+			break;
+		}
+	}
+
+	free(*event);
+	*event = NULL;
+}
+
+void FireEvents(Dcpu* me)
+{
+	uint64_t now = me->cycleBase + me->cycles;
+
+	me->firing = true;
+	me->firingAt = now;
+
+	while(me->eventHeap.count && me->eventHeap.elems[0]->cycle <= now){
+		DcpuEvent* event = me->eventHeap.elems[0];
+		TakeOut(me, event);
+		event->fire(me, event->data);
+	}
+
+	me->firing = false;
+	SetEventStop(me);
+}
+
+void CancelEvents(Dcpu* me)
+{
+	DcpuEvent** it;
+	Vector_ForEach(me->eventHeap, it) (*it)->heapIndex = -1;
+	me->eventHeap.count = 0;
+}
+
+void FreeEvents(Dcpu* me)
+{
+	DcpuEvent** it;
+	Vector_ForEach(me->events, it) free(*it);
+	Vector_Free(me->events);
+	Vector_Free(me->eventHeap);
+}
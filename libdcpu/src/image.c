@@ -0,0 +1,207 @@
+#define _GNU_SOURCE   // memfd_create
+#include "common.h"
+#include "dcpui.h"
+
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Shared program images
+//
+// An image is loaded once into a sealed memfd. Each Dcpu maps it privately,
+// so the kernel shares its pages between all of them and copies a page only
+// when a Dcpu first writes to it. Pages the image has no words in are mapped
+// anonymously instead, which reads as the kernel's single zero page until
+// written. Images are kept in a pool by file, as long as a Dcpu or the
+// caller holds a reference, so getting the same, unchanged file again gives
+// the same image. A raw binary and a segmented image load the same way.
+
+struct DcpuImage {
+	char* filename;
+	dev_t dev;
+	ino_t ino;
+	struct timespec mtime;
+	off_t size;
+
+	int fd;
+	uint16_t entry;
+	uint32_t used[USED_WORDS];
+
+	int refs;   // under poolLock
+	DcpuImage* next;
+};
+
+static pthread_mutex_t poolLock = PTHREAD_MUTEX_INITIALIZER;
+static DcpuImage* pool;
+
+static bool SameFile(DcpuImage* me, const char* filename, struct stat* st)
+{
+	return !strcmp(me->filename, filename) && me->dev == st->st_dev && me->ino == st->st_ino
+		&& me->size == st->st_size && me->mtime.tv_sec == st->st_mtim.tv_sec
+		&& me->mtime.tv_nsec == st->st_mtim.tv_nsec;
+}
+
+static DcpuImage* Load(const char* filename, struct stat* st)
+{
+	DcpuImage* me = calloc(1, sizeof(DcpuImage));
+	if(!me) return NULL;
+
+	me->fd = memfd_create("dcpu-image", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	me->filename = strdup(filename);
+	if(me->fd < 0 || !me->filename || ftruncate(me->fd, RAM_SIZE) != 0) goto fail;
+
+	uint16_t* ram = mmap(NULL, RAM_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, me->fd, 0);
+	if(ram == MAP_FAILED) goto fail;
+
+	int words = LoadImage(ram, filename, &me->entry, me->used);
+	munmap(ram, RAM_SIZE);
+	if(words < 0) goto fail;
+
+	// Nobody can change the image from now on
+	fcntl(me->fd, F_ADD_SEALS, F_SEAL_WRITE | F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL);
+
+	me->dev = st->st_dev;
+	me->ino = st->st_ino;
+	me->mtime = st->st_mtim;
+	me->size = st->st_size;
+
+	return me;
+
+fail:
+	if(me->fd >= 0) close(me->fd);
+	free(me->filename);
+	free(me);
+	return NULL;
+}
+
+DcpuImage* DcpuImage_Get(const char* filename)
+{
+	struct stat st;
+	if(stat(filename, &st) != 0) return NULL;
+
+	pthread_mutex_lock(&poolLock);
+
+	DcpuImage* me;
+	for(me = pool; me; me = me->next){
+		if(SameFile(me, filename, &st)) break;
+	}
+
+	if(!me && (me = Load(filename, &st))){
+		me->next = pool;
+		pool = me;
+	}
+
+	if(me) me->refs++;
+
+	pthread_mutex_unlock(&poolLock);
+	return me;
+}
+
+void DcpuImage_AddRef(DcpuImage* me)
+{
+	pthread_mutex_lock(&poolLock);
+	me->refs++;
+	pthread_mutex_unlock(&poolLock);
+}
+
+void DcpuImage_Release(DcpuImage** me)
+{
+	DcpuImage* img = *me;
+	*me = NULL;
+
+	pthread_mutex_lock(&poolLock);
+
+	bool last = --img->refs == 0;
+	if(last){
+		DcpuImage** it = &pool;
+		while(*it != img) it = &(*it)->next;
+		*it = img->next;
+	}
+
+	pthread_mutex_unlock(&poolLock);
+
+	if(last){
+		close(img->fd);
+		free(img->filename);
+		free(img);
+	}
+}
+
+uint16_t DcpuImage_GetEntry(DcpuImage* me)
+{
+	return me->entry;
+}
+
+// The view holds a reference to the image until it's unmapped
+uint16_t* DcpuImage_Map(DcpuImage* me)
+{
+	uint8_t* ram = mmap(NULL, RAM_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(ram == MAP_FAILED) return NULL;
+
+	// Map the runs of pages that have words in the image over the anonymous memory
+	int pageWords = sysconf(_SC_PAGESIZE) / sizeof(uint16_t);
+	int start, end;
+
+	for(int at = 0; NextUsedRange(me->used, at, &start, &end); at = end){
+		start = start / pageWords * pageWords;
+		end = (end + pageWords - 1) / pageWords * pageWords;
+
+		// The first page may already be mapped for the previous run, that's fine
+		size_t offset = start * sizeof(uint16_t), length = (end - start) * sizeof(uint16_t);
+
+		if(mmap(ram + offset, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, me->fd, offset) == MAP_FAILED){
+			munmap(ram, RAM_SIZE);
+			return NULL;
+		}
+	}
+
+	DcpuImage_AddRef(me);
+	return (uint16_t*)ram;
+}
+
+void DcpuImage_Unmap(DcpuImage* me, uint16_t* ram)
+{
+	munmap(ram, RAM_SIZE);
+	DcpuImage_Release(&me);
+}
+
+// Shared pages are an image's or the zero page. Read from /proc/self/pagemap,
+// which may not be there or readable.
+bool Dcpu_GetRamPages(Dcpu* dcpu, int* resident, int* shared)
+{
+	*resident = *shared = 0;
+
+	uint16_t* ram = Dcpu_GetRam(dcpu);
+	long pageSize = sysconf(_SC_PAGESIZE);
+
+	// The RAM may not start on a page (calloc)
+	uintptr_t first = (uintptr_t)ram / pageSize, last = ((uintptr_t)ram + RAM_SIZE - 1) / pageSize;
+	int numPages = last - first + 1;
+
+	uint64_t entries[numPages];
+
+	int fd = open("/proc/self/pagemap", O_RDONLY);
+	if(fd < 0) return false;
+
+	bool ok = pread(fd, entries, sizeof(entries), first * sizeof(uint64_t)) == sizeof(entries);
+	close(fd);
+
+	if(!ok) return false;
+
+	for(int i = 0; i < numPages; i++){
+		bool present = entries[i] >> 63 & 1;
+		bool file = entries[i] >> 61 & 1;
+		bool exclusive = entries[i] >> 56 & 1;
+
+		if(!present) continue;
+
+		(*resident)++;
+
+		// Pages of an image or the zero page, rather than this RAM's own copy
+		if(file || !exclusive) (*shared)++;
+	}
+
+	return true;
+}
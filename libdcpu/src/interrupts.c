@@ -0,0 +1,102 @@
+#include "common.h"
+#include "dcpui.h"
+
+// Interrupts, as in version 1.7 of the spec. A program sets its handler with
+// IAS (0, the default, drops interrupts) and reads it with IAG. An interrupt
+// is taken between two instructions: PC and A are pushed, A is set to the
+// message and PC to the handler, and further interrupts are queued until the
+// handler returns with RFI, which pops A and PC. IAQ 1 queues them too, IAQ 0
+// lets them in again. INT raises one from the program, Dcpu_Interrupt from
+// the host, also while the cpu runs on another thread.
+//
+// The cpu looks for them at the end of each block of instructions (a branch
+// backwards), and when Dcpu_Execute starts. A program found idle takes one
+// on the next Dcpu_Execute. Dcpu_Reset drops waiting interrupts.
+//
+// Interrupts wait in a bounded ring that any thread can add to without a
+// lock, and that only the thread running the cpu takes from. Each slot has
+// a sequence number: slot i is free for the producer that claimed position
+// pos (pos % size == i) when its sequence is pos, and holds a message for
+// the consumer at position pos when it's pos + 1. Producers claim positions
+// by moving tail forward with a compare and swap.
+//
+// The message is written before the release store of the sequence that
+// publishes it, and read after the consumer's acquire, so a cpu that sees
+// the sequence (with a relaxed load, see InterruptPending, then an acquire)
+// sees the message.
+
+void InitInterrupts(Dcpu* me)
+{
+	InterruptQueue* q = &me->interrupts;
+
+	for(uint32_t i = 0; i < INTERRUPT_QUEUE_SIZE; i++) __atomic_store_n(&q->slots[i].seq, i, __ATOMIC_RELAXED);
+	q->head = 0;
+	q->headSeq = &q->slots[0].seq;
+	q->headReady = 1;
+	__atomic_store_n(&q->tail, 0, __ATOMIC_RELAXED);
+
+	me->ia = 0;
+	me->queueing = false;
+}
+
+bool Dcpu_Interrupt(Dcpu* me, uint16_t message)
+{
+	InterruptQueue* q = &me->interrupts;
+	uint32_t pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+	InterruptSlot* slot;
+
+	for(;;){
+		slot = q->slots + pos % INTERRUPT_QUEUE_SIZE;
+		int32_t diff = (int32_t)(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - pos);
+
+		// Free: claim it, a failed swap gives the tail another producer moved it to
+		if(diff == 0){
+			if(__atomic_compare_exchange_n(&q->tail, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) break;
+		}
+
+		// Still holds the message from a lap ago, the ring is full
+		else if(diff < 0) return false;
+
+		// Another producer claimed it first
+		else pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+	}
+
+	slot->message = message;
+	__atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+	return true;
+}
+
+void TakeInterrupt(Dcpu* me)
+{
+	InterruptQueue* q = &me->interrupts;
+	InterruptSlot* slot = q->slots + q->head % INTERRUPT_QUEUE_SIZE;
+
+	// InterruptPending saw the sequence with a relaxed load, loading it
+	// again with acquire orders the message after it
+	__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+	uint16_t message = slot->message;
+
+	// The slot is free again for the producer a lap ahead
+	__atomic_store_n(&slot->seq, q->head + INTERRUPT_QUEUE_SIZE, __ATOMIC_RELEASE);
+	q->head++;
+	q->headSeq = &q->slots[q->head % INTERRUPT_QUEUE_SIZE].seq;
+	q->headReady = q->head + 1;
+
+	// With no handler interrupts are dropped
+	if(!me->ia) return;
+
+	// The handler ends with RFI, which turns queueing off and pops A and PC
+	me->queueing = true;
+	Dcpu_Push(me, me->pc);
+	Dcpu_Push(me, me->regs[DR_A]);
+	me->pc = me->ia;
+	me->regs[DR_A] = message;
+}
+
+void DropInterrupts(Dcpu* me)
+{
+	me->queueing = false;
+	me->ia = 0;
+
+	while(InterruptPending(me)) TakeInterrupt(me);
+}
@@ -0,0 +1,270 @@
+#include "common.h"
+#include "dcpui.h"
+
+// Loop idioms
+//
+// When a branch goes back to the start of a loop, the loop is matched
+// against the shape of a copy, fill or compare loop:
+//
+//   :loop  SET [I], [J]       ; at most one write through a register, or
+//          IFN [I], [J]       ; a compare that leaves the loop
+//          SET PC, differ
+//          ADD I, 1           ; registers stepped by one, in any order
+//          ADD J, 1
+//          IFN I, end         ; the end test, against a literal
+//          SET PC, loop       ; or SUB PC, n
+//
+// If it matches, the iterations that are sure to go around again are run
+// natively: the writes are done with memmove or a plain C loop, and the
+// registers, O and the cycles are set to what running them would have left.
+// The iteration that ends the loop is left to the interpreter. Iterations
+// are only run natively while no stepped register wraps around, nothing is
+// written over the loop's own code, and they fit in the cycles left.
+
+#define MAX_BODY 8
+
+typedef struct {
+	DIns ins;
+	DVals v[2];
+	uint16_t val[2];   // next words and literal values
+	int nextWords;
+} Op;
+
+typedef struct {
+	Dcpu* me;
+	Op ops[MAX_BODY];
+	int count;
+
+	int step[8];       // what each register changes by per iteration
+	int stepAt[8];     // the op that steps it, or -1
+
+	int write;         // the op that writes, or -1
+	int compare;       // the op that may leave the loop, or -1
+	int test;          // the end test, next to last
+	int cycles;        // of an iteration that goes around again
+} Loop;
+
+static bool IsReg(DVals v){ return v <= DV_J; }
+static bool IsRef(DVals v){ return v >= DV_RefBase && v <= DV_RefTop; }
+static bool IsLiteral(DVals v){ return v == DV_NextWord || v >= DV_LiteralBase; }
+
+// A register, [register] or a literal
+static bool IsSimple(DVals v){ return IsReg(v) || IsRef(v) || IsLiteral(v); }
+
+static int Decode(Dcpu* me, uint16_t addr, Op* op)
+{
+	uint16_t word = me->ram[addr++];
+	op->ins = word & 0xf;
+	op->v[0] = (word >> 4) & 0x3f;
+	op->v[1] = (word >> 10) & 0x3f;
+	op->nextWords = 0;
+
+	for(int i = 0; i < 2; i++){
+		if(opHasNextWord(op->v[i])){
+			op->val[i] = me->ram[addr++];
+			op->nextWords++;
+		}
+		else if(op->v[i] >= DV_LiteralBase) op->val[i] = op->v[i] - DV_LiteralBase;
+	}
+
+	return 1 + op->nextWords;
+}
+
+// The value of register r at op at, in the iteration t from now
+static uint16_t RegAt(Loop* l, int r, int at, int t)
+{
+	int steps = t + (l->stepAt[r] >= 0 && l->stepAt[r] < at);
+	return l->me->regs[r] + steps * l->step[r];
+}
+
+static uint16_t AddrAt(Loop* l, Op* op, int i, int at, int t)
+{
+	return RegAt(l, op->v[i] - DV_RefBase, at, t);
+}
+
+static uint16_t ValueAt(Loop* l, int at, int i, int t)
+{
+	Op* op = l->ops + at;
+	if(IsReg(op->v[i])) return RegAt(l, op->v[i], at, t);
+	if(IsRef(op->v[i])) return l->me->ram[AddrAt(l, op, i, at, t)];
+	return op->val[i];
+}
+
+// Fills in l if the ops from head to branchAddr are a loop it knows
+static bool Match(Loop* l, uint16_t head, uint16_t branchAddr)
+{
+	Dcpu* me = l->me;
+	uint16_t addr = head;
+
+	l->count = 0;
+	while(addr <= branchAddr){
+		if(l->count == MAX_BODY) return false;
+		addr += Decode(me, addr, l->ops + l->count++);
+	}
+
+	// The branch has to end exactly where the decoding did
+	if(addr != branchAddr + l->ops[l->count - 1].nextWords + 1 || l->count < 3) return false;
+
+	Op* branch = l->ops + l->count - 1;
+	if(branch->v[0] != DV_PC || !IsLiteral(branch->v[1])) return false;
+	if(branch->ins == DI_Set && branch->val[1] != head) return false;
+	if(branch->ins == DI_Sub && U16C(addr - branch->val[1]) != head) return false;
+	if(branch->ins != DI_Set && branch->ins != DI_Sub) return false;
+
+	l->test = l->count - 2;
+	Op* test = l->ops + l->test;
+	if(test->ins != DI_Ifn || !IsReg(test->v[0]) || !IsLiteral(test->v[1])) return false;
+
+	for(int r = 0; r < 8; r++){
+		l->step[r] = 0;
+		l->stepAt[r] = -1;
+	}
+
+	l->write = l->compare = -1;
+	l->cycles = (2 + 1 + test->nextWords) + (branch->ins == DI_Set ? 1 : 2) + branch->nextWords;
+
+	for(int i = 0; i < l->test; i++){
+		Op* op = l->ops + i;
+		l->cycles += op->nextWords;
+
+		if((op->ins == DI_Add || op->ins == DI_Sub) && IsReg(op->v[0]) 
+			&& op->v[1] == DV_LiteralBase + 1 && l->stepAt[op->v[0]] < 0){
+			l->step[op->v[0]] = op->ins == DI_Add ? 1 : -1;
+			l->stepAt[op->v[0]] = i;
+			l->cycles += 2;
+		}
+
+		else if(op->ins == DI_Set && IsRef(op->v[0]) && IsSimple(op->v[1]) && l->write < 0){
+			l->write = i;
+			l->cycles += 1;
+		}
+
+		// Goes around again when the IF fails, and the exit is skipped
+		else if((op->ins == DI_Ifn || op->ins == DI_Ife) && IsSimple(op->v[0]) && IsSimple(op->v[1]) 
+			&& l->compare < 0 && i + 1 < l->test){
+			Op* exit = l->ops + i + 1;
+			if(exit->ins != DI_Set || exit->v[0] != DV_PC || !IsLiteral(exit->v[1])) return false;
+
+			l->compare = i++;
+			l->cycles += 2 + exit->nextWords;
+		}
+
+		else return false;
+	}
+
+	// Something has to change for the end test, and writes and compares
+	// aren't mixed so that the order within an iteration doesn't matter
+	if(l->write >= 0 && l->compare >= 0) return false;
+	if(l->write < 0 && l->compare < 0) return false;
+
+	return true;
+}
+
+// How many iterations from now on can run natively
+static int CountIterations(Loop* l, uint16_t head, uint16_t end, int execCycles)
+{
+	Dcpu* me = l->me;
+	int n = (execCycles - me->cycles) / l->cycles;
+
+	// Until the end test fails
+	Op* test = l->ops + l->test;
+	int r = test->v[0];
+	uint16_t first = RegAt(l, r, l->test, 0);
+
+	if(l->step[r]){
+		int untilEnd = U16C((test->val[1] - first) * l->step[r]);
+		if(untilEnd < n) n = untilEnd;
+	}
+	else if(first == test->val[1]) return 0;
+
+	// Without wrapping a register around, so that O ends up 0
+	for(r = 0; r < 8; r++){
+		int room = l->step[r] > 0 ? 0xffff - me->regs[r] : l->step[r] < 0 ? me->regs[r] : n;
+		if(room < n) n = room;
+	}
+
+	// Until a write lands on the loop
+	if(l->write >= 0){
+		Op* op = l->ops + l->write;
+		uint16_t addr = AddrAt(l, op, 0, l->write, 0);
+		int step = l->step[op->v[0] - DV_RefBase];
+		int hit = n;
+
+		if(addr >= head && addr < end) hit = 0;
+		else if(step > 0 && addr < head) hit = head - addr;
+		else if(step < 0 && addr >= end) hit = addr - end + 1;
+
+		if(hit < n) n = hit;
+	}
+
+	// Until the compare leaves the loop
+	if(l->compare >= 0){
+		bool equal = l->ops[l->compare].ins == DI_Ife;
+		for(int t = 0; t < n; t++){
+			if((ValueAt(l, l->compare, 0, t) == ValueAt(l, l->compare, 1, t)) == equal) return t;
+		}
+	}
+
+	return n > 0 ? n : 0;
+}
+
+static void RunWrites(Loop* l, int n)
+{
+	Dcpu* me = l->me;
+	Op* op = l->ops + l->write;
+
+	uint16_t dst = AddrAt(l, op, 0, l->write, 0);
+	int dstStep = l->step[op->v[0] - DV_RefBase];
+
+	if(IsRef(op->v[1]) && dstStep == 1 && l->step[op->v[1] - DV_RefBase] == 1){
+		// A copy forwards, unless it reads what it has written (a smear)
+		uint16_t src = AddrAt(l, op, 1, l->write, 0);
+		if(dst <= src || dst >= src + n){
+			memmove(me->ram + dst, me->ram + src, n * sizeof(uint16_t));
+			Dcpu_MarkDirty(me, dst, n);
+			return;
+		}
+	}
+
+	for(int t = 0; t < n; t++) me->ram[U16C(dst + t * dstStep)] = ValueAt(l, l->write, 1, t);
+
+	if(dstStep == 0) Dcpu_MarkDirty(me, dst, 1);
+	else Dcpu_MarkDirty(me, dstStep > 0 ? dst : dst - n + 1, n);
+}
+
+void FastForwardLoop(Dcpu* me, uint16_t branchAddr, int execCycles)
+{
+	uint16_t head = me->pc;
+
+	// The hooks have to see every word, and other cores each word whole
+	if(me->hookedDevices || SharedRam(me)) return;
+
+	if(me->idiomMiss && me->idiomMissHead == head && me->idiomMissBranch == branchAddr) return;
+
+	Loop l;
+	l.me = me;
+
+	if(!Match(&l, head, branchAddr)){
+		me->idiomMiss = true;
+		me->idiomMissHead = head;
+		me->idiomMissBranch = branchAddr;
+		return;
+	}
+
+	uint16_t end = branchAddr + 1 + l.ops[l.count - 1].nextWords;
+	int n = CountIterations(&l, head, end, execCycles);
+	if(n == 0) return;
+
+	if(l.write >= 0) RunWrites(&l, n);
+
+	// The last ADD or SUB (maybe SUB PC, n) didn't overflow
+	bool setsO = l.ops[l.count - 1].ins == DI_Sub;
+	for(int r = 0; r < 8; r++){
+		me->regs[r] += n * l.step[r];
+		if(l.step[r]) setsO = true;
+	}
+
+	if(setsO) me->o = 0;
+
+	me->cycles += n * l.cycles;
+}
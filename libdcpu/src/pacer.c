@@ -0,0 +1,178 @@
+#include "common.h"
+#include "dcpu.h"
+
+#include <errno.h>
+#include <time.h>
+
+// Each Dcpu counts the cycles it has run since a start time, so it's due to
+// run again once start + cycles / hz has passed on the monotonic clock. A
+// batch runs the cycles it's behind by plus one slice ahead, so waking up
+// late is made up for instead of adding up. The Dcpus wait on a timer wheel
+// of TICK_NS ticks, the thread sleeps (with an absolute deadline) until the
+// next tick that has any.
+//
+// The slice adapts to how late the thread wakes up: the later, the longer
+// the batches, so that waking up stays a small part of the time.
+//
+// A Dcpu leaves the pacer when its status callback returns false, or when
+// it exits.
+
+#define NS 1000000000LL
+#define TICK_NS 250000LL
+#define WHEEL_SLOTS 256
+#define MIN_SLICE_NS 1000000LL
+#define MAX_SLICE_NS 16000000LL
+#define SLICE_PER_LATENCY 32
+
+// Further behind than this (eg. stopped in a debugger, or the host is too
+// slow) the time is written off rather than run at full speed
+#define MAX_LAG_NS 100000000LL
+
+typedef struct PacedDcpu {
+	Dcpu* dcpu;
+	int64_t hz;
+	int64_t start;
+	int64_t cycles;    // since start, less than hz
+	int64_t due;
+
+	bool (*status)(Dcpu* dcpu, DcpuStatus status, void* data);
+	void* data;
+
+	struct PacedDcpu* next;
+} PacedDcpu;
+
+struct DcpuPacer {
+	PacedDcpu* slots[WHEEL_SLOTS];
+	int count;
+
+	int64_t tick;      // the first one that hasn't been run
+	int64_t slice;
+	int64_t latency;   // running average
+};
+
+static int64_t Now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * NS + ts.tv_nsec;
+}
+
+static void SleepUntil(int64_t deadline)
+{
+	struct timespec ts = { deadline / NS, deadline % NS };
+	while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+}
+
+static void Insert(DcpuPacer* me, PacedDcpu* p)
+{
+	int64_t tick = p->due / TICK_NS;
+	if(tick < me->tick) tick = me->tick;
+
+	PacedDcpu** slot = &me->slots[tick % WHEEL_SLOTS];
+	p->next = *slot;
+	*slot = p;
+}
+
+DcpuPacer* DcpuPacer_Create()
+{
+	DcpuPacer* me = calloc(1, sizeof(DcpuPacer));
+	if(!me) return NULL;
+
+	me->tick = Now() / TICK_NS;
+	me->slice = MIN_SLICE_NS;
+	return me;
+}
+
+void DcpuPacer_Destroy(DcpuPacer** me)
+{
+	for(int i = 0; i < WHEEL_SLOTS; i++){
+		PacedDcpu* p = (*me)->slots[i];
+		while(p){
+			PacedDcpu* next = p->next;
+			free(p);
+			p = next;
+		}
+	}
+
+	free(*me);
+	*me = NULL;
+}
+
+bool DcpuPacer_Add(DcpuPacer* me, Dcpu* dcpu, int hz, 
+	bool (*status)(Dcpu* dcpu, DcpuStatus status, void* data), void* data)
+{
+	PacedDcpu* p = calloc(1, sizeof(PacedDcpu));
+	if(!p) return false;
+
+	p->dcpu = dcpu;
+	p->hz = hz > 0 ? hz : 1;
+	p->status = status;
+	p->data = data;
+	p->start = p->due = Now();
+
+	Insert(me, p);
+	me->count++;
+	return true;
+}
+
+// Returns false if the Dcpu leaves the pacer
+static bool RunBatch(DcpuPacer* me, PacedDcpu* p, int64_t now)
+{
+	if(now - p->due > MAX_LAG_NS){
+		p->start = now;
+		p->cycles = 0;
+	}
+
+	int64_t behind = (now - p->start) * p->hz / NS - p->cycles;
+
+	int64_t cycles = behind + me->slice * p->hz / NS;
+	if(cycles < 1) cycles = 1;
+
+	DcpuStatus status = Dcpu_Execute(p->dcpu, cycles);
+	p->cycles += Dcpu_GetCycles(p->dcpu);
+
+	// Keeps the products above in range, whole seconds move to the start
+	p->start += p->cycles / p->hz * NS;
+	p->cycles %= p->hz;
+	p->due = p->start + p->cycles * NS / p->hz;
+
+	bool stay = p->status ? p->status(p->dcpu, status, p->data) : true;
+	return stay && status != DCPU_EXITED;
+}
+
+void DcpuPacer_Run(DcpuPacer* me)
+{
+	while(me->count){
+		// Far off Dcpus are in the slots too, when found early they're put back
+		while(!me->slots[me->tick % WHEEL_SLOTS]) me->tick++;
+
+		int64_t tick = me->tick++;
+		int64_t deadline = tick * TICK_NS;
+		int64_t now = Now();
+
+		if(now < deadline){
+			SleepUntil(deadline);
+			now = Now();
+
+			me->latency += (now - deadline - me->latency) / 8;
+			me->slice = me->latency * SLICE_PER_LATENCY;
+			if(me->slice < MIN_SLICE_NS) me->slice = MIN_SLICE_NS;
+			if(me->slice > MAX_SLICE_NS) me->slice = MAX_SLICE_NS;
+		}
+
+		PacedDcpu* p = me->slots[tick % WHEEL_SLOTS];
+		me->slots[tick % WHEEL_SLOTS] = NULL;
+
+		while(p){
+			PacedDcpu* next = p->next;
+
+			if(p->due / TICK_NS > tick || RunBatch(me, p, now)) Insert(me, p);
+			else{
+				free(p);
+				me->count--;
+			}
+
+			p = next;
+		}
+	}
+}
@@ -0,0 +1,105 @@
+#include "common.h"
+#include "dcpu.h"
+
+#include <pthread.h>
+
+// The free Dcpus are a stack, so the most recently used (and most likely
+// cached) one is handed out first. Dcpus are reset when given back, so
+// taking one only holds the lock for a pop.
+//
+// setup (if not NULL) is called once for each Dcpu the pool creates, eg. to
+// register its syscalls, which a reset keeps. The pool holds a reference to
+// its image.
+
+typedef Dcpu* DcpuPtr;
+typedef Vector(DcpuPtr) DcpuPtrVector;
+
+struct DcpuPool {
+	DcpuImage* image;
+	void (*setup)(Dcpu* dcpu, void* data);
+	void* data;
+
+	pthread_mutex_t lock;
+	DcpuPtrVector free;
+};
+
+DcpuPool* DcpuPool_Create(DcpuImage* image, void (*setup)(Dcpu* dcpu, void* data), void* data)
+{
+	DcpuPool* me = calloc(1, sizeof(DcpuPool));
+	if(!me) return NULL;
+
+	if(image) DcpuImage_AddRef(image);
+	me->image = image;
+
+	me->setup = setup;
+	me->data = data;
+
+	pthread_mutex_init(&me->lock, NULL);
+	Vector_Init(me->free, DcpuPtr);
+
+	return me;
+}
+
+void DcpuPool_Destroy(DcpuPool** me)
+{
+	DcpuPool* p = *me;
+
+	DcpuPtr* it;
+	Vector_ForEach(p->free, it) Dcpu_Destroy(it);
+	Vector_Free(p->free);
+
+	if(p->image) DcpuImage_Release(&p->image);
+
+	pthread_mutex_destroy(&p->lock);
+	free(p);
+	*me = NULL;
+}
+
+static Dcpu* CreateDcpu(DcpuPool* me)
+{
+	Dcpu* dcpu = me->image ? Dcpu_CreateFromImage(me->image) : Dcpu_Create();
+	if(dcpu && me->setup) me->setup(dcpu, me->data);
+	return dcpu;
+}
+
+bool DcpuPool_Fill(DcpuPool* me, int numDcpus)
+{
+	for(int i = 0; i < numDcpus; i++){
+		Dcpu* dcpu = CreateDcpu(me);
+		if(!dcpu) return false;
+
+		pthread_mutex_lock(&me->lock);
+		bool added = Vector_Add(me->free, dcpu);
+		pthread_mutex_unlock(&me->lock);
+
+		if(!added){
+			Dcpu_Destroy(&dcpu);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+Dcpu* DcpuPool_Acquire(DcpuPool* me)
+{
+	Dcpu* dcpu = NULL;
+
+	pthread_mutex_lock(&me->lock);
+	if(me->free.count) dcpu = me->free.elems[--me->free.count];
+	pthread_mutex_unlock(&me->lock);
+
+	return dcpu ? dcpu : CreateDcpu(me);
+}
+
+void DcpuPool_Release(DcpuPool* me, Dcpu* dcpu)
+{
+	Dcpu_Reset(dcpu);
+
+	pthread_mutex_lock(&me->lock);
+	bool added = Vector_Add(me->free, dcpu);
+	pthread_mutex_unlock(&me->lock);
+
+	// Without room to keep it, it's just not reused
+	if(!added) Dcpu_Destroy(&dcpu);
+}
@@ -0,0 +1,460 @@
+#include "common.h"
+#include "dcpui.h"
+#include "threadpool.h"
+
+#include <pthread.h>
+
+// Deterministic parallel simulation: VMs run in epochs of a fixed number of
+// cycles, in parallel. During an epoch a VM only sees itself, what it does
+// to the others is kept until the end of the epoch (the barrier) and done
+// then in an order that depends only on the VMs: by their numbers, then in
+// the order they did it. So the VMs end up exactly the same whatever the
+// number of threads. What they can do to each other:
+//
+//   - send messages. They're delivered in the order of the senders'
+//     numbers, a VM's in the order it sent them. Messages to a VM that has
+//     DCPU_SIM_INBOX_WORDS waiting are dropped. SEND fails (A = 0) for no
+//     such VM, C = 0 or the host out of memory. RECEIVE drops what doesn't
+//     fit in C words, A = 0xffff if no message is waiting.
+//   - write to the shared range (DcpuSim_Share), which starts out as the
+//     first VM's words there. The words each one wrote are merged, VM by VM
+//     in order, so of two VMs that wrote a word the one with the higher
+//     number wins, and then copied to all of them.
+//   - the host raises interrupts with DcpuSim_Interrupt, from any thread.
+//     They're raised by VM, then in the order they were raised, after the
+//     interrupts for delivered messages.
+//
+// VMs mustn't reach each other in other ways (channels, cores, Dcpu_Interrupt
+// during an epoch), or depend on the time. Their own events are fine, they
+// fire at cycle counts. A VM suspended by a syscall (DCPU_WAITING) stops for
+// the rest of the epoch, the host resumes it in the barrier callback, which
+// runs on the calling thread with the VMs stopped and the effects done. Run
+// stops early if all the VMs exit.
+//
+// During an epoch each VM runs on its own: what it sends only goes to its
+// outbox, and the words it writes to the shared range are marked by a
+// device without hooks. At the barrier, on the thread that called
+// DcpuSim_Run, the effects are applied VM by VM in the order of their
+// numbers, so nothing depends on which thread ran which VM, or when.
+
+// Messages wait as the VM they're to (in the outbox) or from (in the inbox),
+// their length and their words
+typedef Vector(uint16_t) WordVector;
+
+typedef struct {
+	DcpuSim* sim;
+	Dcpu* dcpu;
+	int id;
+
+	uint64_t target;   // the cycle count this epoch runs it to
+	bool exited;
+
+	DcpuDevice* shared;
+
+	WordVector outbox;
+	WordVector inbox;
+	int inboxRead;     // where the next message to receive starts
+	bool delivered;    // at this barrier
+	uint16_t notify;   // the interrupt for delivered messages, 0 for none
+} Vm;
+
+typedef Vm* VmPtr;
+typedef Vector(VmPtr) VmVector;
+
+typedef struct {
+	int vm;
+	int seq;   // the order it was raised in
+	uint16_t message;
+} HostInterrupt;
+
+typedef Vector(HostInterrupt) HostInterruptVector;
+
+typedef struct {
+	int start, end;
+} WordRun;
+
+typedef Vector(WordRun) WordRunVector;
+
+struct DcpuSim {
+	int epochCycles;
+	int numThreads;
+	ThreadPool* pool;   // NULL with one thread
+	uint64_t epoch;
+
+	VmVector vms;
+	int nextVm;         // the next one to run this epoch, taken by the threads
+
+	// The shared range as of the last barrier, and the words written since
+	int sharedStart;
+	int sharedCount;
+	uint16_t* sharedWords;
+	WordRunVector sharedRuns;
+
+	pthread_mutex_t interruptLock;
+	HostInterruptVector interrupts;
+	int interruptSeq;
+};
+
+DcpuSim* DcpuSim_Create(int epochCycles, int numThreads)
+{
+	DcpuSim* me = calloc(1, sizeof(DcpuSim));
+	if(!me) return NULL;
+
+	me->epochCycles = epochCycles > 0 ? epochCycles : 1;
+	me->numThreads = numThreads > 0 ? numThreads : 1;
+
+	if(me->numThreads > 1){
+		me->pool = ThreadPool_Create(me->numThreads);
+		if(!me->pool){
+			free(me);
+			return NULL;
+		}
+	}
+
+	Vector_Init(me->vms, VmPtr);
+	Vector_Init(me->sharedRuns, WordRun);
+	Vector_Init(me->interrupts, HostInterrupt);
+	pthread_mutex_init(&me->interruptLock, NULL);
+
+	return me;
+}
+
+void DcpuSim_Destroy(DcpuSim** me)
+{
+	if((*me)->pool) ThreadPool_Destroy(&(*me)->pool);
+
+	VmPtr* it;
+	Vector_ForEach((*me)->vms, it){
+		Vm* vm = *it;
+		if(vm->shared) Dcpu_UnmapDevice(vm->dcpu, &vm->shared);
+		Vector_Free(vm->outbox);
+		Vector_Free(vm->inbox);
+		free(vm);
+	}
+
+	Vector_Free((*me)->vms);
+	Vector_Free((*me)->sharedRuns);
+	Vector_Free((*me)->interrupts);
+	pthread_mutex_destroy(&(*me)->interruptLock);
+	free((*me)->sharedWords);
+
+	free(*me);
+	*me = NULL;
+}
+
+bool DcpuSim_Share(DcpuSim* me, uint16_t start, int count)
+{
+	if(me->vms.count || me->sharedWords || count <= 0 || count > 0x10000 - start) return false;
+
+	me->sharedWords = calloc(count, sizeof(uint16_t));
+	if(!me->sharedWords) return false;
+
+	me->sharedStart = start;
+	me->sharedCount = count;
+	return true;
+}
+
+static void SysSimId(Dcpu* dcpu, void* data)
+{
+	Vm* me = data;
+
+	dcpu->regs[DR_A] = me->id;
+	dcpu->regs[DR_B] = me->sim->vms.count;
+	ChargeIntrinsic(dcpu, 0);
+}
+
+static void SysSimSend(Dcpu* dcpu, void* data)
+{
+	Vm* me = data;
+	uint16_t to = dcpu->regs[DR_A];
+	uint16_t addr = dcpu->regs[DR_B];
+	int count = ClipLength(addr, dcpu->regs[DR_C]);
+
+	if(to >= me->sim->vms.count || count == 0){
+		dcpu->regs[DR_A] = 0;
+		ChargeIntrinsic(dcpu, 0);
+		return;
+	}
+
+	if(!Vector_Grow(me->outbox, 2 + count)){
+		dcpu->regs[DR_A] = 0;
+		ChargeIntrinsic(dcpu, 0);
+		return;
+	}
+
+	// There's room for these now
+	Vector_Add(me->outbox, to);
+	Vector_Add(me->outbox, count);
+	Vector_Append(me->outbox, dcpu->ram + addr, count);
+
+	dcpu->regs[DR_A] = count;
+	ChargeIntrinsic(dcpu, count);
+}
+
+static void SysSimReceive(Dcpu* dcpu, void* data)
+{
+	Vm* me = data;
+
+	if(me->inboxRead == me->inbox.count){
+		dcpu->regs[DR_A] = 0xffff;
+		ChargeIntrinsic(dcpu, 0);
+		return;
+	}
+
+	uint16_t from = me->inbox.elems[me->inboxRead];
+	uint16_t length = me->inbox.elems[me->inboxRead + 1];
+	uint16_t addr = dcpu->regs[DR_B];
+
+	// What doesn't fit is dropped with the message
+	int count = ClipLength(addr, dcpu->regs[DR_C] < length ? dcpu->regs[DR_C] : length);
+
+	memcpy(dcpu->ram + addr, me->inbox.elems + me->inboxRead + 2, count * sizeof(uint16_t));
+	if(count) Dcpu_MarkDirty(dcpu, addr, count);
+	me->inboxRead += 2 + length;
+
+	dcpu->regs[DR_A] = length;
+	dcpu->regs[DR_C] = from;
+	ChargeIntrinsic(dcpu, count);
+}
+
+static void SysSimNotify(Dcpu* dcpu, void* data)
+{
+	Vm* me = data;
+
+	me->notify = dcpu->regs[DR_B];
+	ChargeIntrinsic(dcpu, 0);
+}
+
+bool DcpuSim_Add(DcpuSim* me, Dcpu* dcpu)
+{
+	if(!Vector_Reserve(me->vms, me->vms.count + 1)) return false;
+
+	Vm* vm = calloc(1, sizeof(Vm));
+	if(!vm) return false;
+
+	vm->sim = me;
+	vm->dcpu = dcpu;
+	vm->id = me->vms.count;
+	vm->target = Dcpu_GetCycleCount(dcpu);
+	Vector_Init(vm->outbox, uint16_t);
+	Vector_Init(vm->inbox, uint16_t);
+
+	if(me->sharedWords){
+		vm->shared = Dcpu_MapDevice(dcpu, me->sharedStart, me->sharedCount, NULL, NULL, NULL);
+		if(!vm->shared){
+			free(vm);
+			return false;
+		}
+
+		// The first VM's words are where the shared range starts from
+		uint16_t* words = dcpu->ram + me->sharedStart;
+
+		if(vm->id == 0) memcpy(me->sharedWords, words, me->sharedCount * sizeof(uint16_t));
+		else{
+			memcpy(words, me->sharedWords, me->sharedCount * sizeof(uint16_t));
+			Dcpu_MarkDirty(dcpu, me->sharedStart, me->sharedCount);
+		}
+
+		DcpuDevice_ClearDirty(vm->shared);
+	}
+
+	if(!Dcpu_SetSysCall(dcpu, SysSimId, DCPU_SYS_SIM_ID, vm)
+		|| !Dcpu_SetSysCall(dcpu, SysSimSend, DCPU_SYS_SIM_SEND, vm)
+		|| !Dcpu_SetSysCall(dcpu, SysSimReceive, DCPU_SYS_SIM_RECEIVE, vm)
+		|| !Dcpu_SetSysCall(dcpu, SysSimNotify, DCPU_SYS_SIM_NOTIFY, vm)){
+		if(vm->shared) Dcpu_UnmapDevice(dcpu, &vm->shared);
+		free(vm);
+		return false;
+	}
+
+	// There's room, it was reserved above
+	Vector_Add(me->vms, vm);
+	return true;
+}
+
+bool DcpuSim_Interrupt(DcpuSim* me, int vm, uint16_t message)
+{
+	if(vm < 0 || vm >= me->vms.count) return false;
+
+	pthread_mutex_lock(&me->interruptLock);
+	HostInterrupt interrupt = { vm, me->interruptSeq++, message };
+	bool ok = Vector_Add(me->interrupts, interrupt);
+	pthread_mutex_unlock(&me->interruptLock);
+
+	return ok;
+}
+
+uint64_t DcpuSim_GetEpoch(DcpuSim* me)
+{
+	return me->epoch;
+}
+
+static void RunVm(DcpuSim* me, Vm* vm)
+{
+	vm->target += me->epochCycles;
+
+	while(!vm->exited && Dcpu_GetCycleCount(vm->dcpu) < vm->target){
+		DcpuStatus status = Dcpu_Execute(vm->dcpu, vm->target - Dcpu_GetCycleCount(vm->dcpu));
+		if(status == DCPU_EXITED) vm->exited = true;
+
+		// Suspended until the host resumes it at a barrier, it doesn't catch up
+		if(status == DCPU_WAITING){
+			vm->target = Dcpu_GetCycleCount(vm->dcpu);
+			break;
+		}
+	}
+}
+
+// A job for each thread: VMs are taken until none are left, which thread
+// runs which doesn't matter
+static void RunVms(void* data)
+{
+	DcpuSim* me = data;
+	int i;
+
+	while((i = __atomic_fetch_add(&me->nextVm, 1, __ATOMIC_RELAXED)) < me->vms.count) RunVm(me, me->vms.elems[i]);
+}
+
+// The words each VM wrote go to the shared range in order, a later VM's
+// over an earlier one's, and the range then to every VM
+static void MergeShared(DcpuSim* me)
+{
+	me->sharedRuns.count = 0;
+	bool all = false;  // out of memory for the runs, the whole range goes
+
+	VmPtr* it;
+	Vector_ForEach(me->vms, it){
+		Vm* vm = *it;
+		int from = me->sharedStart, start, end;
+
+		while(DcpuDevice_NextDirty(vm->shared, from, &start, &end)){
+			memcpy(me->sharedWords + start - me->sharedStart, vm->dcpu->ram + start, (end - start) * sizeof(uint16_t));
+
+			WordRun run = { start, end };
+			if(!Vector_Add(me->sharedRuns, run)) all = true;
+			from = end;
+		}
+	}
+
+	WordRun whole = { me->sharedStart, me->sharedStart + me->sharedCount };
+	WordRun* runs = all ? &whole : me->sharedRuns.elems;
+	int numRuns = all ? 1 : me->sharedRuns.count;
+
+	Vector_ForEach(me->vms, it){
+		Vm* vm = *it;
+
+		for(WordRun* run = runs; run < runs + numRuns; run++){
+			memcpy(vm->dcpu->ram + run->start, me->sharedWords + run->start - me->sharedStart, (run->end - run->start) * sizeof(uint16_t));
+			Dcpu_MarkDirty(vm->dcpu, run->start, run->end - run->start);
+		}
+
+		DcpuDevice_ClearDirty(vm->shared);
+	}
+}
+
+static void DeliverMessages(DcpuSim* me)
+{
+	VmPtr* it;
+
+	// What was received goes
+	Vector_ForEach(me->vms, it){
+		Vm* vm = *it;
+
+		memmove(vm->inbox.elems, vm->inbox.elems + vm->inboxRead, (vm->inbox.count - vm->inboxRead) * sizeof(uint16_t));
+		vm->inbox.count -= vm->inboxRead;
+		vm->inboxRead = 0;
+		vm->delivered = false;
+	}
+
+	Vector_ForEach(me->vms, it){
+		Vm* from = *it;
+
+		for(int i = 0; i < from->outbox.count; i += 2 + from->outbox.elems[i + 1]){
+			Vm* to = me->vms.elems[from->outbox.elems[i]];
+			uint16_t length = from->outbox.elems[i + 1];
+
+			// A full inbox drops it, as does running out of memory for it
+			if(to->inbox.count + 2 + length > DCPU_SIM_INBOX_WORDS || !Vector_Grow(to->inbox, 2 + length)) continue;
+
+			Vector_Add(to->inbox, from->id);
+			Vector_Add(to->inbox, length);
+			Vector_Append(to->inbox, from->outbox.elems + i + 2, length);
+			to->delivered = true;
+		}
+
+		from->outbox.count = 0;
+	}
+
+	Vector_ForEach(me->vms, it){
+		Vm* vm = *it;
+		if(vm->delivered && vm->notify && !Dcpu_Interrupt(vm->dcpu, vm->notify))
+			LogW("Interrupt queue of VM %d full, dropped: 0x%04x", vm->id, vm->notify);
+	}
+}
+
+static int CompareInterrupts(const void* a, const void* b)
+{
+	const HostInterrupt* x = a;
+	const HostInterrupt* y = b;
+
+	if(x->vm != y->vm) return x->vm < y->vm ? -1 : 1;
+	return x->seq < y->seq ? -1 : x->seq > y->seq;
+}
+
+static void RaiseInterrupts(DcpuSim* me)
+{
+	pthread_mutex_lock(&me->interruptLock);
+
+	qsort(me->interrupts.elems, me->interrupts.count, sizeof(HostInterrupt), CompareInterrupts);
+
+	HostInterrupt* it;
+	Vector_ForEach(me->interrupts, it){
+		if(!Dcpu_Interrupt(me->vms.elems[it->vm]->dcpu, it->message))
+			LogW("Interrupt queue of VM %d full, dropped: 0x%04x", it->vm, it->message);
+	}
+
+	me->interrupts.count = 0;
+	me->interruptSeq = 0;
+
+	pthread_mutex_unlock(&me->interruptLock);
+}
+
+static bool AnyRunning(DcpuSim* me)
+{
+	VmPtr* it;
+	Vector_ForEach(me->vms, it) if(!(*it)->exited) return true;
+	return false;
+}
+
+int DcpuSim_Run(DcpuSim* me, int epochs, void (*barrier)(DcpuSim* sim, void* data), void* data)
+{
+	int run = 0;
+
+	while(run < epochs && AnyRunning(me)){
+		me->nextVm = 0;
+
+		if(me->pool){
+			// The threads take VMs until none are left, if one can't be
+			// queued this thread takes them too
+			for(int i = 0; i < me->numThreads; i++){
+				if(!ThreadPool_Submit(me->pool, RunVms, me)){
+					RunVms(me);
+					break;
+				}
+			}
+			ThreadPool_Wait(me->pool);
+		}
+		else RunVms(me);
+
+		if(me->sharedWords) MergeShared(me);
+		DeliverMessages(me);
+		RaiseInterrupts(me);
+
+		me->epoch++;
+		run++;
+
+		if(barrier) barrier(me, data);
+	}
+
+	return run;
+}
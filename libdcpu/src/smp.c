@@ -0,0 +1,54 @@
+#include "common.h"
+#include "dcpui.h"
+
+// The syscalls for programs running on several cores (see Dcpu_CreateCore).
+//
+// What a program running on several cores can count on:
+//   - an instruction reads and writes each word whole, a core never sees half
+//     of another's write. Reading and writing a word (ADD [x], 1) isn't atomic,
+//     the memory intrinsics aren't either.
+//   - CAS is atomic and, like FENCE, a full barrier: every core sees the
+//     reads and writes before it done before those after it
+//   - other than that a core may see another's writes late, and in another
+//     order than they were made
+//
+// So a spinlock is taken with CAS 0 to 1, until it returns 0, and released
+// with FENCE and a write of 0.
+//
+// A core's own reads and writes are relaxed atomic loads and stores (see
+// SharedRam), CAS and FENCE add what those don't give: an atomic
+// read-modify-write and order.
+
+static void SysCompareAndSwap(Dcpu* me, void* data)
+{
+	uint16_t addr = me->regs[DR_A];
+	uint16_t old = me->regs[DR_B];
+
+	if(__atomic_compare_exchange_n(me->ram + addr, &old, me->regs[DR_C], false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+		Dcpu_MarkDirty(me, addr, 1);
+
+	me->regs[DR_A] = old;
+	ChargeIntrinsic(me, 1);
+}
+
+static void SysFence(Dcpu* me, void* data)
+{
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	ChargeIntrinsic(me, 0);
+}
+
+static void SysCore(Dcpu* me, void* data)
+{
+	me->regs[DR_A] = me->coreId;
+	me->regs[DR_B] = me->ramOwner ? me->ramOwner->numCores : me->numCores;
+	ChargeIntrinsic(me, 0);
+}
+
+bool InitSmp(Dcpu* me)
+{
+	me->numCores = 1;
+
+	return Dcpu_SetSysCall(me, SysCompareAndSwap, DCPU_SYS_CAS, NULL)
+		&& Dcpu_SetSysCall(me, SysFence, DCPU_SYS_FENCE, NULL)
+		&& Dcpu_SetSysCall(me, SysCore, DCPU_SYS_CORE, NULL);
+}
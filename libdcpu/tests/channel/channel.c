@@ -0,0 +1,155 @@
+// Two Dcpus talking over a channel, through the wrappers in libdcpu/lib/channel.dasm
+#include "test.h"
+
+#include <pthread.h>
+
+enum { DONE, SEND, RECEIVE, POLL, NOTIFY, SETUP, COUNT, MESSAGE };
+
+#define ID 1
+#define OUT 0x100   // the sender's words
+#define IN 0x200    // where the receiver puts them
+
+#define STREAM_WORDS 200000
+
+// Sends 0, 1, 2... in chunks of up to 7 words, while the receiver takes them
+// on another thread
+void* Sender(void* data)
+{
+	Dcpu* dcpu = data;
+	uint16_t* ram = Dcpu_GetRam(dcpu);
+
+	for(int sent = 0; sent < STREAM_WORDS;){
+		int count = STREAM_WORDS - sent < 7 ? STREAM_WORDS - sent : 1 + sent % 7;
+		for(int i = 0; i < count; i++) ram[OUT + i] = sent + i;
+		Dcpu_MarkDirty(dcpu, OUT, count);
+
+		if(Call(dcpu, SEND, ID, OUT, count) == count) sent += count;
+	}
+
+	return NULL;
+}
+
+int main(int argc, char** argv)
+{
+	DcpuImage* image = DcpuImage_Get(argv[1]);
+	CHECK(image);
+
+	Dcpu* sender = Dcpu_CreateFromImage(image);
+	Dcpu* receiver = Dcpu_CreateFromImage(image);
+	CHECK(sender && receiver);
+
+	uint16_t* out = Dcpu_GetRam(sender);
+	uint16_t* in = Dcpu_GetRam(receiver);
+
+	// Rounded up to 4 words
+	DcpuChannel* channel = DcpuChannel_Create(3);
+	CHECK(channel);
+	CHECK(Dcpu_AttachChannel(sender, ID, channel, true));
+	CHECK(Dcpu_AttachChannel(receiver, ID, channel, false));
+	CHECK(!Dcpu_AttachChannel(sender, DCPU_CHANNELS, channel, true));
+
+	// Only the end a Dcpu has, of a channel it has
+	CHECK(Call(sender, RECEIVE, ID, IN, 1) == 0xffff);
+	CHECK(Call(receiver, SEND, ID, OUT, 1) == 0xffff);
+	CHECK(Call(sender, POLL, ID + 1, 0, 0) == 0xffff);
+
+	// Empty
+	CHECK(Call(sender, POLL, ID, 0, 0) == 4);
+	CHECK(Call(receiver, POLL, ID, 0, 0) == 0);
+	CHECK(Call(receiver, RECEIVE, ID, IN, 4) == 0);
+
+	for(int i = 0; i < 6; i++) out[OUT + i] = 1 + i;
+	Dcpu_MarkDirty(sender, OUT, 6);
+
+	CHECK(Call(sender, SEND, ID, OUT, 3) == 3);
+	CHECK(Call(sender, POLL, ID, 0, 0) == 1);
+	CHECK(Call(receiver, POLL, ID, 0, 0) == 3);
+
+	// Full: a send that doesn't fit sends nothing
+	CHECK(Call(sender, SEND, ID, OUT + 3, 2) == 0);
+	CHECK(Call(receiver, POLL, ID, 0, 0) == 3);
+
+	CHECK(Call(receiver, RECEIVE, ID, IN, 2) == 2);
+	CHECK(in[IN] == 1 && in[IN + 1] == 2);
+
+	// Around the end of the ring, and filling it
+	CHECK(Call(sender, SEND, ID, OUT + 3, 3) == 3);
+	CHECK(Call(sender, POLL, ID, 0, 0) == 0);
+	CHECK(Call(receiver, RECEIVE, ID, IN, 8) == 4);
+	for(int i = 0; i < 4; i++) CHECK(in[IN + i] == 3 + i);
+	CHECK(Call(receiver, POLL, ID, 0, 0) == 0);
+
+	// Notified once when words come in, and again after the channel was emptied
+	Call(receiver, SETUP, 0, 0, 0);
+	uint16_t count = in[COUNT], message = in[MESSAGE];
+
+	Call(receiver, NOTIFY, ID, 0x42, 0);
+	CHECK(Call(sender, SEND, ID, OUT, 1) == 1);
+	CHECK(Call(sender, SEND, ID, OUT, 1) == 1);
+	Call(receiver, POLL, ID, 0, 0);
+	CHECK(in[count] == 1 && in[message] == 0x42);
+
+	CHECK(Call(receiver, RECEIVE, ID, IN, 1) == 1);
+	CHECK(Call(sender, SEND, ID, OUT, 1) == 1);
+	Call(receiver, POLL, ID, 0, 0);
+	CHECK(in[count] == 1);
+
+	CHECK(Call(receiver, RECEIVE, ID, IN, 4) == 2);
+	CHECK(Call(sender, SEND, ID, OUT, 1) == 1);
+	Call(receiver, POLL, ID, 0, 0);
+	CHECK(in[count] == 2);
+
+	// Words that are already waiting notify right away
+	Call(receiver, NOTIFY, ID, 0, 0);
+	Call(receiver, NOTIFY, ID, 0x43, 0);
+	Call(receiver, POLL, ID, 0, 0);
+	CHECK(in[count] == 3 && in[message] == 0x43);
+
+	// Turned off
+	CHECK(Call(receiver, RECEIVE, ID, IN, 4) == 1);
+	Call(receiver, NOTIFY, ID, 0, 0);
+	CHECK(Call(sender, SEND, ID, OUT, 1) == 1);
+	Call(receiver, POLL, ID, 0, 0);
+	CHECK(in[count] == 3);
+	CHECK(Call(receiver, RECEIVE, ID, IN, 4) == 1);
+
+	// A send to a detached receiver is kept and notifies nobody
+	Call(receiver, NOTIFY, ID, 0x44, 0);
+	Dcpu_DetachChannel(receiver, ID);
+	CHECK(Call(sender, SEND, ID, OUT, 2) == 2);
+	CHECK(Call(receiver, RECEIVE, ID, IN, 4) == 0xffff);
+	CHECK(Dcpu_AttachChannel(receiver, ID, channel, false));
+	CHECK(Call(receiver, RECEIVE, ID, IN, 4) == 2);
+	Call(receiver, POLL, ID, 0, 0);
+	CHECK(in[count] == 3);
+
+	Dcpu_DetachChannel(sender, ID);
+	Dcpu_DetachChannel(receiver, ID);
+	DcpuChannel_Destroy(&channel);
+
+	// A stream between two threads comes out whole and in order
+	channel = DcpuChannel_Create(64);
+	CHECK(channel);
+	CHECK(Dcpu_AttachChannel(sender, ID, channel, true));
+	CHECK(Dcpu_AttachChannel(receiver, ID, channel, false));
+
+	pthread_t thread;
+	CHECK(pthread_create(&thread, NULL, Sender, sender) == 0);
+
+	for(int received = 0; received < STREAM_WORDS;){
+		uint16_t got = Call(receiver, RECEIVE, ID, IN, 16);
+		for(int i = 0; i < got; i++) CHECK(in[IN + i] == (uint16_t)(received + i));
+		received += got;
+	}
+
+	pthread_join(thread, NULL);
+	CHECK(Call(receiver, POLL, ID, 0, 0) == 0);
+
+	Dcpu_Destroy(&sender);
+	Dcpu_Destroy(&receiver);
+	DcpuChannel_Destroy(&channel);
+	DcpuImage_Release(&image);
+
+	printf("ok\n");
+	return 0;
+}
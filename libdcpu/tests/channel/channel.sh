@@ -0,0 +1,10 @@
+#!/bin/bash
+echo " == Channels == "
+set -e
+rm -rf /tmp/libdcpu_channel
+mkdir -p /tmp/libdcpu_channel
+../../../dasm/dasm guest.dasm /tmp/libdcpu_channel/guest.dbin
+
+gcc -std=gnu99 -Wall -I.. -I../../include -I../../../common -o /tmp/libdcpu_channel/channel channel.c \
+	../../src/*.c ../../../common/common.c ../../../common/ramio.c ../../../common/threadpool.c -lpthread
+/tmp/libdcpu_channel/channel /tmp/libdcpu_channel/guest.dbin
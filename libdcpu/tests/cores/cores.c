@@ -0,0 +1,85 @@
+// Cores sharing one RAM: each sees the others' words whole and in the order
+// they were written, locks built on CAS count right, and the words an
+// instruction writes are stored back and marked dirty
+#include "test.h"
+#include "dcpui.h"
+
+#include <pthread.h>
+
+enum { DONE, COUNTED, PUBLISH, WATCH, IAG, TOTAL, SEQ, GOT, MUTEX };
+
+#define NUM_CORES 4
+#define COUNT 5000
+#define SEQ_END 0xfff0
+
+typedef struct {
+	Dcpu* dcpu;
+	int routine;
+	uint16_t a;
+	uint16_t result;
+} Run;
+
+static void* Thread(void* data)
+{
+	Run* r = data;
+	r->result = Call(r->dcpu, r->routine, r->a, 0, 0);
+	return NULL;
+}
+
+static void RunAll(Run* runs, int count)
+{
+	pthread_t threads[count];
+	for(int i = 0; i < count; i++) CHECK(!pthread_create(threads + i, NULL, Thread, runs + i));
+	for(int i = 0; i < count; i++) pthread_join(threads[i], NULL);
+}
+
+int main(int argc, char** argv)
+{
+	DcpuImage* image = DcpuImage_Get(argv[1]);
+	CHECK(image);
+
+	Dcpu* cores[NUM_CORES];
+	cores[0] = Dcpu_CreateFromImage(image);
+	CHECK(cores[0]);
+
+	for(int i = 1; i < NUM_CORES; i++){
+		cores[i] = Dcpu_CreateCore(i == 1 ? cores[0] : cores[i - 1]);
+		CHECK(cores[i]);
+		CHECK(Dcpu_GetRam(cores[i]) == Dcpu_GetRam(cores[0]));
+	}
+
+	// A stack each
+	for(int i = 0; i < NUM_CORES; i++) Dcpu_SetRegister(cores[i], DR_SP, 0x10000 - 0x100 * i);
+
+	// Each adds COUNT under the lock
+	Run runs[NUM_CORES];
+	for(int i = 0; i < NUM_CORES; i++) runs[i] = (Run){ cores[i], COUNTED, COUNT };
+	RunAll(runs, NUM_CORES);
+
+	uint16_t* ram = Dcpu_GetRam(cores[0]);
+	CHECK(ram[ram[TOTAL]] == NUM_CORES * COUNT);
+	CHECK(ram[ram[MUTEX]] == 0);
+
+	// One writes a sequence, the others never see it go back
+	runs[0] = (Run){ cores[0], PUBLISH, SEQ_END };
+	for(int i = 1; i < NUM_CORES; i++) runs[i] = (Run){ cores[i], WATCH, SEQ_END };
+	RunAll(runs, NUM_CORES);
+
+	for(int i = 1; i < NUM_CORES; i++) CHECK(runs[i].result == 0);
+	CHECK(ram[ram[SEQ]] == SEQ_END);
+
+	// IAG's operand is stored back, and dirty on the core that wrote it
+	for(int i = 0; i < NUM_CORES; i++) cores[i]->dirty = 0;
+	Call(cores[2], IAG, 0x1357, 0, 0);
+
+	uint16_t got = ram[GOT];
+	CHECK(ram[got] == 0x1357);
+	CHECK(cores[2]->dirty & 1u << (got >> DIRTY_PAGE_SHIFT));
+	CHECK(!cores[1]->dirty);
+
+	for(int i = NUM_CORES - 1; i >= 0; i--) Dcpu_Destroy(cores + i);
+	DcpuImage_Release(&image);
+
+	printf("ok\n");
+	return 0;
+}
@@ -0,0 +1,10 @@
+#!/bin/bash
+echo " == Cores == "
+set -e
+rm -rf /tmp/libdcpu_cores
+mkdir -p /tmp/libdcpu_cores
+../../../dasm/dasm guest.dasm /tmp/libdcpu_cores/guest.dbin
+
+gcc -std=gnu99 -Wall -I.. -I../../include -I../../src -I../../../common -o /tmp/libdcpu_cores/cores cores.c \
+	../../src/*.c ../../../common/common.c ../../../common/ramio.c ../../../common/threadpool.c -lpthread
+timeout 60 /tmp/libdcpu_cores/cores /tmp/libdcpu_cores/guest.dbin
@@ -0,0 +1,132 @@
+// A device with read and write hooks: the words the program reads and writes
+// on it, with instructions, the stack and the memory intrinsics, reach it
+#include "test.h"
+
+enum { DONE, STORE, LOAD, PUSHPOP, CALL, MEMCPY, MEMSET, MEMCMP, STRLEN };
+
+#define START 0x8000
+#define WORDS 32
+
+// Reads of MAGIC_AT give MAGIC, the others what's in the RAM
+#define MAGIC_AT (START + 2)
+#define MAGIC 0xbeef
+
+typedef struct {
+	int reads[WORDS];
+	int writes[WORDS];
+	uint16_t written[WORDS];
+} Device;
+
+static uint16_t Read(Dcpu* dcpu, uint16_t addr, void* data)
+{
+	Device* d = data;
+	d->reads[addr - START]++;
+	return addr == MAGIC_AT ? MAGIC : Dcpu_GetRam(dcpu)[addr];
+}
+
+static void Write(Dcpu* dcpu, uint16_t addr, uint16_t value, void* data)
+{
+	Device* d = data;
+	d->writes[addr - START]++;
+	d->written[addr - START] = value;
+}
+
+// The words from START + from to START + to, and only those, were written
+// once each, and are dirty
+static void CheckWritten(Device* d, DcpuDevice* device, int from, int to)
+{
+	for(int i = 0; i < WORDS; i++) CHECK(d->writes[i] == (i >= from && i < to));
+
+	int start, end;
+	CHECK(DcpuDevice_NextDirty(device, 0, &start, &end));
+	CHECK(start == START + from && end == START + to);
+	CHECK(!DcpuDevice_NextDirty(device, end, &start, &end));
+
+	memset(d->writes, 0, sizeof(d->writes));
+	DcpuDevice_ClearDirty(device);
+}
+
+int main(int argc, char** argv)
+{
+	DcpuImage* image = DcpuImage_Get(argv[1]);
+	CHECK(image);
+
+	Dcpu* dcpu = Dcpu_CreateFromImage(image);
+	CHECK(dcpu);
+	uint16_t* ram = Dcpu_GetRam(dcpu);
+
+	Device d;
+	memset(&d, 0, sizeof(d));
+	DcpuDevice* device = Dcpu_MapDevice(dcpu, START, WORDS, Read, Write, &d);
+	CHECK(device);
+	CHECK(!Dcpu_MapDevice(dcpu, 0xfff0, 17, Read, Write, &d));
+
+	// SET
+	Call(dcpu, STORE, START + 1, 0x1234, 0);
+	CHECK(ram[START + 1] == 0x1234 && d.written[1] == 0x1234);
+	CheckWritten(&d, device, 1, 2);
+
+	CHECK(Call(dcpu, LOAD, MAGIC_AT, 0, 0) == MAGIC);
+	CHECK(d.reads[2] == 1);
+
+	// PUSH and POP, and the return address of JSR
+	CHECK(Call(dcpu, PUSHPOP, START + 6, 0x5678, 0) == 0x5678);
+	CHECK(d.written[5] == 0x5678 && d.reads[5] == 1);
+	CheckWritten(&d, device, 5, 6);
+
+	Call(dcpu, CALL, START + 8, 0, 0);
+	CHECK(d.reads[7] == 1);
+	CheckWritten(&d, device, 7, 8);
+
+	// The host's pushes and pops
+	uint16_t sp = Dcpu_GetRegister(dcpu, DR_SP);
+	Dcpu_SetRegister(dcpu, DR_SP, START + 10);
+	Dcpu_Push(dcpu, 0x4321);
+	CHECK(Dcpu_Pop(dcpu) == 0x4321 && d.reads[9] == 1 && d.written[9] == 0x4321);
+	CheckWritten(&d, device, 9, 10);
+	Dcpu_SetRegister(dcpu, DR_SP, sp);
+
+	// The intrinsics write word by word, and read through the hooks
+	Call(dcpu, MEMSET, START + 12, 0x7777, 4);
+	for(int i = 12; i < 16; i++) CHECK(d.written[i] == 0x7777);
+	CheckWritten(&d, device, 12, 16);
+
+	ram[0x100] = 0xaaaa;
+	ram[0x101] = 0xbbbb;
+	Dcpu_MarkDirty(dcpu, 0x100, 2);
+	Call(dcpu, MEMCPY, START + 20, 0x100, 2);
+	CHECK(d.written[20] == 0xaaaa && d.written[21] == 0xbbbb);
+	CheckWritten(&d, device, 20, 22);
+
+	// Overlapping, within the device
+	Call(dcpu, MEMCPY, START + 21, START + 20, 2);
+	CHECK(ram[START + 21] == 0xaaaa && ram[START + 22] == 0xbbbb);
+	CheckWritten(&d, device, 21, 23);
+
+	Call(dcpu, MEMCPY, 0x200, MAGIC_AT, 1);
+	CHECK(ram[0x200] == MAGIC);
+
+	ram[0x300] = MAGIC;
+	Dcpu_MarkDirty(dcpu, 0x300, 1);
+	int reads = d.reads[2];
+	CHECK(Call(dcpu, MEMCMP, MAGIC_AT, 0x300, 1) == 0);
+	CHECK(d.reads[2] == reads + 1);
+
+	ram[MAGIC_AT + 1] = 0;
+	CHECK(Call(dcpu, STRLEN, MAGIC_AT, 0, 0) == 1);
+	CHECK(d.reads[2] == reads + 2 && d.reads[3] == 1);
+
+	// Nothing reaches it once it's unmapped
+	Dcpu_UnmapDevice(dcpu, &device);
+	memset(&d, 0, sizeof(d));
+	Call(dcpu, STORE, START + 1, 0x1111, 0);
+	Call(dcpu, MEMSET, START, 0, WORDS);
+	CHECK(Call(dcpu, LOAD, MAGIC_AT, 0, 0) == 0);
+	for(int i = 0; i < WORDS; i++) CHECK(!d.reads[i] && !d.writes[i]);
+
+	Dcpu_Destroy(&dcpu);
+	DcpuImage_Release(&image);
+
+	printf("ok\n");
+	return 0;
+}
@@ -0,0 +1,10 @@
+#!/bin/bash
+echo " == Devices == "
+set -e
+rm -rf /tmp/libdcpu_device
+mkdir -p /tmp/libdcpu_device
+../../../dasm/dasm guest.dasm /tmp/libdcpu_device/guest.dbin
+
+gcc -std=gnu99 -Wall -I.. -I../../include -I../../../common -o /tmp/libdcpu_device/device device.c \
+	../../src/*.c ../../../common/common.c ../../../common/ramio.c ../../../common/threadpool.c -lpthread
+/tmp/libdcpu_device/device /tmp/libdcpu_device/guest.dbin
@@ -0,0 +1,124 @@
+// Cycle-timed events: when they fire, and callbacks that arm them again
+#include "test.h"
+
+enum { DONE, BUSY, IDLE };
+
+// Fired events are late by at most what's left of the instruction that
+// passed their cycle
+#define MAX_LATE 4
+
+typedef struct {
+	DcpuEvent* event;
+	uint64_t due;
+	uint64_t period;   // armed again this many cycles later, 0 for not
+	int fired;
+	bool late;
+} Timer;
+
+static void Fire(Dcpu* dcpu, void* data)
+{
+	Timer* t = data;
+	uint64_t now = Dcpu_GetCycleCount(dcpu);
+
+	if(now < t->due || now > t->due + MAX_LATE) t->late = true;
+	t->fired++;
+
+	if(t->period){
+		t->due += t->period;
+		Dcpu_ScheduleEvent(dcpu, t->event, t->due);
+	}
+}
+
+// Arms itself again for the cycle it fired at, or one before
+static int loopFired;
+static uint64_t loopLast;
+
+static void FireLoop(Dcpu* dcpu, void* data)
+{
+	DcpuEvent* event = *(DcpuEvent**)data;
+	uint64_t now = Dcpu_GetCycleCount(dcpu);
+
+	// Never twice on one cycle
+	CHECK(loopFired == 0 || now > loopLast);
+	loopFired++;
+	loopLast = now;
+
+	Dcpu_ScheduleEvent(dcpu, event, now - (loopFired % 2));
+}
+
+static void Start(Dcpu* dcpu, int entry)
+{
+	Dcpu_SetRegister(dcpu, DR_PC, Dcpu_GetRam(dcpu)[entry]);
+}
+
+int main(int argc, char** argv)
+{
+	DcpuImage* image = DcpuImage_Get(argv[1]);
+	CHECK(image);
+
+	Dcpu* dcpu = Dcpu_CreateFromImage(image);
+	CHECK(dcpu);
+
+	// A timer every 100 cycles, and one that fires once
+	Timer periodic = { .due = 100, .period = 100 }, once = { .due = 2500 };
+	periodic.event = Dcpu_AddEvent(dcpu, Fire, &periodic);
+	once.event = Dcpu_AddEvent(dcpu, Fire, &once);
+	CHECK(periodic.event && once.event);
+
+	Dcpu_ScheduleEvent(dcpu, periodic.event, periodic.due);
+	Dcpu_ScheduleEvent(dcpu, once.event, once.due);
+	CHECK(DcpuEvent_IsArmed(once.event));
+
+	Start(dcpu, BUSY);
+	for(int i = 0; i < 100; i++) CHECK(Dcpu_Execute(dcpu, 1 + i * 7 % 150) == DCPU_RUNNING);
+
+	uint64_t cycles = Dcpu_GetCycleCount(dcpu);
+	// One due when Execute returned fires on the next
+	CHECK(periodic.fired == periodic.due / 100 - 1 && !periodic.late);
+	CHECK(periodic.due + MAX_LATE >= cycles && periodic.due <= cycles + 100);
+	CHECK(once.fired == 1 && !once.late && !DcpuEvent_IsArmed(once.event));
+
+	// Cancelled and moved
+	periodic.period = 0;
+	Dcpu_CancelEvent(dcpu, periodic.event);
+	once.due = cycles + 500;
+	Dcpu_ScheduleEvent(dcpu, once.event, cycles + 50);
+	Dcpu_ScheduleEvent(dcpu, once.event, once.due);
+	Dcpu_Execute(dcpu, 1000);
+	CHECK(periodic.fired == periodic.due / 100 - 1);
+	CHECK(once.fired == 2 && !once.late);
+
+	// Armed again by its callback for the current cycle, or one that passed:
+	// it fires on the next cycle, and Execute returns
+	DcpuEvent* loop = Dcpu_AddEvent(dcpu, FireLoop, &loop);
+	CHECK(loop);
+	Dcpu_ScheduleEvent(dcpu, loop, Dcpu_GetCycleCount(dcpu));
+
+	cycles = Dcpu_GetCycleCount(dcpu);
+	CHECK(Dcpu_Execute(dcpu, 1000) == DCPU_RUNNING);
+	CHECK(loopFired > 0 && loopFired <= Dcpu_GetCycleCount(dcpu) - cycles + 1);
+	Dcpu_RemoveEvent(dcpu, &loop);
+
+	// An idle program skips ahead to the next event
+	Start(dcpu, IDLE);
+	once.due = Dcpu_GetCycleCount(dcpu) + 50000;
+	Dcpu_ScheduleEvent(dcpu, once.event, once.due);
+	while(once.fired == 2) CHECK(Dcpu_Execute(dcpu, 100000) != DCPU_EXITED);
+	CHECK(once.fired == 3 && !once.late);
+
+	// And is idle without events
+	CHECK(Dcpu_Execute(dcpu, 1000) == DCPU_IDLE);
+
+	// Reset disarms them
+	Dcpu_ScheduleEvent(dcpu, once.event, Dcpu_GetCycleCount(dcpu) + 10);
+	Dcpu_Reset(dcpu);
+	CHECK(!DcpuEvent_IsArmed(once.event) && Dcpu_GetCycleCount(dcpu) == 0);
+
+	Dcpu_RemoveEvent(dcpu, &periodic.event);
+	Dcpu_RemoveEvent(dcpu, &once.event);
+	Dcpu_Destroy(&dcpu);
+	DcpuImage_Release(&image);
+
+	printf("ok\n");
+	return 0;
+}
@@ -0,0 +1,10 @@
+#!/bin/bash
+echo " == Events == "
+set -e
+rm -rf /tmp/libdcpu_events
+mkdir -p /tmp/libdcpu_events
+../../../dasm/dasm guest.dasm /tmp/libdcpu_events/guest.dbin
+
+gcc -std=gnu99 -Wall -I.. -I../../include -I../../../common -o /tmp/libdcpu_events/events events.c \
+	../../src/*.c ../../../common/common.c ../../../common/ramio.c ../../../common/threadpool.c -lpthread
+timeout 10 /tmp/libdcpu_events/events /tmp/libdcpu_events/guest.dbin
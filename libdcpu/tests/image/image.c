@@ -0,0 +1,62 @@
+// Dcpus made from one image share its pages: a page is copied only for the
+// Dcpu that writes to it, and the others keep seeing the image
+#include "test.h"
+
+#include <unistd.h>
+
+#define RAM_WORDS 0x10000
+
+// In the image's only page, and in a page it has no words in
+#define PROGRAM_WORD 1
+#define ZERO_WORD 0x8000
+
+int main(int argc, char** argv)
+{
+	DcpuImage* image = DcpuImage_Get(argv[1]);
+	CHECK(image);
+
+	Dcpu* a = Dcpu_CreateFromImage(image);
+	Dcpu* b = Dcpu_CreateFromImage(image);
+	CHECK(a && b);
+
+	uint16_t* ramA = Dcpu_GetRam(a);
+	uint16_t* ramB = Dcpu_GetRam(b);
+	CHECK(ramA != ramB);
+
+	// Reading all of both RAMs brings every page in
+	static uint16_t before[RAM_WORDS];
+	memcpy(before, ramB, sizeof(before));
+	CHECK(!memcmp(ramA, before, sizeof(before)));
+	CHECK(before[PROGRAM_WORD] == 0x8020 && before[ZERO_WORD] == 0);
+
+	ramA[PROGRAM_WORD] = 0xaaaa;
+	ramA[ZERO_WORD] = 0xbbbb;
+
+	// B, and the image, are as they were
+	CHECK(!memcmp(ramB, before, sizeof(before)));
+	CHECK(ramA[PROGRAM_WORD] == 0xaaaa && ramA[ZERO_WORD] == 0xbbbb);
+
+	uint16_t* mapped = DcpuImage_Map(image);
+	CHECK(mapped);
+	CHECK(!memcmp(mapped, before, sizeof(before)));
+	DcpuImage_Unmap(image, mapped);
+
+	// Everything was read, only the two pages written are A's own
+	int pages = RAM_WORDS * sizeof(uint16_t) / sysconf(_SC_PAGESIZE);
+	int resident, shared;
+
+	if(Dcpu_GetRamPages(a, &resident, &shared)){
+		CHECK(resident == pages && shared == pages - 2);
+
+		CHECK(Dcpu_GetRamPages(b, &resident, &shared));
+		CHECK(resident == pages && shared == pages);
+	}
+	else printf("can't read /proc/self/pagemap, not checking the pages\n");
+
+	Dcpu_Destroy(&a);
+	Dcpu_Destroy(&b);
+	DcpuImage_Release(&image);
+
+	printf("ok\n");
+	return 0;
+}
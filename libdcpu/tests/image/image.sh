@@ -0,0 +1,10 @@
+#!/bin/bash
+echo " == Shared images == "
+set -e
+rm -rf /tmp/libdcpu_image
+mkdir -p /tmp/libdcpu_image
+../../../dasm/dasm guest.dasm /tmp/libdcpu_image/guest.dbin
+
+gcc -std=gnu99 -Wall -I.. -I../../include -I../../../common -o /tmp/libdcpu_image/image image.c \
+	../../src/*.c ../../../common/common.c ../../../common/ramio.c ../../../common/threadpool.c -lpthread
+/tmp/libdcpu_image/image /tmp/libdcpu_image/guest.dbin
@@ -0,0 +1,102 @@
+// Interrupts raised from host threads at a running Dcpu: none are lost or
+// taken twice, each thread's come in the order it raised them, a full queue
+// says so, and IAQ holds them back
+#include "test.h"
+
+#include <pthread.h>
+#include <sched.h>
+
+enum { DONE, SETUP, QUEUE, BUSY, COUNT };
+
+#define SEEN 0x4000   // how many times each message was taken
+#define LOG 0x8000    // the messages in the order they were taken
+
+#define THREADS 4
+#define PER_THREAD 2000
+
+typedef struct {
+	Dcpu* dcpu;
+	int thread;
+	int full;   // times the queue was full
+} Producer;
+
+// Raises 1 + thread * PER_THREAD... until each has gone in
+void* Produce(void* data)
+{
+	Producer* p = data;
+
+	for(int i = 0; i < PER_THREAD; i++){
+		while(!Dcpu_Interrupt(p->dcpu, 1 + p->thread * PER_THREAD + i)){
+			p->full++;
+			sched_yield();
+		}
+	}
+
+	return NULL;
+}
+
+int main(int argc, char** argv)
+{
+	DcpuImage* image = DcpuImage_Get(argv[1]);
+	CHECK(image);
+
+	Dcpu* dcpu = Dcpu_CreateFromImage(image);
+	CHECK(dcpu);
+	uint16_t* ram = Dcpu_GetRam(dcpu);
+	uint16_t count = ram[COUNT];
+
+	Call(dcpu, SETUP, 0, 0, 0);
+
+	// Held back by IAQ 1, the queue takes 256
+	const int first = 1 + THREADS * PER_THREAD;
+	Call(dcpu, QUEUE, 1, 0, 0);
+	for(int i = 0; i < 256; i++) CHECK(Dcpu_Interrupt(dcpu, first + i));
+	CHECK(!Dcpu_Interrupt(dcpu, first + 256));
+
+	Dcpu_SetRegister(dcpu, DR_PC, ram[BUSY]);
+	CHECK(Dcpu_Execute(dcpu, 1000) == DCPU_RUNNING);
+	CHECK(ram[count] == 0);
+
+	// And taken in order once it's let go
+	Call(dcpu, QUEUE, 0, 0, 0);
+	CHECK(ram[count] == 256);
+	for(int i = 0; i < 256; i++) CHECK(ram[LOG + i] == first + i);
+
+	// Raised from threads while the cpu runs
+	Producer producers[THREADS];
+	pthread_t threads[THREADS];
+
+	for(int t = 0; t < THREADS; t++){
+		producers[t] = (Producer){ dcpu, t, 0 };
+		CHECK(pthread_create(threads + t, NULL, Produce, producers + t) == 0);
+	}
+
+	Dcpu_SetRegister(dcpu, DR_PC, ram[BUSY]);
+	while(ram[count] < 256 + THREADS * PER_THREAD) CHECK(Dcpu_Execute(dcpu, 1000) == DCPU_RUNNING);
+
+	int full = 0;
+	for(int t = 0; t < THREADS; t++){
+		pthread_join(threads[t], NULL);
+		full += producers[t].full;
+	}
+
+	CHECK(Dcpu_Execute(dcpu, 1000) == DCPU_RUNNING);
+	CHECK(ram[count] == 256 + THREADS * PER_THREAD);
+
+	for(int m = 1; m < first + 256; m++) CHECK(ram[SEEN + m] == 1);
+
+	int next[THREADS] = {0};
+	for(int i = 256; i < ram[count]; i++){
+		int m = ram[LOG + i] - 1, t = m / PER_THREAD;
+		CHECK(m % PER_THREAD == next[t]);
+		next[t]++;
+	}
+
+	LogV("the queue was full %d times", full);
+
+	Dcpu_Destroy(&dcpu);
+	DcpuImage_Release(&image);
+
+	printf("ok\n");
+	return 0;
+}
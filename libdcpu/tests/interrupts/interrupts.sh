@@ -0,0 +1,10 @@
+#!/bin/bash
+echo " == Interrupts == "
+set -e
+rm -rf /tmp/libdcpu_interrupts
+mkdir -p /tmp/libdcpu_interrupts
+../../../dasm/dasm guest.dasm /tmp/libdcpu_interrupts/guest.dbin
+
+gcc -std=gnu99 -Wall -I.. -I../../include -I../../../common -o /tmp/libdcpu_interrupts/interrupts interrupts.c \
+	../../src/*.c ../../../common/common.c ../../../common/ramio.c ../../../common/threadpool.c -lpthread
+timeout 60 /tmp/libdcpu_interrupts/interrupts /tmp/libdcpu_interrupts/guest.dbin
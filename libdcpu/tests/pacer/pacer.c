@@ -0,0 +1,114 @@
+// Dcpus paced in real time: they hold their clock rates, and each batch runs
+// when the Dcpu is due, in the order they're due
+#include "test.h"
+
+#include <time.h>
+
+enum { DONE, BUSY };
+
+#define NS 1000000000LL
+#define MS 1000000LL
+
+#define RUN_NS (1000 * MS)
+
+// The rate may be off by what a batch runs ahead, at most 16 ms, and what
+// the clock and the scheduler add
+#define RATE_TOLERANCE 0.03
+
+// A batch may run a tick (0.25 ms) before the Dcpu is due, and later by
+// however late the thread wakes up. Batches are in the order the Dcpus were
+// due, to within a tick and the difference in their start times.
+#define EARLY_NS (MS / 4)
+#define LATE_NS (50 * MS)
+#define ORDER_NS (MS / 2)
+
+typedef struct {
+	Dcpu* dcpu;
+	int hz;
+	int64_t start;    // at most the pacer's start for it
+	uint64_t cycles;  // run by the last batch
+	int batches;
+} Paced;
+
+#define NUM_PACED 4
+static Paced paced[NUM_PACED];
+
+static int64_t lastDue;
+static int early, late, unordered;
+
+static int64_t Now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * NS + ts.tv_nsec;
+}
+
+// After each batch: when it was due, going by the cycles before it
+static bool Status(Dcpu* dcpu, DcpuStatus status, void* data)
+{
+	Paced* p = data;
+	int64_t now = Now();
+	int64_t due = p->start + (int64_t)(p->cycles * NS / p->hz);
+
+	if(now < due - EARLY_NS) early++;
+	if(now > due + LATE_NS) late++;
+	if(due < lastDue - ORDER_NS) unordered++;
+
+	lastDue = due;
+	p->cycles = Dcpu_GetCycleCount(dcpu);
+	p->batches++;
+
+	return now - p->start < RUN_NS;
+}
+
+int main(int argc, char** argv)
+{
+	DcpuImage* image = DcpuImage_Get(argv[1]);
+	CHECK(image);
+
+	DcpuPacer* pacer = DcpuPacer_Create();
+	CHECK(pacer);
+
+	const int rates[NUM_PACED] = { 100000, 250000, 50000, 1000000 };
+
+	for(int i = 0; i < NUM_PACED; i++){
+		Paced* p = paced + i;
+		p->dcpu = Dcpu_CreateFromImage(image);
+		CHECK(p->dcpu);
+		p->hz = rates[i];
+		p->start = Now();
+
+		Dcpu_SetRegister(p->dcpu, DR_PC, Dcpu_GetRam(p->dcpu)[BUSY]);
+		CHECK(DcpuPacer_Add(pacer, p->dcpu, p->hz, Status, p));
+	}
+
+	// One that exits right away leaves on its own
+	Dcpu* exits = Dcpu_CreateFromImage(image);
+	CHECK(exits);
+	CHECK(DcpuPacer_Add(pacer, exits, 1000, NULL, NULL));
+
+	DcpuPacer_Run(pacer);
+	CHECK(Dcpu_GetExit(exits));
+
+	for(int i = 0; i < NUM_PACED; i++){
+		Paced* p = paced + i;
+		double expected = (double)p->hz * RUN_NS / NS;
+		double rate = Dcpu_GetCycleCount(p->dcpu) / expected;
+
+		LogV("%d Hz: %.4f of the rate in %d batches", p->hz, rate, p->batches);
+		CHECK(rate > 1 - RATE_TOLERANCE && rate < 1 + RATE_TOLERANCE);
+		CHECK(p->batches > 50);
+
+		Dcpu_Destroy(&p->dcpu);
+	}
+
+	LogV("%d early, %d late and %d out of order", early, late, unordered);
+	CHECK(!early && !late && !unordered);
+
+	DcpuPacer_Destroy(&pacer);
+	Dcpu_Destroy(&exits);
+	DcpuImage_Release(&image);
+
+	printf("ok\n");
+	return 0;
+}
@@ -0,0 +1,10 @@
+#!/bin/bash
+echo " == Pacer == "
+set -e
+rm -rf /tmp/libdcpu_pacer
+mkdir -p /tmp/libdcpu_pacer
+../../../dasm/dasm guest.dasm /tmp/libdcpu_pacer/guest.dbin
+
+gcc -std=gnu99 -Wall -I.. -I../../include -I../../../common -o /tmp/libdcpu_pacer/pacer pacer.c \
+	../../src/*.c ../../../common/common.c ../../../common/ramio.c ../../../common/threadpool.c -lpthread
+/tmp/libdcpu_pacer/pacer /tmp/libdcpu_pacer/guest.dbin
@@ -0,0 +1,166 @@
+// Dcpu_Reset puts a Dcpu back the way it was created, and the pool hands out
+// reset Dcpus
+#include "test.h"
+#include "dcpui.h"
+
+#include <pthread.h>
+
+enum { DONE, SCRIBBLE, ANSWER };
+
+// The pages scribble writes: the program's, 0x1000 to 0x3fff, 0xf123 and the stack
+#define SCRIBBLED (1u << 0 | 0xfcu | 1u << 30 | 1u << 31)
+
+#define THREADS 8
+#define ROUNDS 2000
+
+static const char* program;
+
+// The same RAM, registers and cycle count as fresh, and no pages dirty
+static void CheckClean(Dcpu* dcpu, Dcpu* fresh)
+{
+	CHECK(!memcmp(Dcpu_GetRam(dcpu), Dcpu_GetRam(fresh), RAM_SIZE));
+	for(int r = DR_A; r <= DR_O; r++) CHECK(Dcpu_GetRegister(dcpu, r) == Dcpu_GetRegister(fresh, r));
+	CHECK(Dcpu_GetCycleCount(dcpu) == 0);
+	CHECK(dcpu->dirty == 0 && fresh->dirty == 0);
+}
+
+static void Scribble(Dcpu* dcpu)
+{
+	Call(dcpu, SCRIBBLE, 0, 0, 0);
+	CHECK(dcpu->dirty == SCRIBBLED);
+	CHECK(Dcpu_GetRegister(dcpu, DR_Y) == 0x7777 && Dcpu_GetRegister(dcpu, DR_O) == 1);
+}
+
+// Loads the program into a Dcpu with zeroed RAM
+static void Load(Dcpu* dcpu)
+{
+	int words = LoadImage(Dcpu_GetRam(dcpu), program, NULL, NULL);
+	CHECK(words > 0);
+	Dcpu_MarkDirty(dcpu, 0, words);
+}
+
+static int setups;
+
+static void Answer(Dcpu* dcpu, void* data)
+{
+	Dcpu_SetRegister(dcpu, DR_A, 42);
+}
+
+static void Setup(Dcpu* dcpu, void* data)
+{
+	__atomic_add_fetch(&setups, 1, __ATOMIC_RELAXED);
+	CHECK(Dcpu_SetSysCall(dcpu, Answer, 5, NULL));
+}
+
+// Takes Dcpus from the pool, checks that they're clean and dirties them
+static void* UsePool(void* data)
+{
+	DcpuPool* pool = data;
+
+	for(int i = 0; i < ROUNDS; i++){
+		Dcpu* dcpu = DcpuPool_Acquire(pool);
+		CHECK(dcpu);
+
+		uint16_t* ram = Dcpu_GetRam(dcpu);
+		CHECK(dcpu->dirty == 0 && Dcpu_GetRegister(dcpu, DR_Y) == 0);
+		CHECK(ram[0x1000] == 0 && ram[0xf123] == 0 && ram[ram[SCRIBBLE]] != 0xaaaa);
+
+		Scribble(dcpu);
+		DcpuPool_Release(pool, dcpu);
+	}
+
+	return NULL;
+}
+
+int main(int argc, char** argv)
+{
+	program = argv[1];
+
+	DcpuImage* image = DcpuImage_Get(program);
+	CHECK(image);
+
+	// From an image: written pages are dropped and are the image's again
+	Dcpu* fresh = Dcpu_CreateFromImage(image);
+	Dcpu* dcpu = Dcpu_CreateFromImage(image);
+	CHECK(fresh && dcpu);
+
+	Scribble(dcpu);
+	Dcpu_Reset(dcpu);
+	CheckClean(dcpu, fresh);
+
+	int resident, shared;
+	if(Dcpu_GetRamPages(dcpu, &resident, &shared)) CHECK(resident == shared);
+	else printf("can't read /proc/self/pagemap, not checking the pages\n");
+
+	// And again, the same way
+	Scribble(dcpu);
+	Dcpu_Reset(dcpu);
+	CheckClean(dcpu, fresh);
+
+	Dcpu_Destroy(&dcpu);
+	Dcpu_Destroy(&fresh);
+
+	// With zeroed RAM: written pages are zeroed
+	fresh = Dcpu_Create();
+	dcpu = Dcpu_Create();
+	CHECK(fresh && dcpu);
+
+	Load(dcpu);
+	Scribble(dcpu);
+	Dcpu_Reset(dcpu);
+	CheckClean(dcpu, fresh);
+
+	Dcpu_Destroy(&dcpu);
+	Dcpu_Destroy(&fresh);
+
+	// A pool hands out the Dcpu given back last, reset, with the syscalls of its setup
+	fresh = Dcpu_CreateFromImage(image);
+	DcpuPool* pool = DcpuPool_Create(image, Setup, NULL);
+	CHECK(fresh && pool);
+	CHECK(DcpuPool_Fill(pool, 2) && setups == 2);
+
+	Dcpu* a = DcpuPool_Acquire(pool);
+	Dcpu* b = DcpuPool_Acquire(pool);
+	Dcpu* c = DcpuPool_Acquire(pool);
+	CHECK(a && b && c && a != b && b != c && setups == 3);
+
+	Scribble(a);
+	DcpuPool_Release(pool, a);
+	CHECK(DcpuPool_Acquire(pool) == a);
+	CheckClean(a, fresh);
+	CHECK(Call(a, ANSWER, 0, 0, 0) == 42);
+
+	DcpuPool_Release(pool, a);
+	DcpuPool_Release(pool, b);
+	DcpuPool_Release(pool, c);
+
+	// Used from many threads at once
+	pthread_t threads[THREADS];
+	for(int i = 0; i < THREADS; i++) CHECK(pthread_create(threads + i, NULL, UsePool, pool) == 0);
+	for(int i = 0; i < THREADS; i++) pthread_join(threads[i], NULL);
+	CHECK(setups <= 3 + THREADS);
+
+	DcpuPool_Destroy(&pool);
+	Dcpu_Destroy(&fresh);
+
+	// Without an image, zeroed
+	fresh = Dcpu_Create();
+	pool = DcpuPool_Create(NULL, NULL, NULL);
+	CHECK(fresh && pool);
+
+	a = DcpuPool_Acquire(pool);
+	CHECK(a);
+	Load(a);
+	Scribble(a);
+	DcpuPool_Release(pool, a);
+	CHECK(DcpuPool_Acquire(pool) == a);
+	CheckClean(a, fresh);
+	DcpuPool_Release(pool, a);
+
+	DcpuPool_Destroy(&pool);
+	Dcpu_Destroy(&fresh);
+	DcpuImage_Release(&image);
+
+	printf("ok\n");
+	return 0;
+}
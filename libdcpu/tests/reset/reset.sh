@@ -0,0 +1,10 @@
+#!/bin/bash
+echo " == Reset and pool == "
+set -e
+rm -rf /tmp/libdcpu_reset
+mkdir -p /tmp/libdcpu_reset
+../../../dasm/dasm guest.dasm /tmp/libdcpu_reset/guest.dbin
+
+gcc -std=gnu99 -Wall -I.. -I../../include -I../../src -I../../../common -o /tmp/libdcpu_reset/reset reset.c \
+	../../src/*.c ../../../common/common.c ../../../common/ramio.c ../../../common/threadpool.c -lpthread
+/tmp/libdcpu_reset/reset /tmp/libdcpu_reset/guest.dbin
@@ -0,0 +1,14 @@
+#!/bin/bash
+
+for t in "channel" "events" "device" "interrupts" "reset" "pacer" "image" "cores"
+do
+	cd $t && ./$t.sh && cd -
+	if [ $? != 0 ]; then
+		echo ""
+		echo "test: '$t' failed"
+		exit 1
+	fi
+done
+
+echo ""
+echo "all tests passed"
@@ -0,0 +1,61 @@
+// What the libdcpu tests share: checks, and calling into a guest program
+#ifndef TEST_H
+#define TEST_H
+
+#include "common.h"
+#include "dcpu.h"
+
+int logLevel = 3;
+
+#define CHECK(__v) do{ if(!(__v)){ printf("%s:%d: failed: %s\n", __FILE__, __LINE__, #__v); exit(1); } }while(0)
+
+// Guest programs used by the tests start with a table of the addresses the
+// host calls, see Call
+#define TABLE_DONE 0
+
+// Where Sys puts its instructions, out of the way of the programs
+#define SYS_AT 0xfff0
+
+// Runs a Dcpu until it exits (SYS 0) and lets it run again
+static inline void RunToExit(Dcpu* dcpu)
+{
+	while(Dcpu_Execute(dcpu, 1000) != DCPU_EXITED);
+	Dcpu_SetExit(dcpu, false);
+}
+
+// Calls the routine at table entry n of the program with A, B and C set, and
+// returns A. The routine returns to the SYS 0 at the table's first entry.
+static inline uint16_t Call(Dcpu* dcpu, int n, uint16_t a, uint16_t b, uint16_t c)
+{
+	uint16_t* ram = Dcpu_GetRam(dcpu);
+
+	Dcpu_SetRegister(dcpu, DR_A, a);
+	Dcpu_SetRegister(dcpu, DR_B, b);
+	Dcpu_SetRegister(dcpu, DR_C, c);
+	Dcpu_Push(dcpu, ram[TABLE_DONE]);
+	Dcpu_SetRegister(dcpu, DR_PC, ram[n]);
+
+	RunToExit(dcpu);
+	return Dcpu_GetRegister(dcpu, DR_A);
+}
+
+// Makes syscall id with A, B and C set, and returns A
+static inline uint16_t Sys(Dcpu* dcpu, uint16_t id, uint16_t a, uint16_t b, uint16_t c)
+{
+	uint16_t* ram = Dcpu_GetRam(dcpu);
+
+	ram[SYS_AT] = 0x7c20;      // SYS next word
+	ram[SYS_AT + 1] = id;
+	ram[SYS_AT + 2] = 0x8020;  // SYS 0
+	Dcpu_MarkDirty(dcpu, SYS_AT, 3);
+
+	Dcpu_SetRegister(dcpu, DR_A, a);
+	Dcpu_SetRegister(dcpu, DR_B, b);
+	Dcpu_SetRegister(dcpu, DR_C, c);
+	Dcpu_SetRegister(dcpu, DR_PC, SYS_AT);
+
+	RunToExit(dcpu);
+	return Dcpu_GetRegister(dcpu, DR_A);
+}
+
+#endif